@@ -0,0 +1,271 @@
+// sp - string formatting micro-library
+//
+// Written in 2017 by Johan Sköld
+//
+// To the extent possible under law, the author(s) have dedicated all
+// copyright and related and neighboring rights to this software to the public
+// domain worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <chrono> // std::chrono::steady_clock
+#include <cstdio> // std::snprintf, std::fprintf
+#include <cstdlib> // std::atoi
+#include <iomanip> // std::setw, std::setprecision
+#include <sstream> // std::ostringstream
+#include <string> // std::string
+
+#include "../include/sp.hpp"
+
+#if defined(_WIN32)
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+enum {
+    VALUE_COUNT = 64, // inputs cycled through, so no call formats a constant
+};
+
+static char s_buffer[4096];
+static FILE* s_null = nullptr;
+static std::ostringstream s_stream;
+static double s_minSeconds = 0.05;
+static volatile size_t s_sink = 0;
+
+static int s_ints[VALUE_COUNT];
+static unsigned s_uints[VALUE_COUNT];
+static double s_doubles[VALUE_COUNT];
+static std::string s_long;
+static std::string s_json;
+
+// Return the amount of characters written to `s_stream` by `fn`, after
+// clearing it.
+template <class Fn>
+static int stream_length(Fn&& fn)
+{
+    s_stream.str(std::string());
+    s_stream.clear();
+    s_stream.flags(std::ios::dec | std::ios::skipws);
+    s_stream.precision(6);
+    s_stream.fill(' ');
+    fn(s_stream);
+    return int(s_stream.tellp());
+}
+
+// Call `fn` with increasing indices until at least `s_minSeconds` have
+// passed, and print the time per call along with the throughput.
+template <class Fn>
+static void column(Fn&& fn)
+{
+    using Clock = std::chrono::steady_clock;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        s_sink = s_sink + size_t(fn(i % VALUE_COUNT));
+    }
+
+    size_t calls = 0;
+    size_t bytes = 0;
+    size_t batch = 1000;
+    double seconds = 0;
+
+    const auto start = Clock::now();
+    while (seconds < s_minSeconds) {
+        for (size_t i = 0; i < batch; ++i) {
+            bytes += size_t(fn(i % VALUE_COUNT));
+        }
+        calls += batch;
+        batch *= 2;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    s_sink = s_sink + bytes;
+    std::printf(" %9.1f %7.0f", seconds * 1e9 / double(calls), double(bytes) / seconds / 1e6);
+}
+
+static void missing()
+{
+    std::printf(" %9s %7s", "-", "-");
+}
+
+static void row(const char* name)
+{
+    std::printf("%-14s", name);
+}
+
+static void end_row()
+{
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+template <size_t N>
+static void header(const char* const (&columns)[N])
+{
+    std::printf("%-14s", "");
+    for (const auto column : columns) {
+        std::printf(" %17s", column);
+    }
+    std::printf("\n%-14s", "case");
+    for (size_t i = 0; i < N; ++i) {
+        std::printf(" %9s %7s", "ns/call", "MB/s");
+    }
+    std::printf("\n");
+}
+
+// Run a case formatting `fmt` with sp, at runtime and pre-compiled, and the
+// printf format `cfmt` with the C runtime. The arguments use `i` to cycle
+// through the inputs, and `stream` writes the same output to `out`.
+#define BENCH_CASE(name, fmt, cfmt, stream, ...)                                                            \
+    for (;;) {                                                                                              \
+        BENCH_SP(name, fmt, __VA_ARGS__);                                                                   \
+        column([](size_t i) { (void)i; return std::snprintf(s_buffer, sizeof(s_buffer), cfmt, __VA_ARGS__); });     \
+        column([](size_t i) { (void)i; return std::fprintf(s_null, cfmt, __VA_ARGS__); });                           \
+        BENCH_STREAM(stream);                                                                               \
+        break;                                                                                              \
+    }
+
+// Run a case that printf has no equivalent format for.
+#define BENCH_SP_CASE(name, fmt, stream, ...) \
+    for (;;) {                                \
+        BENCH_SP(name, fmt, __VA_ARGS__);     \
+        missing();                            \
+        missing();                            \
+        BENCH_STREAM(stream);                 \
+        break;                                \
+    }
+
+#define BENCH_SP(name, fmt, ...)                                                      \
+    static const sp::CompiledFormat<32> compiled(fmt);                                \
+    row(name);                                                                        \
+    column([](size_t i) { (void)i; return sp::format(s_buffer, fmt, __VA_ARGS__); });          \
+    column([](size_t i) { (void)i; return sp::format(s_buffer, compiled, __VA_ARGS__); });     \
+    column([](size_t i) { (void)i; return sp::format(s_null, fmt, __VA_ARGS__); })
+
+// Run a case formatting all `VALUE_COUNT` elements of `values` per call, one
+// value at a time with `fmt` and `cfmt`, and as a range with `spec`.
+#define BENCH_COLUMN(name, fmt, spec, cfmt, values)                                                     \
+    for (;;) {                                                                                          \
+        static const sp::CompiledFormat<2> compiled(fmt);                                               \
+        row(name);                                                                                      \
+        column([](size_t) {                                                                             \
+            sp::StringWriter writer(s_buffer, sizeof(s_buffer));                                        \
+            for (const auto value : values) {                                                           \
+                sp::format(writer, fmt, value);                                                         \
+            }                                                                                           \
+            return writer.result();                                                                     \
+        });                                                                                             \
+        column([](size_t) {                                                                             \
+            sp::StringWriter writer(s_buffer, sizeof(s_buffer));                                        \
+            for (const auto value : values) {                                                           \
+                sp::format(writer, compiled, value);                                                    \
+            }                                                                                           \
+            return writer.result();                                                                     \
+        });                                                                                             \
+        column([](size_t) {                                                                             \
+            sp::StringWriter writer(s_buffer, sizeof(s_buffer));                                        \
+            sp::format_range(writer, spec, values, values + VALUE_COUNT);                               \
+            return writer.result();                                                                     \
+        });                                                                                             \
+        column([](size_t) {                                                                             \
+            int length = 0;                                                                             \
+            for (const auto value : values) {                                                           \
+                length += std::snprintf(s_buffer + length, sizeof(s_buffer) - size_t(length), cfmt, value); \
+            }                                                                                           \
+            return length;                                                                              \
+        });                                                                                             \
+        end_row();                                                                                      \
+        break;                                                                                          \
+    }
+
+#define BENCH_STREAM(stream)                                                                   \
+    column([](size_t i) { (void)i; return stream_length([i](std::ostringstream& out) { (void)i; stream; }); }); \
+    end_row()
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        s_minSeconds = std::atoi(argv[1]) / 1000.0;
+    }
+
+    s_null = std::fopen(NULL_DEVICE, "w");
+    if (!s_null) {
+        std::fprintf(stderr, "failed to open %s\n", NULL_DEVICE);
+        return 1;
+    }
+
+    unsigned seed = 12345;
+    for (int i = 0; i < VALUE_COUNT; ++i) {
+        seed = seed * 1103515245 + 12345;
+        s_uints[i] = seed;
+        s_ints[i] = int(seed >> (i % 24)) * (i % 2 ? -1 : 1);
+        s_doubles[i] = double(int(seed % 2000000) - 1000000) / double(1 + (seed >> 20) % 1000);
+    }
+    s_long.assign(1024, 'x');
+
+    // mostly clean text, with a quote or newline to escape now and then
+    s_json.assign(1024, 'x');
+    for (size_t i = 100; i < s_json.size(); i += 100) {
+        s_json[i] = i % 200 ? '"' : '\n';
+    }
+
+// about 256 chars of markup, as in mostly-literal templates
+#define MARKUP                                                                     \
+    "<tr class=\"row\"><td class=\"label\">name</td><td class=\"value\">"         \
+    "<span class=\"detail\">-</span></td><td class=\"note\">none</td></tr>\n"     \
+    "<tr class=\"row\"><td class=\"label\">size</td><td class=\"value\">bytes"   \
+    "</td><td class=\"note\">rounded</td></tr><!-- end of the rows -->\n"
+
+#define I s_ints[i]
+#define U s_uints[i]
+#define D s_doubles[i]
+#define L s_long.c_str()
+#define J s_json.c_str()
+#define C int(65 + i % 26)
+
+    static const char* const columns[] = { "sp buffer", "sp compiled", "sp FILE*", "snprintf", "fprintf", "ostringstream" };
+    header(columns);
+
+    BENCH_CASE("int dec", "{}", "%d", out << I, I);
+    BENCH_CASE("int hex", "{:x}", "%x", out << std::hex << U, U);
+    BENCH_CASE("int HEX alt", "{:#X}", "%#X", out << std::hex << std::uppercase << std::showbase << U, U);
+    BENCH_CASE("int oct", "{:o}", "%o", out << std::oct << U, U);
+    BENCH_SP_CASE("int bin", "{:b}", out << U, U);
+    BENCH_CASE("int char", "{:c}", "%c", out << char(C), C);
+    BENCH_CASE("float default", "{}", "%.17g", out << std::setprecision(17) << D, D);
+    BENCH_CASE("float f", "{:f}", "%f", out << std::fixed << D, D);
+    BENCH_CASE("float .2f", "{:.2f}", "%.2f", out << std::fixed << std::setprecision(2) << D, D);
+    BENCH_CASE("float e", "{:e}", "%e", out << std::scientific << D, D);
+    BENCH_CASE("float g", "{:g}", "%g", out << D, D);
+    BENCH_SP_CASE("float %", "{:.1%}", out << std::fixed << std::setprecision(1) << D * 100 << '%', D);
+    BENCH_CASE("padded", "{:>12}|{:<8}|{:08.3f}", "%12d|%-8s|%08.3f",
+               out << std::setw(12) << I << '|' << std::left << std::setw(8) << "ab" << '|' << std::right << std::setfill('0') << std::setw(8) << std::fixed << std::setprecision(3) << D,
+               I, "ab", D);
+    BENCH_SP_CASE("centered", "{:*^24}", out << std::setw(24) << I, I);
+    BENCH_CASE("nested spec", "{2:{0}.{1}f}", "%*.*f", out << std::setw(12) << std::fixed << std::setprecision(3) << D, 12, 3, D);
+    BENCH_CASE("dynamic width", "{1:>{0}}|{3:<{2}}", "%*d|%-*s", out << std::setw(12) << I << '|' << std::left << std::setw(10) << "name", 12, I, 10, "name");
+    BENCH_CASE("long string", "{}", "%s", out << L, L);
+    BENCH_SP_CASE("json string", "{:j}",
+                  out << '"'; for (const auto ch : s_json) { if (ch == '"') out << "\\\""; else if (ch == '\n') out << "\\n"; else out << ch; } out << '"',
+                  J);
+    BENCH_CASE("many args", "{} {} {} {} {} {} {} {} {} {}", "%d %d %d %d %d %d %d %d %d %d",
+               out << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I << ' ' << I,
+               I, I, I, I, I, I, I, I, I, I);
+    BENCH_CASE("long literal", MARKUP MARKUP "{}" MARKUP MARKUP "{}" MARKUP, MARKUP MARKUP "%d" MARKUP MARKUP "%s" MARKUP,
+               out << MARKUP MARKUP << I << MARKUP MARKUP << "ab" << MARKUP, I, "ab");
+    BENCH_CASE("mixed", "{}: {} = {:.3f} ({:#x})", "%s: %d = %.3f (%#x)",
+               out << "key" << ": " << I << " = " << std::fixed << std::setprecision(3) << D << " (" << std::hex << std::showbase << U << ')',
+               "key", I, D, U);
+
+    static const char* const rangeColumns[] = { "sp per value", "sp compiled", "sp range", "snprintf" };
+    std::printf("\n%d values per call\n", int(VALUE_COUNT));
+    header(rangeColumns);
+
+    BENCH_COLUMN("column int", "{:>12}", ">12", "%12d", s_ints);
+    BENCH_COLUMN("column hex", "{:08x}", "08x", "%08x", s_uints);
+    BENCH_COLUMN("column .3f", "{:>12.3f}", ">12.3f", "%12.3f", s_doubles);
+
+    std::fclose(s_null);
+    return s_sink == 0x7fffffff ? 1 : 0;
+}
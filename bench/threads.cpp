@@ -0,0 +1,351 @@
+// sp - string formatting micro-library
+//
+// Written in 2017 by Johan Sköld
+//
+// To the extent possible under law, the author(s) have dedicated all
+// copyright and related and neighboring rights to this software to the public
+// domain worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <algorithm> // std::sort, std::min
+#include <atomic> // std::atomic
+#include <chrono> // std::chrono::steady_clock
+#include <cstdio> // std::snprintf, std::printf, std::tmpfile
+#include <cstdlib> // std::atoi, std::strtoul
+#include <cstring> // std::memcmp
+#include <string> // std::string
+#include <thread> // std::thread, std::this_thread::yield
+#include <vector> // std::vector
+
+#if defined(_WIN32)
+#include <io.h> // _close, _dup, _dup2, _fileno
+#define close _close
+#define dup _dup
+#define dup2 _dup2
+#define fileno _fileno
+#else
+#include <unistd.h> // close, dup, dup2
+#endif
+
+#define SP_ENABLE_ASYNC
+#include "../include/sp.hpp"
+
+// every message is a whole line, identifying its thread and sequence number so
+// that the output can be checked for torn, reordered or missing messages
+#define MESSAGE "{:02} {:08} {:>11} {:.3f}\n"
+#define CMESSAGE "%02u %08u %11d %.3f\n"
+#define ARGS(t, i) t, i, value(t, i), double(i) * 0.25
+
+enum {
+    MAX_LINE = 64,
+    BATCH_SIZE = 16 * 1024, // bytes each thread collects in "MemoryWriter 16K"
+};
+
+static unsigned s_maxThreads = 64;
+static unsigned s_messages = 100000; // in total, split between the threads
+static unsigned s_perThread = 0;
+static std::atomic<bool> s_go(false);
+
+struct ThreadState {
+    unsigned id = 0;
+    size_t bytes = 0; //< of output not written to a file
+    std::vector<uint32_t> latencies; //< of each call, in nanoseconds
+};
+
+/// Temporary file the messages of one measurement are written to.
+struct Output {
+    FILE* file = std::tmpfile();
+
+    ~Output()
+    {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+};
+
+static int value(unsigned thread, unsigned index)
+{
+    return int(thread * 2654435761u + index * 40503u) >> 1;
+}
+
+// Wait for all threads to be started, then call `fn(thread, index)` for each
+// message of the thread, recording how long every call takes.
+template <class Fn>
+static void messages(ThreadState& state, Fn&& fn)
+{
+    using Clock = std::chrono::steady_clock;
+
+    while (!s_go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    for (unsigned i = 0; i < s_perThread; ++i) {
+        const auto start = Clock::now();
+        state.bytes += size_t(fn(state.id, i));
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        state.latencies[i] = uint32_t(std::min<long long>(nanoseconds, 0xffffffff));
+    }
+}
+
+// Read back the output of `threads` threads from `file`, and return the
+// amount of messages that are malformed, out of order or missing.
+static size_t violations(FILE* file, unsigned threads)
+{
+    std::fseek(file, 0, SEEK_END);
+    std::string output(size_t(std::ftell(file)), '\0');
+    std::rewind(file);
+    if (std::fread(&output[0], 1, output.size(), file) != output.size()) {
+        return size_t(-1);
+    }
+
+    std::vector<unsigned> next(threads, 0);
+    std::vector<unsigned> received(threads, 0);
+    size_t count = 0;
+
+    for (size_t start = 0; start < output.size();) {
+        auto end = output.find('\n', start);
+        if (end == std::string::npos) {
+            ++count;
+            break;
+        }
+        ++end;
+
+        const auto line = output.c_str() + start;
+        char* parsed;
+        const auto thread = unsigned(std::strtoul(line, &parsed, 10));
+        const auto index = unsigned(std::strtoul(parsed, nullptr, 10));
+
+        char expected[MAX_LINE];
+        const auto length = size_t(std::snprintf(expected, sizeof(expected), CMESSAGE, ARGS(thread, index)));
+
+        if (thread >= threads || length != end - start || std::memcmp(expected, line, length) != 0) {
+            ++count;
+        } else {
+            count += index != next[thread] ? 1 : 0;
+            next[thread] = index + 1;
+            ++received[thread];
+        }
+
+        start = end;
+    }
+
+    for (const auto got : received) {
+        count += got < s_perThread ? s_perThread - got : 0;
+    }
+
+    return count;
+}
+
+// Run `body` on `threads` threads at once, and call `finish` once they are all
+// done, before checking the messages written to `output` (if any). Then print
+// the aggregate throughput, the percentiles of the call latencies, and the
+// amount of broken messages.
+template <class Body, class Finish>
+static void measure(unsigned threads, Output* output, Body&& body, Finish&& finish)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<ThreadState> states(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        states[t].id = t;
+        states[t].latencies.resize(s_perThread);
+        workers.emplace_back([&body, &states, t]() { body(states[t]); });
+    }
+
+    const auto start = Clock::now();
+    s_go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    finish();
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    s_go.store(false, std::memory_order_relaxed);
+
+    std::vector<uint32_t> latencies;
+    size_t bytes = 0;
+    for (const auto& state : states) {
+        latencies.insert(latencies.end(), state.latencies.begin(), state.latencies.end());
+        bytes += state.bytes;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const auto percentile = [&latencies](double fraction) {
+        return latencies[std::min(latencies.size() - 1, size_t(fraction * double(latencies.size())))];
+    };
+
+    if (output) {
+        std::fflush(output->file);
+        bytes = size_t(std::ftell(output->file));
+    }
+
+    const auto count = double(latencies.size());
+    std::printf(" %7u %9.2f %8.0f %8u %8u %8u", threads, count / seconds / 1e6, double(bytes) / seconds / 1e6,
+                percentile(0.5), percentile(0.99), percentile(0.999));
+
+    if (output) {
+        std::printf(" %10zu\n", violations(output->file, threads));
+    } else {
+        std::printf(" %10s\n", "-");
+    }
+    std::fflush(stdout);
+}
+
+static void bench_buffer(unsigned threads)
+{
+    measure(threads, nullptr, [](ThreadState& state) {
+        char buffer[MAX_LINE];
+        messages(state, [&buffer](unsigned t, unsigned i) { return sp::format(buffer, MESSAGE, ARGS(t, i)); });
+    }, []() {});
+}
+
+static void bench_print(unsigned threads)
+{
+    Output output;
+
+    // send stdout to the output for the duration of the measurement
+    std::fflush(stdout);
+    const auto saved = dup(fileno(stdout));
+    dup2(fileno(output.file), fileno(stdout));
+
+    measure(threads, &output, [](ThreadState& state) {
+        messages(state, [](unsigned t, unsigned i) {
+            sp::print(MESSAGE, ARGS(t, i));
+            return 0;
+        });
+    }, [saved]() {
+        std::fflush(stdout);
+        dup2(saved, fileno(stdout));
+        close(saved);
+    });
+}
+
+static void bench_file(unsigned threads)
+{
+    Output output;
+    measure(threads, &output, [&output](ThreadState& state) {
+        messages(state, [&output](unsigned t, unsigned i) {
+            sp::format(output.file, MESSAGE, ARGS(t, i));
+            return 0;
+        });
+    }, []() {});
+}
+
+static void bench_stream(unsigned threads)
+{
+    Output output;
+    measure(threads, &output, [&output](ThreadState& state) {
+        messages(state, [&output](unsigned t, unsigned i) {
+            sp::StreamWriter writer(output.file);
+            sp::format(writer, MESSAGE, ARGS(t, i));
+            return 0;
+        });
+    }, []() {});
+}
+
+static void bench_stream_kept(unsigned threads)
+{
+    Output output;
+    measure(threads, &output, [&output](ThreadState& state) {
+        sp::StreamWriter writer(output.file);
+        messages(state, [&writer](unsigned t, unsigned i) {
+            sp::format(writer, MESSAGE, ARGS(t, i));
+            return 0;
+        });
+    }, []() {});
+}
+
+static void bench_memory(unsigned threads)
+{
+    Output output;
+    measure(threads, &output, [&output](ThreadState& state) {
+        sp::MemoryWriter writer;
+        messages(state, [&writer, &output](unsigned t, unsigned i) {
+            sp::format(writer, MESSAGE, ARGS(t, i));
+            if (writer.length() >= BATCH_SIZE || i + 1 == s_perThread) {
+                std::fwrite(writer.data(), 1, writer.length(), output.file);
+                writer.clear();
+            }
+            return 0;
+        });
+    }, []() {});
+}
+
+static void bench_async(unsigned threads)
+{
+    Output output;
+    sp::AsyncStream stream(output.file);
+    measure(threads, &output, [&stream](ThreadState& state) {
+        messages(state, [&stream](unsigned t, unsigned i) {
+            sp::format(stream, MESSAGE, ARGS(t, i));
+            return 0;
+        });
+    }, [&stream]() { stream.flush(); });
+}
+
+static void bench_deferred(unsigned threads)
+{
+    Output output;
+    sp::StreamWriter writer(output.file);
+    sp::DeferredWriter deferred(writer);
+    measure(threads, &output, [&deferred](ThreadState& state) {
+        sp::DeferredQueue queue;
+        deferred.attach(queue);
+        messages(state, [&queue](unsigned t, unsigned i) {
+            while (!sp::format(queue, MESSAGE, ARGS(t, i))) {
+                std::this_thread::yield();
+            }
+            return 0;
+        });
+        deferred.detach(queue);
+    }, [&deferred, &writer]() {
+        deferred.flush();
+        writer.flush();
+    });
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        s_maxThreads = unsigned(std::max(1, std::atoi(argv[1])));
+    }
+    if (argc > 2) {
+        s_messages = unsigned(std::max(1, std::atoi(argv[2])));
+    }
+
+    struct Case {
+        const char* name;
+        void (*run)(unsigned threads);
+    };
+
+    static const Case cases[] = {
+        { "sp buffer", bench_buffer },
+        { "sp::print", bench_print },
+        { "sp FILE*", bench_file },
+        { "StreamWriter", bench_stream },
+        { "StreamWriter kept", bench_stream_kept },
+        { "MemoryWriter 16K", bench_memory },
+        { "AsyncStream", bench_async },
+        { "DeferredQueue", bench_deferred },
+    };
+
+    std::printf("%u messages per measurement, %u hardware threads\n\n", s_messages, std::thread::hardware_concurrency());
+    std::printf("%-18s %7s %9s %8s %8s %8s %8s %10s\n", "case", "threads", "Mmsg/s", "MB/s", "p50 ns", "p99 ns", "p999 ns", "violations");
+
+    for (const auto& test : cases) {
+        for (unsigned threads = 1;; threads = std::min(threads * 2, s_maxThreads)) {
+            s_perThread = std::max(1u, s_messages / threads);
+            std::printf("%-18s", test.name);
+            test.run(threads);
+
+            if (threads == s_maxThreads) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -11,15 +11,129 @@
 
 #pragma once
 
-#include <cmath> // NAN, INFINITY
+// With `SP_SEPARATE_IMPLEMENTATION` defined, the formatting engine is left
+// out and only declared, and one translation unit defining `SP_IMPLEMENTATION`
+// compiles it. Without either, everything is inline.
+#if defined(SP_IMPLEMENTATION)
+#    define SP_DEFINE_ENGINE 1
+#    define SP_INLINE
+#elif defined(SP_SEPARATE_IMPLEMENTATION)
+#    define SP_DEFINE_ENGINE 0
+#else
+#    define SP_DEFINE_ENGINE 1
+#    define SP_INLINE inline
+#endif
+
 #include <cstddef> // std::nullptr_t
 #include <cstdint> // int32_t, uint64_t
-#include <cstdio> // std::snprintf, std::FILE, std::fwrite
+#include <cstdio> // std::FILE, std::fwrite
+#include <cstdlib> // std::malloc, std::free
 #include <cstring> // std::memcpy
-#include <cctype> // std::isupper
 #include <algorithm> // std::min, std::max
+#include <iterator> // std::begin, std::end
 #include <limits> // std::numeric_limits
-#include <utility> // std::forward
+#include <tuple> // std::tuple_size, std::get
+#include <type_traits> // std::true_type, std::false_type
+#include <utility> // std::forward, std::declval
+
+#if defined(SP_ENABLE_POSIX)
+#    include <cerrno> // errno, EINTR
+#    include <sys/mman.h> // mmap, munmap
+#    include <sys/uio.h> // iovec
+#    include <unistd.h> // write, ftruncate, sysconf
+#endif
+
+#if SP_DEFINE_ENGINE
+#    include <cmath> // std::isnan, std::isinf, std::ceil
+#endif
+
+#if defined(SP_ENABLE_STATS) && SP_DEFINE_ENGINE
+#    include <atomic> // std::atomic
+#    include <chrono> // std::chrono::steady_clock
+#    include <thread> // std::this_thread::yield
+#    if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#        include <intrin.h> // __rdtsc
+#        define SP_STATS_RDTSC
+#    elif defined(__x86_64__) || defined(__i386__)
+#        include <x86intrin.h> // __rdtsc
+#        define SP_STATS_RDTSC
+#    endif
+#    if !defined(SP_STATS_CAPACITY)
+#        define SP_STATS_CAPACITY 1024
+#    endif
+#    if !defined(SP_STATS_FORMAT_LENGTH)
+#        define SP_STATS_FORMAT_LENGTH 120
+#    endif
+#endif
+
+#if defined(SP_ENABLE_CHRONO)
+#    include <chrono> // std::chrono::time_point, std::chrono::duration
+#endif
+
+#if defined(SP_ENABLE_ASYNC)
+#    include <atomic> // std::atomic
+#    include <chrono> // std::chrono::microseconds
+#    include <condition_variable> // std::condition_variable
+#    include <mutex> // std::mutex, std::lock_guard, std::unique_lock
+#    include <thread> // std::thread, std::this_thread
+#endif
+
+#if !defined(SP_DISABLE_SIMD) && SP_DEFINE_ENGINE
+#    if defined(__AVX2__)
+#        include <immintrin.h> // _mm256_cmpeq_epi8, _mm256_movemask_epi8
+#        define SP_SIMD_AVX2
+#        define SP_SIMD_SSE2
+#    elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#        include <emmintrin.h> // _mm_cmpeq_epi8, _mm_movemask_epi8
+#        define SP_SIMD_SSE2
+#    elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#        include <arm_neon.h> // vceqq_u8, vshrn_n_u16
+#        define SP_SIMD_NEON
+#    endif
+#endif
+
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+#    define SP_CONSTEXPR14 constexpr
+#    define SP_HAS_CONSTEXPR14 1
+#else
+#    define SP_CONSTEXPR14
+#    define SP_HAS_CONSTEXPR14 0
+#endif
+
+// whether a constexpr function is being evaluated at compile time, assuming
+// it is if that can't be told
+#if !SP_HAS_CONSTEXPR14
+#    define SP_CONSTANT_EVALUATED() false
+#elif defined(__has_builtin)
+#    if __has_builtin(__builtin_is_constant_evaluated)
+#        define SP_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#    endif
+#elif (defined(__GNUC__) && __GNUC__ >= 9) || (defined(_MSC_VER) && _MSC_VER >= 1925)
+#    define SP_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+#if !defined(SP_CONSTANT_EVALUATED)
+#    define SP_CONSTANT_EVALUATED() true
+#endif
+
+// keeps the formatting engine out of the call sites, so each of them only
+// packs its arguments and makes a call
+#if defined(_MSC_VER)
+#    define SP_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__) || defined(__clang__)
+#    define SP_NOINLINE __attribute__((noinline))
+#else
+#    define SP_NOINLINE
+#endif
+
+/// Create a `sp::FormatLiteral` from the provided string literal.
+#define SP_FMT(str)                                                        \
+    ([] {                                                                  \
+        struct Literal : sp::FormatLiteral<Literal> {                      \
+            static constexpr const char* data() { return str; }            \
+            static constexpr ptrdiff_t size() { return sizeof(str) - 1; }  \
+        };                                                                 \
+        return Literal();                                                  \
+    }())
 
 ///
 // API
@@ -33,38 +147,278 @@ namespace sp {
         virtual size_t write(size_t length, const void* data) = 0;
     };
 
+    /// Allocator interface for writers that grow their buffer.
+    struct IAllocator {
+        /// Allocate `size` bytes. Return `nullptr` on failure.
+        virtual void* allocate(size_t size) = 0;
+
+        /// Free memory previously returned by `allocate`, of the provided size.
+        virtual void deallocate(void* ptr, size_t size) = 0;
+    };
+
+    class BufferedWriter;
+    class MemoryWriter;
+    class BinaryLogWriter;
+#if defined(SP_ENABLE_ASYNC)
+    class AsyncStream;
+    class DeferredQueue;
+    struct IBatchExecutor;
+#endif
+
     /// View into a string.
     struct StringView {
         const char* ptr = nullptr; //< Pointer to the string.
-        int32_t length = 0; //< Length of the string.
+        ptrdiff_t length = 0; //< Length of the string.
 
         /// Construct an empty StringView.
-        StringView();
+        constexpr StringView();
 
         /// Construct a StringView from the provided null-terminated string.
         StringView(const char str[]);
 
         /// Construct a StringView from the provided string, with the provided
         /// length (in `char`).
-        StringView(const char str[], int32_t length);
+        constexpr StringView(const char str[], ptrdiff_t length);
+    };
+
+    /// String that outlives any deferred formatting of it, such as a string
+    /// literal. Deferred formats reference it rather than copy it.
+    struct StaticString {
+        StringView str; //< The referenced string.
+    };
+
+    /// Mark the provided string as static.
+    StaticString static_string(const StringView& str);
+
+    /// Parsed format specifier flags.
+    struct FormatFlags {
+        char fill = 0; //< Fill character, or `0` for the default.
+        char align = 0; //< Alignment (`<`, `>`, `^` or `=`), or `0` for the default.
+        char sign = 0; //< Sign option (`+`, `-` or ` `), or `0` for the default.
+        bool alternate = false; //< Whether `#` was specified.
+        int32_t width = -1; //< Minimum width, or `-1` if not specified.
+        int32_t precision = -1; //< Precision, or `-1` if not specified.
+        char type = 0; //< Presentation type, or `0` if not specified.
+    };
+
+    /// Parse the provided format specifier into `flags`. Return `false` if the
+    /// format specifier is invalid.
+    SP_CONSTEXPR14 bool parse_format(const StringView& fmt, FormatFlags* flags);
+
+    /// Replacement field of a format string.
+    struct FormatField {
+        StringView spec; //< Format specifier, without the leading `:`.
+        StringView raw; //< The entire field, braces included.
+        int32_t index = -1; //< Index of the argument to format.
+        bool nested = false; //< Whether `spec` contains nested fields.
+    };
+
+    /// Segment of a format string; literal text, optionally followed by a
+    /// replacement field.
+    struct FormatToken {
+        StringView literal; //< Literal text to output as-is.
+        FormatField field; //< Replacement field following `literal`.
+        bool hasField = false; //< Whether `field` is set.
+    };
+
+    /// Splits a format string into `FormatToken`s.
+    class FormatTokenizer {
+    public:
+        /// Construct a tokenizer for the provided format. Indices of
+        /// non-indexed fields are determined from, and written to,
+        /// `prevIndex`.
+        SP_CONSTEXPR14 FormatTokenizer(const StringView& fmt, int32_t* prevIndex);
+
+        /// Read the next token of the format. Return `false` once the entire
+        /// format has been consumed.
+        SP_CONSTEXPR14 bool next(FormatToken* token);
+
+    private:
+        const char* m_next;
+        const char* m_term;
+        int32_t* m_prevIndex;
+    };
+
+    /// Pre-parsed segment of a `CompiledFormat`.
+    struct FormatSegment {
+        FormatToken token; //< The tokenized segment.
+        FormatFlags flags; //< Parsed `token.field.spec`, if `parsed` is set.
+        bool parsed = false; //< Whether `flags` holds a valid parsed spec.
+    };
+
+    /// Format string that has been split into its literal text and
+    /// replacement fields ahead of time, so formatting with it does not have
+    /// to tokenize the format or parse the format specifiers of the fields.
+    /// It may hold up to `N` segments, where each replacement field and each
+    /// escaped brace ends a segment. Formats needing more than that are
+    /// instead parsed at the time of formatting. The format string itself
+    /// must outlive the `CompiledFormat`.
+    template <size_t N>
+    class CompiledFormat {
+    public:
+        /// Compile the provided null-terminated string literal.
+        template <size_t L>
+        SP_CONSTEXPR14 CompiledFormat(const char (&fmt)[L]);
+
+        /// Compile the provided format string.
+        SP_CONSTEXPR14 CompiledFormat(const StringView& fmt);
+
+        /// Return the format string this format was compiled from.
+        constexpr const StringView& source() const;
+
+        /// Return whether the format was split into segments, i.e. whether it
+        /// did not exceed the segment capacity.
+        constexpr bool compiled() const;
+
+        /// Return the first segment of the format.
+        constexpr const FormatSegment* begin() const;
+
+        /// Return the end of the segments of the format.
+        constexpr const FormatSegment* end() const;
+
+    private:
+        SP_CONSTEXPR14 void compile();
+
+        StringView m_source;
+        FormatSegment m_segments[N ? N : 1];
+        size_t m_count = 0;
+        bool m_compiled = false;
+    };
+
+    /// Type-erased format argument. Arithmetic values are stored by value,
+    /// while strings and custom types are referenced, and must outlive the
+    /// argument.
+    struct FormatArg {
+        /// Function formatting a referenced custom type. `flags` holds
+        /// the pre-parsed `spec`, or is `nullptr` if it has not been parsed.
+        using FormatFn = bool (*)(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const void* value);
+
+        enum Type : uint8_t {
+            TYPE_NONE,
+            TYPE_BOOL,
+            TYPE_CHAR,
+            TYPE_INT,
+            TYPE_UINT,
+            TYPE_FLOAT,
+            TYPE_DOUBLE,
+            TYPE_STRING,
+            TYPE_POINTER,
+            TYPE_CUSTOM,
+        };
+
+        union Value {
+            bool b;
+            char32_t c;
+            long long i;
+            unsigned long long u;
+            float f;
+            double d;
+            const void* p;
+
+            struct {
+                const char* ptr;
+                ptrdiff_t length;
+            } string;
+
+            struct {
+                const void* value;
+                FormatFn format;
+            } custom;
+        };
+
+        Value value = {}; //< The argument value, as determined by `type`.
+        Type type = TYPE_NONE; //< Type of the argument.
+    };
+
+    /// View into a list of type-erased format arguments.
+    class FormatArgs {
+    public:
+        /// Construct an empty list of arguments.
+        FormatArgs();
+
+        /// Construct a view into the provided arguments.
+        FormatArgs(const FormatArg args[], int32_t count);
+
+        /// Return the amount of arguments.
+        int32_t size() const;
+
+        /// Return the argument at the provided index, or a `TYPE_NONE`
+        /// argument if the index is out of range.
+        const FormatArg& operator[](int32_t index) const;
+
+    private:
+        const FormatArg* m_args;
+        int32_t m_count;
+    };
+
+    /// Storage for `N` type-erased format arguments.
+    template <size_t N>
+    struct FormatArgStore {
+        FormatArg args[N ? N : 1];
+
+        /// Return a view into the stored arguments.
+        operator FormatArgs() const;
     };
 
+    /// Type-erase the provided format arguments, so they may be stored and
+    /// formatted later with `vformat`.
+    template <class... Args>
+    FormatArgStore<sizeof...(Args)> make_format_args(Args&&... args);
+
+    /// Print to the provided writer using the provided format with the
+    /// provided type-erased format arguments.
+    void vformat(IWriter& writer, const StringView& fmt, const FormatArgs& args);
+    void vformat(BufferedWriter& writer, const StringView& fmt, const FormatArgs& args);
+
+    /// Print to the provided writer using the provided pre-compiled format
+    /// with the provided type-erased format arguments.
+    template <size_t F>
+    void vformat(IWriter& writer, const CompiledFormat<F>& fmt, const FormatArgs& args);
+    template <size_t F>
+    void vformat(BufferedWriter& writer, const CompiledFormat<F>& fmt, const FormatArgs& args);
+
     /// Print to standard out using the provided format with the provided
     /// format arguments. Return the amount of `char`s written, or `-1` in case
     /// of an error.
     template <class... Args>
-    int32_t print(const StringView& fmt, Args&&... args);
+    ptrdiff_t print(const StringView& fmt, Args&&... args);
 
     /// Print to the provided writer using the provided format with the
     /// provided format arguments.
     template <class... Args>
     void format(IWriter& writer, const StringView& fmt, Args&&... args);
+    template <class... Args>
+    void format(BufferedWriter& writer, const StringView& fmt, Args&&... args);
 
     /// Print to the provided FILE stream using the provided format with the
     /// provided format arguments. Return the amount of `char`s written, or
-    /// `-1` in case of an error.
+    /// `-1` in case of an error. The message is formatted into a per-thread
+    /// buffer first, and written to the stream with a single write.
+    template <class... Args>
+    ptrdiff_t format(std::FILE* file, const StringView& fmt, Args&&... args);
+
+#if defined(SP_ENABLE_ASYNC)
+    /// Queue a message for the provided asynchronous stream, using the
+    /// provided format with the provided format arguments. Return the amount
+    /// of `char`s queued, or `-1` in case of an error.
+    template <class... Args>
+    ptrdiff_t format(AsyncStream& stream, const StringView& fmt, Args&&... args);
+
+    /// Queue the provided format and format arguments, to be formatted later
+    /// by the `DeferredWriter` the queue is attached to. The format string
+    /// must outlive the queued message. Strings are copied unless marked
+    /// with `static_string`, and custom types must be trivially copyable.
+    /// Return `false` if the queue is full, in which case nothing is queued.
+    template <class... Args>
+    bool format(DeferredQueue& queue, const StringView& fmt, Args&&... args);
+#endif
+
+    /// Write a binary record of the provided format and format arguments to
+    /// the provided binary log, to be formatted later by a `BinaryLogReader`.
+    /// The format string must outlive the log without changing, and only
+    /// arithmetic types, pointers and strings may be passed.
     template <class... Args>
-    int32_t format(std::FILE* file, const StringView& fmt, Args&&... args);
+    void format(BinaryLogWriter& log, const StringView& fmt, Args&&... args);
 
     /// Print to the provided buffer of the provided size, using the provided
     /// format string with the provided format arguments. Return the amount of
@@ -72,7 +426,7 @@ namespace sp {
     /// not big enough to hold the entire result, the returned value may be
     /// larger than the buffer size. Return `-1` in case of an error.
     template <class... Args>
-    int32_t format(char buffer[], size_t size, const StringView& fmt, Args&&... args);
+    ptrdiff_t format(char buffer[], size_t size, const StringView& fmt, Args&&... args);
 
     /// Print to the provided statically sized buffer, using the provided
     /// format string with the provided format arguments. Return the amount of
@@ -80,7 +434,230 @@ namespace sp {
     /// not big enough to hold the entire result, the returned value may be
     /// larger than the buffer size. Return `-1` in case of an error.
     template <size_t N, class... Args>
-    int32_t format(char (&buffer)[N], const StringView& fmt, Args&&... args);
+    ptrdiff_t format(char (&buffer)[N], const StringView& fmt, Args&&... args);
+
+    /// Return the amount of `char`s that formatting the provided format with
+    /// the provided format arguments results in, without producing them.
+    template <class... Args>
+    ptrdiff_t formatted_size(const StringView& fmt, Args&&... args);
+
+    /// Print to a growable, heap allocated buffer using the provided format
+    /// with the provided format arguments, and return the buffer. Memory is
+    /// allocated through `allocator` if provided.
+    template <class... Args>
+    MemoryWriter format_to_string(const StringView& fmt, Args&&... args);
+    template <class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const StringView& fmt, Args&&... args);
+
+    /// Print to standard out using the provided pre-compiled format.
+    template <size_t F, class... Args>
+    ptrdiff_t print(const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Print to the provided writer using the provided pre-compiled format.
+    template <size_t F, class... Args>
+    void format(IWriter& writer, const CompiledFormat<F>& fmt, Args&&... args);
+    template <size_t F, class... Args>
+    void format(BufferedWriter& writer, const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Print to the provided FILE stream using the provided pre-compiled
+    /// format.
+    template <size_t F, class... Args>
+    ptrdiff_t format(std::FILE* file, const CompiledFormat<F>& fmt, Args&&... args);
+
+#if defined(SP_ENABLE_ASYNC)
+    /// Queue a message for the provided asynchronous stream, using the
+    /// provided pre-compiled format.
+    template <size_t F, class... Args>
+    ptrdiff_t format(AsyncStream& stream, const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Queue the provided pre-compiled format and format arguments, to be
+    /// formatted later. The compiled format must outlive the queued message.
+    template <size_t F, class... Args>
+    bool format(DeferredQueue& queue, const CompiledFormat<F>& fmt, Args&&... args);
+#endif
+
+    /// Print to the provided buffer of the provided size, using the provided
+    /// pre-compiled format.
+    template <size_t F, class... Args>
+    ptrdiff_t format(char buffer[], size_t size, const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Print to the provided statically sized buffer, using the provided
+    /// pre-compiled format.
+    template <size_t N, size_t F, class... Args>
+    ptrdiff_t format(char (&buffer)[N], const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Return the amount of `char`s that formatting the provided pre-compiled
+    /// format results in, without producing them.
+    template <size_t F, class... Args>
+    ptrdiff_t formatted_size(const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Print to a growable, heap allocated buffer using the provided
+    /// pre-compiled format, and return the buffer.
+    template <size_t F, class... Args>
+    MemoryWriter format_to_string(const CompiledFormat<F>& fmt, Args&&... args);
+    template <size_t F, class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const CompiledFormat<F>& fmt, Args&&... args);
+
+    /// Print each value in the range [`begin`, `end`) to the provided writer
+    /// using the same format specifier, such as `>12.3f`, with `separator`
+    /// written between the values. The specifier is only parsed once for the
+    /// entire range. Return `false` if a value could not be formatted with
+    /// the specifier, in which case no further values are written.
+    template <class Iterator>
+    bool format_range(IWriter& writer, const StringView& spec, Iterator begin, Iterator end, const StringView& separator = StringView());
+    template <class Iterator>
+    bool format_range(BufferedWriter& writer, const StringView& spec, Iterator begin, Iterator end, const StringView& separator = StringView());
+
+    /// Print `count` rows to the provided writer, using the provided format
+    /// for each row. The arguments of row `i` are element `i` of each of the
+    /// provided columns. The format is compiled once for all rows.
+    template <class... Columns>
+    void format_columns(IWriter& writer, const StringView& fmt, size_t count, const Columns*... columns);
+    template <class... Columns>
+    void format_columns(BufferedWriter& writer, const StringView& fmt, size_t count, const Columns*... columns);
+    template <size_t F, class... Columns>
+    void format_columns(IWriter& writer, const CompiledFormat<F>& fmt, size_t count, const Columns*... columns);
+    template <size_t F, class... Columns>
+    void format_columns(BufferedWriter& writer, const CompiledFormat<F>& fmt, size_t count, const Columns*... columns);
+
+#if defined(SP_ENABLE_ASYNC)
+    /// Print `count` records to the provided buffer of the provided size, in
+    /// parallel, with `fn(BufferedWriter& writer, size_t index)` formatting
+    /// record `index`. Chunks of records are measured first, and then
+    /// formatted straight into their place in the buffer, so `fn` must write
+    /// the same output every time, and may be called from any thread. The
+    /// chunks are run by `executor`, or on one thread per hardware thread if
+    /// `nullptr`. Return the amount of `char`s of all records, which may be
+    /// larger than the buffer size if it was not big enough.
+    template <class Fn>
+    ptrdiff_t format_batch(char buffer[], size_t size, size_t count, const Fn& fn, IBatchExecutor* executor = nullptr);
+
+    /// Print `count` records to the provided writer in order, formatting
+    /// chunks of them in parallel into buffers of their own before writing
+    /// them, as above. Return the amount of `char`s written, or `-1` if a
+    /// buffer failed to grow or the writer did not take all of a chunk, in
+    /// which case no further chunks are written.
+    template <class Fn>
+    ptrdiff_t format_batch(IWriter& writer, size_t count, const Fn& fn, IBatchExecutor* executor = nullptr);
+#endif
+
+#if defined(SP_ENABLE_STATS)
+    /// Counters of a format string, kept for every format string formatted
+    /// with `vformat` (and thereby `format`, `print` and the like) while
+    /// `SP_ENABLE_STATS` is defined. Format strings are told apart by their
+    /// text, which is copied when first seen, so formats need not outlive the
+    /// calls formatting them, and equal strings are counted together wherever
+    /// they are stored. Up to `SP_STATS_CAPACITY` (1024 by default) format
+    /// strings are tracked, and up to `SP_STATS_FORMAT_LENGTH` (120 by
+    /// default) `char`s of each are kept.
+    struct FormatStats {
+        StringView format; //< The format string, or as much of it as was kept.
+        ptrdiff_t length = 0; //< Length of the whole format string.
+        uint64_t calls = 0; //< Amount of times it was formatted.
+        uint64_t bytes = 0; //< Bytes of output, including any that were discarded.
+        uint64_t truncations = 0; //< Amount of times output was discarded by the writer.
+        uint64_t ticks = 0; //< Time spent formatting it, in `stats_ticks` units.
+    };
+
+    /// Return the current time in the units of `FormatStats::ticks`; CPU
+    /// cycles where the time stamp counter is available, and nanoseconds
+    /// otherwise.
+    uint64_t stats_ticks();
+
+    /// Copy the counters of up to `capacity` format strings into `stats`.
+    /// Return the amount of format strings tracked, which may be more than
+    /// `capacity`.
+    size_t format_stats(FormatStats stats[], size_t capacity);
+
+    /// Reset the counters of all format strings.
+    void reset_format_stats();
+
+    /// Print the counters of all format strings to the provided writer, one
+    /// per line, with those that took the most time first.
+    void dump_format_stats(IWriter& writer);
+    void dump_format_stats(std::FILE* file);
+#endif
+
+    /// Result of checking a format against the types of its arguments.
+    enum FormatCheck {
+        FORMAT_OK, //< The format is valid for the arguments.
+        FORMAT_INVALID_FIELD, //< A replacement field is malformed, and would be output as-is.
+        FORMAT_INVALID_SPEC, //< A format specifier can not be parsed.
+        FORMAT_TYPE_MISMATCH, //< A format specifier does not apply to the type of its argument.
+        FORMAT_MISSING_ARG, //< A replacement field refers to an argument that was not provided.
+        FORMAT_UNUSED_ARG, //< An argument is not referred to by any replacement field.
+    };
+
+    /// Check the provided format against arguments of the provided types.
+    /// The specifiers of custom types, and of fields with nested fields, are
+    /// not checked. Only the first 64 arguments are checked for being used.
+    SP_CONSTEXPR14 FormatCheck check_format(const StringView& fmt, const FormatArg::Type* types, int32_t count);
+
+    /// Type-erased argument type that values of type `T` are formatted as.
+    template <class T>
+    struct FormatArgType;
+
+    /// Format string literal, as created by `SP_FMT`. When compiled as C++14
+    /// or later, formatting with it checks the format against the types of
+    /// the arguments at compile time, and formats with a `CompiledFormat`
+    /// that was compiled at compile time too. `S` provides the literal, with
+    /// static `data()` and `size()` functions.
+    template <class S>
+    struct FormatLiteral {
+    };
+
+    template <class S>
+    struct LiteralFormat;
+
+    /// Print to standard out using the provided format literal.
+    template <class S, class... Args>
+    ptrdiff_t print(const FormatLiteral<S>& fmt, Args&&... args);
+
+    /// Print to the provided output using the provided format literal. Any
+    /// output accepted along with a `CompiledFormat` may be used.
+    template <class Output, class S, class... Args>
+    auto format(Output&& output, const FormatLiteral<S>& fmt, Args&&... args)
+        -> decltype(format(output, LiteralFormat<S>::get(), std::forward<Args>(args)...));
+
+    /// Print to the provided buffer of the provided size, using the provided
+    /// format literal.
+    template <class S, class... Args>
+    ptrdiff_t format(char buffer[], size_t size, const FormatLiteral<S>& fmt, Args&&... args);
+
+    /// Return the amount of `char`s that formatting the provided format
+    /// literal results in, without producing them.
+    template <class S, class... Args>
+    ptrdiff_t formatted_size(const FormatLiteral<S>& fmt, Args&&... args);
+
+    /// Print to a growable, heap allocated buffer using the provided format
+    /// literal, and return the buffer.
+    template <class S, class... Args>
+    MemoryWriter format_to_string(const FormatLiteral<S>& fmt, Args&&... args);
+    template <class S, class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const FormatLiteral<S>& fmt, Args&&... args);
+
+    /// Formatter for a custom type `T`, as an alternative to overloading
+    /// `format_value`. Its format specifier is parsed into a `State` once,
+    /// and the parsed state is then reused whenever the same specifier is
+    /// formatted again on the same thread. Specializations must provide:
+    ///
+    ///     using State = ...; // default constructible and copyable
+    ///     static bool parse(const StringView& spec, State* state);
+    ///     static bool format(IWriter& writer, const State& state, const T& value);
+    ///
+    /// Both return `false` if the value could not be formatted, in which
+    /// case the replacement field is output as-is. A specialization takes
+    /// precedence over any `format_value` overloads for the same type.
+    ///
+    /// Types with neither are formatted as ranges if they can be iterated,
+    /// as `[1, 2]`, or `{1: 2}` for maps, and as tuples if they support
+    /// `std::tuple_size`, as `(1, 2)`. Their specifier is an optional `n` to
+    /// leave out the brackets, followed by `:` and the specifier of the
+    /// elements, such as `{::>8x}`. Ranges of `char` are not formatted, as
+    /// they are usually strings.
+    template <class T>
+    struct Formatter {
+    };
 
     /// Provided format functions.
     bool format_value(IWriter& writer, const StringView& fmt, std::nullptr_t);
@@ -108,6 +685,49 @@ namespace sp {
     template <class T>
     bool format_value(IWriter& output, const StringView& fmt, T* value);
 
+    /// Provided format functions, for already parsed format specifiers.
+    bool format_value(IWriter& writer, const FormatFlags& flags, std::nullptr_t);
+    bool format_value(IWriter& writer, const FormatFlags& flags, bool value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, float value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, double value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, char value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, char16_t value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, char32_t value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, wchar_t value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, signed char value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, unsigned char value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, short value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, unsigned short value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, int value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, unsigned value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, long value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, unsigned long value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, long long value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, unsigned long long value);
+    bool format_value(IWriter& writer, const FormatFlags& flags, char value[]);
+    bool format_value(IWriter& writer, const FormatFlags& flags, const char value[]);
+    bool format_value(IWriter& writer, const FormatFlags& flags, const StringView& value);
+
+    template <class T>
+    bool format_value(IWriter& output, const FormatFlags& flags, T* value);
+
+#if defined(SP_ENABLE_CHRONO)
+    /// Format a time point of the system clock as UTC. The specifier is made
+    /// up of `%Y` (year), `%m` (month), `%d` (day), `%H` (hour), `%M`
+    /// (minute), `%S` (second), `%f` (microsecond), `%F` (`%Y-%m-%d`), `%T`
+    /// (`%H:%M:%S`) and `%%`, with any other characters written as-is, and
+    /// defaults to `%Y-%m-%d %H:%M:%S`. Each thread keeps the output of the
+    /// last second per specifier, so only the microseconds are formatted
+    /// within the same second. Specifiers may be up to 64 `char`s long.
+    template <class Duration>
+    bool format_value(IWriter& writer, const StringView& spec, const std::chrono::time_point<std::chrono::system_clock, Duration>& value);
+
+    /// Format a duration as its count followed by its unit, such as `42ms`.
+    /// The format specifier applies to the count.
+    template <class Rep, class Period>
+    bool format_value(IWriter& writer, const StringView& spec, const std::chrono::duration<Rep, Period>& value);
+#endif
+
 } // namespace sp
 
 ///
@@ -116,947 +736,6733 @@ namespace sp {
 
 namespace sp {
 
-    class StringWriter : public IWriter {
+    /// Writer that writes into a buffer through non-virtual, inlineable
+    /// functions. Only once the buffer runs out of room is the (virtual)
+    /// `flush_buffer` called, to flush and/or grow the buffer.
+    class BufferedWriter : public IWriter {
+    public:
+        /// Write the provided data to the output. Return the amount of bytes
+        /// that could be written.
+        size_t write(size_t length, const void* data) final;
+
+        /// Write `count` copies of the provided character to the output.
+        /// Return the amount of bytes that could be written.
+        size_t fill(size_t count, char ch);
+
+        /// Write data that stays valid for as long as the output is used,
+        /// such as the literal text of a format string. Writers may then
+        /// reference the data rather than copy it. Return the amount of bytes
+        /// that could be written.
+        size_t reference(size_t length, const void* data);
+
+        /// Reserve room for writing `length` bytes directly into the buffer.
+        /// Return a pointer to the reserved room, or `nullptr` if the writer
+        /// was unable to provide it, in which case `write` must be used
+        /// instead. The bytes are not part of the output until committed.
+        char* reserve(size_t length);
+
+        /// Commit the first `length` bytes of the most recent reservation to
+        /// the output.
+        void commit(size_t length);
+
+        /// Return the amount of bytes written, including those that were
+        /// discarded because they did not fit the output.
+        size_t size() const;
+
+        /// Return the amount of bytes that were discarded because they did
+        /// not fit the output, not counting those of writers that only count.
+        size_t discarded() const;
+
+        /// Return whether the writer only counts the bytes written to it,
+        /// which is the case for writers without any buffer. Formatters may
+        /// then `skip` the output rather than producing it.
+        bool counting() const;
+
+        /// Count `length` bytes of output without writing them. Only valid
+        /// when `counting`.
+        void skip(size_t length);
+
+    protected:
+        /// Construct a writer writing into the provided buffer.
+        BufferedWriter(char* buffer, size_t size);
+
+        /// Called when the buffer is full. Flush and/or grow the buffer to
+        /// make room for more data, preferably at least `length` bytes, and
+        /// update it with `set_buffer`. Return `false` if no room could be
+        /// made, in which case any data that does not fit is discarded.
+        virtual bool flush_buffer(size_t length) = 0;
+
+        /// Called by `reference` for data of at least the size set with
+        /// `set_reference_size`, to reference it rather than copy it. Copies
+        /// it by default.
+        virtual size_t write_reference(size_t length, const char* data);
+
+        /// Set the smallest amount of bytes passed to `reference` that is
+        /// passed on to `write_reference`. Nothing is by default.
+        void set_reference_size(size_t size);
+
+        /// Set the buffer to write subsequent data into. `flushed` is the
+        /// amount of bytes written to the previous buffer.
+        void set_buffer(char* buffer, size_t size, size_t flushed);
+
+        /// Set the buffer to write subsequent data into, of which the first
+        /// `used` bytes already hold the output written so far.
+        void reset_buffer(char* buffer, size_t size, size_t used);
+
+        /// Return the start of the current buffer.
+        char* buffer() const;
+
+        /// Return the amount of bytes written to the current buffer.
+        size_t buffered() const;
+
+    private:
+        size_t write_slow(size_t length, const char* data);
+        size_t fill_slow(size_t count, char ch);
+        void discard(size_t length);
+
+        char* m_begin;
+        char* m_next;
+        char* m_end;
+        size_t m_flushed;
+        size_t m_discarded;
+        size_t m_referenceSize;
+    };
+
+    class StringWriter : public BufferedWriter {
     public:
         StringWriter(char buffer[], size_t size)
-            : m_buffer(buffer)
-            , m_size(int32_t(size))
-            , m_length(0)
+            : BufferedWriter(buffer, size)
         {
         }
 
-        int32_t result() const
+        ptrdiff_t result() const
         {
-            return m_length;
+            return ptrdiff_t(size());
         }
 
-        size_t write(size_t length, const void* data) override
+    protected:
+        bool flush_buffer(size_t) override
         {
-            if (m_length >= 0) {
-                m_length += int32_t(length);
-
-                if (m_size) {
-                    const auto toCopy = std::min(size_t(m_size), length);
-                    std::memcpy(m_buffer, data, toCopy);
-                    m_buffer += toCopy;
-                    m_size -= int32_t(toCopy);
-                    return toCopy;
-                }
-            }
-
-            return 0;
+            return false;
         }
-
-    private:
-        char* m_buffer;
-        int32_t m_size;
-        int32_t m_length;
     };
 
-    class StreamWriter : public IWriter {
+    class StreamWriter : public BufferedWriter {
     public:
         StreamWriter(FILE* stream)
-            : m_stream(stream)
-            , m_length(0)
+            : BufferedWriter(m_data, sizeof(m_data))
+            , m_stream(stream)
+            , m_failed(false)
+        {
+        }
+
+        StreamWriter(const StreamWriter&) = delete;
+        StreamWriter& operator=(const StreamWriter&) = delete;
+
+        ~StreamWriter()
         {
+            flush();
         }
 
-        int32_t result() const
+        /// Return the amount of `char`s written, or `-1` in case of an error.
+        /// Errors may not be detected until the writer has been flushed.
+        ptrdiff_t result() const
         {
-            return m_length;
+            return m_failed ? -1 : ptrdiff_t(size());
         }
 
-        size_t write(size_t length, const void* data) override
+        /// Write any buffered data to the stream.
+        void flush()
         {
-            if (m_length >= 0) {
-                const auto written = std::fwrite(data, 1, length, m_stream);
+            flush_buffer(0);
+        }
 
-                if (written == length) {
-                    m_length += int32_t(written);
-                } else {
-                    m_length = -1;
-                }
+    protected:
+        bool flush_buffer(size_t) override
+        {
+            const auto length = buffered();
 
-                return written;
+            if (length && !m_failed) {
+                m_failed = std::fwrite(buffer(), 1, length, m_stream) != length;
             }
 
-            return 0;
+            set_buffer(m_data, sizeof(m_data), length);
+            return !m_failed;
         }
 
     private:
+        char m_data[1024];
         FILE* m_stream;
-        int32_t m_length;
+        bool m_failed;
     };
 
-    inline void write_char(IWriter& writer, char ch)
-    {
-        writer.write(1, &ch);
-    }
+    /// Writer that only counts its output, such as for finding the size of a
+    /// formatted string up front.
+    class SizeWriter : public BufferedWriter {
+    public:
+        SizeWriter()
+            : BufferedWriter(nullptr, 0)
+        {
+        }
 
-    inline StringView::StringView() {}
+        ptrdiff_t result() const
+        {
+            return ptrdiff_t(size());
+        }
 
-    inline StringView::StringView(const char str[])
-        : ptr(str)
-        , length(str ? int32_t(std::strlen(str)) : 0)
-    {
-    }
+    protected:
+        bool flush_buffer(size_t) override
+        {
+            return false;
+        }
+    };
 
-    inline StringView::StringView(const char str[], int32_t length)
-        : ptr(str)
-        , length(length)
-    {
-    }
+    /// Buffers the output for another writer, so that it may be written in
+    /// larger chunks.
+    class WriterBuffer : public BufferedWriter {
+    public:
+        WriterBuffer(IWriter& writer)
+            : BufferedWriter(m_data, sizeof(m_data))
+            , m_writer(writer)
+        {
+        }
 
-    struct FormatFlags {
-        char fill = 0;
-        char align = 0;
-        char sign = 0;
-        bool alternate = false;
-        int32_t width = -1;
-        int32_t precision = -1;
-        char type = 0;
+        WriterBuffer(const WriterBuffer&) = delete;
+        WriterBuffer& operator=(const WriterBuffer&) = delete;
+
+        ~WriterBuffer()
+        {
+            flush_buffer(0);
+        }
+
+    protected:
+        bool flush_buffer(size_t) override
+        {
+            const auto length = buffered();
+
+            if (length) {
+                m_writer.write(length, buffer());
+            }
+
+            set_buffer(m_data, sizeof(m_data), length);
+            return true;
+        }
+
+    private:
+        char m_data[256];
+        IWriter& m_writer;
     };
 
-    inline bool parse_format(const StringView& fmt, FormatFlags* flags)
-    {
-        enum State {
-            STATE_ALIGN,
-            STATE_SIGN,
-            STATE_ALTERNATE,
-            STATE_WIDTH,
-            STATE_PRECISION,
-            STATE_TYPE,
-            STATE_DONE,
-        };
+    /// Writer into a buffer that grows as needed. Small outputs are kept
+    /// inline, while larger ones are moved to memory from the provided
+    /// allocator (or `std::malloc`), growing it geometrically.
+    class MemoryWriter : public BufferedWriter {
+    public:
+        MemoryWriter(IAllocator* allocator = nullptr)
+            : BufferedWriter(m_inline, sizeof(m_inline) - 1)
+            , m_data(m_inline)
+            , m_capacity(sizeof(m_inline))
+            , m_allocator(allocator)
+            , m_failed(false)
+        {
+        }
 
-        auto state = STATE_ALIGN;
-        auto next = fmt.ptr;
-        auto term = fmt.ptr + fmt.length;
-        *flags = FormatFlags{};
+        MemoryWriter(MemoryWriter&& other)
+            : BufferedWriter(m_inline, sizeof(m_inline) - 1)
+            , m_data(m_inline)
+            , m_capacity(sizeof(m_inline))
+            , m_allocator(nullptr)
+            , m_failed(false)
+        {
+            *this = std::move(other);
+        }
 
-        while (next < term) {
-            const auto ptr = next++;
-            const auto ch = *ptr;
-
-            switch (state) {
-            case STATE_ALIGN: {
-                const auto isAlign = [](char ch) {
-                    return (ch >= '<' && ch <= '>') || ch == '^';
-                };
-
-                if (next < term && isAlign(*next)) {
-                    flags->fill = ch;
-                    flags->align = *next++;
-                } else if (isAlign(ch)) {
-                    flags->align = ch;
+        MemoryWriter& operator=(MemoryWriter&& other)
+        {
+            if (this != &other) {
+                release();
+
+                const auto used = other.length();
+                m_allocator = other.m_allocator;
+                m_failed = other.m_failed;
+
+                if (other.m_data == other.m_inline) {
+                    std::memcpy(m_inline, other.m_inline, used);
+                    m_data = m_inline;
+                    m_capacity = sizeof(m_inline);
                 } else {
-                    --next;
+                    m_data = other.m_data;
+                    m_capacity = other.m_capacity;
+                    other.m_data = other.m_inline;
+                    other.m_capacity = sizeof(other.m_inline);
                 }
 
-                state = STATE_SIGN;
-                break;
+                reset_buffer(m_data, m_capacity - 1, used);
+                other.clear();
             }
 
-            case STATE_SIGN:
-                switch (ch) {
-                case '+':
-                case '-':
-                case ' ':
-                    flags->sign = ch;
-                    break;
-                default:
-                    --next;
-                    break;
-                }
-                state = STATE_ALTERNATE;
-                break;
+            return *this;
+        }
 
-            case STATE_ALTERNATE:
-                if (ch == '#') {
-                    flags->alternate = true;
-                } else {
-                    --next;
-                }
-                state = STATE_WIDTH;
-                break;
+        MemoryWriter(const MemoryWriter&) = delete;
+        MemoryWriter& operator=(const MemoryWriter&) = delete;
 
-            case STATE_WIDTH:
-                if (ch >= '0' && ch <= '9') {
-                    if (flags->width < 0) {
-                        if (ch == '0') {
-                            flags->fill = flags->fill ? flags->fill : '0';
-                            flags->align = flags->align ? flags->align : '=';
-                        }
-                        flags->width = 0;
-                    }
-                    flags->width = (flags->width * 10) + (ch - '0');
-                } else {
-                    state = STATE_PRECISION;
-                    --next;
-                }
-                break;
+        ~MemoryWriter()
+        {
+            release();
+        }
 
-            case STATE_PRECISION: {
-                const auto isDigit = [](char ch) {
-                    return ch >= '0' && ch <= '9';
-                };
+        /// Return the written data.
+        const char* data() const
+        {
+            return m_data;
+        }
+        char* data()
+        {
+            return m_data;
+        }
 
-                if (ch == '.') {
-                    const char nextCh = (next < term) ? *next : 0;
+        /// Return the written data, null-terminated.
+        const char* c_str()
+        {
+            m_data[length()] = 0;
+            return m_data;
+        }
 
-                    if (flags->precision < 0 && isDigit(nextCh)) {
-                        flags->precision = 0;
-                        continue;
-                    }
-                } else if (isDigit(ch)) {
-                    if (flags->precision >= 0) {
-                        flags->precision = (flags->precision * 10) + (ch - '0');
-                        continue;
-                    }
-                }
+        /// Return the amount of `char`s held by the buffer.
+        size_t length() const
+        {
+            return buffered();
+        }
 
-                state = STATE_TYPE;
-                --next;
-                break;
+        /// Return the amount of `char`s written, or `-1` in case the buffer
+        /// could not grow to hold all of it.
+        ptrdiff_t result() const
+        {
+            return m_failed ? -1 : ptrdiff_t(size());
+        }
+
+        /// Discard the written data, keeping the allocated memory.
+        void clear()
+        {
+            m_failed = false;
+            reset_buffer(m_data, m_capacity - 1, 0);
+        }
+
+    protected:
+        bool flush_buffer(size_t length) override
+        {
+            const auto used = buffered();
+            auto capacity = m_capacity * 2;
+
+            // leave room for the null terminator
+            while (capacity - 1 < used + length) {
+                capacity *= 2;
             }
 
-            case STATE_TYPE:
-                switch (ch) {
-                case 'b':
-                case 'd':
-                case 'c':
-                case 'e':
-                case 'E':
-                case 'f':
-                case 'F':
-                case 'g':
-                case 'G':
-                case 'o':
-                case 's':
-                case 'x':
-                case 'X':
-                case '%':
-                    flags->type = ch;
-                    break;
-                default:
-                    --next;
-                    break;
-                }
-                state = STATE_DONE;
-                break;
+            auto data = static_cast<char*>(m_allocator ? m_allocator->allocate(capacity) : std::malloc(capacity));
 
-            case STATE_DONE:
-                // if we get here, it means there's stuff in there after the
-                // flags, in which case we should fail.
+            if (!data) {
+                m_failed = true;
                 return false;
             }
+
+            std::memcpy(data, m_data, used);
+            release();
+
+            m_data = data;
+            m_capacity = capacity;
+            reset_buffer(m_data, m_capacity - 1, used);
+            return true;
         }
 
-        return true;
-    }
+    private:
+        void release()
+        {
+            if (m_data != m_inline) {
+                if (m_allocator) {
+                    m_allocator->deallocate(m_data, m_capacity);
+                } else {
+                    std::free(m_data);
+                }
+            }
 
-    inline bool format_int(IWriter& writer, const FormatFlags& flags, bool isNegative, uint64_t value)
-    {
-        // determine base
-        int32_t base = 10;
+            m_data = m_inline;
+            m_capacity = sizeof(m_inline);
+        }
 
-        switch (flags.type) {
-        case 'b':
-            base = 2;
-            break;
-        case 'o':
-            base = 8;
-            break;
-        case 'c':
-        case 'x':
-        case 'X':
-            base = 16;
-            break;
+        char m_inline[256];
+        char* m_data;
+        size_t m_capacity;
+        IAllocator* m_allocator;
+        bool m_failed;
+    };
+
+#if defined(SP_ENABLE_POSIX)
+    using IoVec = ::iovec;
+#else
+    /// Entry of an `IoVecWriter`, laid out as POSIX `struct iovec`.
+    struct IoVec {
+        void* iov_base; //< Start of the data.
+        size_t iov_len; //< Length of the data.
+    };
+#endif
+
+    /// Writer that records its output as a list of `IoVec` entries, to be
+    /// written with `writev` or `sendmsg` without copying it again. Literal
+    /// text of the format and string arguments of at least `referenceSize`
+    /// `char`s are referenced rather than copied, and must therefore stay
+    /// valid for as long as the entries are used. Everything else, such as
+    /// digits and padding, is copied into scratch memory that does not move
+    /// once written. Scratch memory beyond the first 256 `char`s, and entries
+    /// beyond the first 16, are allocated from the provided allocator (or
+    /// `std::malloc`).
+    class IoVecWriter : public BufferedWriter {
+    public:
+        IoVecWriter(size_t referenceSize = 64, IAllocator* allocator = nullptr)
+            : BufferedWriter(m_inline, sizeof(m_inline))
+            , m_chunks(nullptr)
+            , m_scratchEnd(m_inline + sizeof(m_inline))
+            , m_entries(m_inlineEntries)
+            , m_count(0)
+            , m_capacity(sizeof(m_inlineEntries) / sizeof(*m_inlineEntries))
+            , m_allocator(allocator)
+            , m_failed(false)
+        {
+            set_reference_size(referenceSize);
         }
 
-        // count digits, and copy them to a buffer (so we don't have to repeat
-        // this later)
-        char buffer[67]; // max needed; 64-bit binary + sign + alternate prefix
-        char* digits = buffer + sizeof(buffer);
-        char* prefix = buffer + 3;
-        int32_t ndigits = 0;
-        int32_t nprefix = 0;
-        char type = flags.type;
+        IoVecWriter(const IoVecWriter&) = delete;
+        IoVecWriter& operator=(const IoVecWriter&) = delete;
 
-        const bool isChar = type == 'c';
-        const bool charAsHex = (value >= 0x80 || isNegative);
+        ~IoVecWriter()
+        {
+            release_chunks();
 
-        if (isChar) {
-            if (charAsHex) {
-                *(--digits) = ')';
-            } else {
-                *(--digits) = char(value);
+            if (m_entries != m_inlineEntries) {
+                deallocate(m_entries, m_capacity * sizeof(IoVec));
             }
-            ndigits = 1;
         }
 
-        if (!isChar || charAsHex) {
-            const auto digitchars = (flags.type == 'X')
-                ? "0123456789ABCDEFX"
-                : "0123456789abcdefx";
+        /// Return the entries of the output written so far.
+        const IoVec* entries()
+        {
+            end_span();
+            return m_entries;
+        }
 
-            uint64_t v = value;
-            do {
-                *(--digits) = digitchars[v % base];
-                v /= base;
-                ++ndigits;
-            } while (v);
+        /// Return the amount of entries of the output written so far.
+        size_t count()
+        {
+            end_span();
+            return m_count;
+        }
+
+        /// Return the amount of `char`s written, or `-1` in case memory for
+        /// all of it could not be allocated.
+        ptrdiff_t result() const
+        {
+            return m_failed ? -1 : ptrdiff_t(size());
+        }
+
+        /// Discard the written data, keeping the allocated entries.
+        void clear()
+        {
+            release_chunks();
+            m_count = 0;
+            m_scratchEnd = m_inline + sizeof(m_inline);
+            m_failed = false;
+            reset_buffer(m_inline, sizeof(m_inline), 0);
+        }
+
+    protected:
+        bool flush_buffer(size_t length) override
+        {
+            end_span();
+
+            const auto size = std::max(size_t(CHUNK_SIZE), length);
+            const auto chunk = static_cast<Chunk*>(allocate(sizeof(Chunk) + size));
+
+            if (!chunk) {
+                m_failed = true;
+                return false;
+            }
+
+            chunk->next = m_chunks;
+            chunk->size = size;
+            m_chunks = chunk;
+
+            const auto data = reinterpret_cast<char*>(chunk + 1);
+            m_scratchEnd = data + size;
+            set_buffer(data, size, 0);
+            return true;
+        }
+
+        size_t write_reference(size_t length, const char* data) override
+        {
+            end_span();
+
+            if (!add_entry(data, length)) {
+                return write(length, data);
+            }
+
+            // continue copying data after the span that just ended
+            set_buffer(buffer(), size_t(m_scratchEnd - buffer()), length);
+            return length;
+        }
+
+    private:
+        enum {
+            CHUNK_SIZE = 4096,
+        };
+
+        struct Chunk {
+            Chunk* next;
+            size_t size; //< of the data following the chunk
+        };
+
+        /// End the span of data copied into the buffer since the previous
+        /// span, and add it as an entry.
+        void end_span()
+        {
+            const auto used = buffered();
+
+            if (used && add_entry(buffer(), used)) {
+                set_buffer(buffer() + used, size_t(m_scratchEnd - buffer() - used), used);
+            }
+        }
+
+        bool add_entry(const char* data, size_t length)
+        {
+            // extend the previous entry if this one follows it
+            if (m_count) {
+                auto& last = m_entries[m_count - 1];
+                if (static_cast<const char*>(last.iov_base) + last.iov_len == data) {
+                    last.iov_len += length;
+                    return true;
+                }
+            }
+
+            if (m_count == m_capacity) {
+                const auto capacity = m_capacity * 2;
+                const auto entries = static_cast<IoVec*>(allocate(capacity * sizeof(IoVec)));
+
+                if (!entries) {
+                    m_failed = true;
+                    return false;
+                }
+
+                std::memcpy(entries, m_entries, m_count * sizeof(IoVec));
+                if (m_entries != m_inlineEntries) {
+                    deallocate(m_entries, m_capacity * sizeof(IoVec));
+                }
+
+                m_entries = entries;
+                m_capacity = capacity;
+            }
+
+            auto& entry = m_entries[m_count++];
+            entry.iov_base = const_cast<char*>(data);
+            entry.iov_len = length;
+            return true;
+        }
+
+        void release_chunks()
+        {
+            while (m_chunks) {
+                const auto next = m_chunks->next;
+                deallocate(m_chunks, sizeof(Chunk) + m_chunks->size);
+                m_chunks = next;
+            }
+        }
+
+        void* allocate(size_t size)
+        {
+            return m_allocator ? m_allocator->allocate(size) : std::malloc(size);
+        }
+
+        void deallocate(void* ptr, size_t size)
+        {
+            if (m_allocator) {
+                m_allocator->deallocate(ptr, size);
+            } else {
+                std::free(ptr);
+            }
+        }
+
+        char m_inline[256];
+        IoVec m_inlineEntries[16];
+        Chunk* m_chunks;
+        char* m_scratchEnd; //< End of the current scratch memory.
+        IoVec* m_entries;
+        size_t m_count;
+        size_t m_capacity;
+        IAllocator* m_allocator;
+        bool m_failed;
+    };
+
+#if defined(SP_ENABLE_POSIX)
+    /// Writer to a file descriptor, through a buffer of its own that is
+    /// written with `write` whenever it is full, when calling `flush()`, and
+    /// on destruction. The descriptor is not closed.
+    class FdWriter : public BufferedWriter {
+    public:
+        FdWriter(int fd, size_t bufferSize = 64 * 1024)
+            : BufferedWriter(m_inline, sizeof(m_inline))
+            , m_data(bufferSize ? static_cast<char*>(std::malloc(bufferSize)) : nullptr)
+            , m_size(bufferSize)
+            , m_fd(fd)
+            , m_failed(false)
+        {
+            // the inline buffer is only used if the allocation failed
+            if (m_data) {
+                reset_buffer(m_data, m_size, 0);
+            }
+        }
+
+        FdWriter(const FdWriter&) = delete;
+        FdWriter& operator=(const FdWriter&) = delete;
+
+        ~FdWriter()
+        {
+            flush();
+            std::free(m_data);
+        }
+
+        /// Return the amount of `char`s written, or `-1` in case of an error.
+        /// Errors may not be detected until the writer has been flushed.
+        ptrdiff_t result() const
+        {
+            return m_failed ? -1 : ptrdiff_t(size());
+        }
+
+        /// Write any buffered data to the file descriptor.
+        void flush()
+        {
+            flush_buffer(0);
+        }
+
+    protected:
+        bool flush_buffer(size_t) override
+        {
+            const auto length = buffered();
+            const auto data = buffer();
+            size_t written = 0;
+
+            while (written < length && !m_failed) {
+                const auto result = ::write(m_fd, data + written, length - written);
+
+                if (result > 0) {
+                    written += size_t(result);
+                } else if (result == 0 || errno != EINTR) {
+                    // a write of nothing would never make progress
+                    m_failed = true;
+                }
+            }
+
+            set_buffer(data, data == m_data ? m_size : sizeof(m_inline), length);
+            return !m_failed;
+        }
+
+    private:
+        char m_inline[256];
+        char* m_data;
+        size_t m_size;
+        int m_fd;
+        bool m_failed;
+    };
+
+    /// Writer formatting directly into a memory-mapped file, replacing its
+    /// contents. The file is mapped a window at a time, and grown by at least
+    /// `growth` bytes whenever the window is full. Once finished, the file is
+    /// unmapped and truncated to the length written. The file descriptor
+    /// must be open for both reading and writing, and is not closed.
+    class MmapWriter : public BufferedWriter {
+    public:
+        MmapWriter(int fd, size_t growth = 64 * 1024 * 1024)
+            : BufferedWriter(nullptr, 0)
+            , m_empty(0)
+            , m_window(nullptr)
+            , m_windowSize(0)
+            , m_growth(growth)
+            , m_fd(fd)
+            , m_failed(false)
+            , m_finished(false)
+        {
+            m_failed = !map(0);
+        }
+
+        MmapWriter(const MmapWriter&) = delete;
+        MmapWriter& operator=(const MmapWriter&) = delete;
+
+        ~MmapWriter()
+        {
+            finish();
+        }
+
+        /// Return the amount of `char`s written, or `-1` in case of an error.
+        ptrdiff_t result() const
+        {
+            return m_failed ? -1 : ptrdiff_t(size());
+        }
+
+        /// Unmap the file, and truncate it to the length written. Anything
+        /// written once finished is discarded as an error. Return `false` in
+        /// case of an error.
+        bool finish()
+        {
+            if (!m_finished) {
+                m_finished = true;
+                close_window();
+                m_failed = ::ftruncate(m_fd, off_t(size() - discarded())) != 0 || m_failed;
+            }
+
+            return !m_failed;
+        }
+
+    protected:
+        bool flush_buffer(size_t length) override
+        {
+            if (m_finished || m_failed) {
+                m_failed = true;
+                return false;
+            }
+
+            m_failed = !map(length);
+            return !m_failed;
+        }
+
+    private:
+        /// Map the window following the written output, with room for at
+        /// least `length` more bytes, growing the file to hold it.
+        bool map(size_t length)
+        {
+            static const auto pageSize = size_t(::sysconf(_SC_PAGESIZE));
+
+            // windows start at a page boundary, which may be part-way into
+            // the output already written
+            const auto written = size();
+            const auto offset = written - written % pageSize;
+            const auto skip = written - offset;
+            const auto room = std::max(std::max(m_growth, length), size_t(1));
+            const auto windowSize = (skip + room + pageSize - 1) / pageSize * pageSize;
+
+            // the output written so far is already in the file, so it is
+            // enough to stop writing into the window if this fails
+            close_window();
+
+            if (::ftruncate(m_fd, off_t(offset + windowSize)) != 0) {
+                return false;
+            }
+
+            const auto window = ::mmap(nullptr, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, off_t(offset));
+            if (window == MAP_FAILED) {
+                return false;
+            }
+
+            m_window = static_cast<char*>(window);
+            m_windowSize = windowSize;
+            set_buffer(m_window + skip, windowSize - skip, 0);
+            return true;
+        }
+
+        /// Unmap the window, leaving an empty buffer rather than none, so the
+        /// writer isn't taken to only be counting.
+        void close_window()
+        {
+            set_buffer(&m_empty, 0, buffered());
+
+            if (m_window) {
+                ::munmap(m_window, m_windowSize);
+                m_window = nullptr;
+            }
+        }
+
+        char m_empty;
+        char* m_window;
+        size_t m_windowSize;
+        size_t m_growth;
+        int m_fd;
+        bool m_failed;
+        bool m_finished;
+    };
+#endif
+
+#if defined(SP_ENABLE_ASYNC)
+    /// Stream that collects whole messages from any number of threads in a
+    /// lock-free ring, and writes them to a `FILE` stream from a background
+    /// thread. A message takes up as many consecutive slots as it needs, and
+    /// messages too large for the whole ring are written to the stream
+    /// directly. Writers wait for room while the ring is full.
+    class AsyncStream {
+    public:
+        /// Construct a stream writing to `stream` through a ring of at least
+        /// `slots` slots.
+        AsyncStream(std::FILE* stream, size_t slots = 1024);
+
+        AsyncStream(const AsyncStream&) = delete;
+        AsyncStream& operator=(const AsyncStream&) = delete;
+
+        /// Write all queued messages, and stop the background thread.
+        ~AsyncStream();
+
+        /// Queue the provided message.
+        void write(size_t length, const void* data);
+
+        /// Wait for all messages queued so far to be written, and flush the
+        /// stream.
+        void flush();
+
+        /// Return whether writing to the stream has failed.
+        bool failed() const;
+
+    private:
+        enum : size_t {
+            SLOT_DATA = 116, //< makes a slot 128 bytes
+        };
+
+        struct Slot {
+            std::atomic<size_t> sequence;
+            uint32_t length; //< of the whole message, in its first slot
+            char data[SLOT_DATA];
+        };
+
+        void run();
+
+        Slot* m_slots;
+        char* m_batch;
+        size_t m_mask;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_written;
+        std::atomic<bool> m_stop;
+        std::atomic<bool> m_failed;
+        std::FILE* m_stream;
+        std::thread m_thread;
+    };
+
+#if SP_DEFINE_ENGINE
+    SP_INLINE AsyncStream::AsyncStream(std::FILE* stream, size_t slots)
+        : m_head(0)
+        , m_written(0)
+        , m_stop(false)
+        , m_failed(false)
+        , m_stream(stream)
+    {
+        size_t capacity = 1;
+        while (capacity < slots) {
+            capacity *= 2;
+        }
+
+        m_slots = new Slot[capacity];
+        m_batch = new char[capacity * SLOT_DATA];
+        m_mask = capacity - 1;
+
+        for (size_t i = 0; i < capacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        m_thread = std::thread(&AsyncStream::run, this);
+    }
+
+    SP_INLINE AsyncStream::~AsyncStream()
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_thread.join();
+        std::fflush(m_stream);
+
+        delete[] m_slots;
+        delete[] m_batch;
+    }
+
+    SP_INLINE void AsyncStream::write(size_t length, const void* data)
+    {
+        const auto slots = (length + SLOT_DATA - 1) / SLOT_DATA;
+
+        if (!slots) {
+            return;
+        }
+
+        if (slots > m_mask + 1) {
+            flush();
+            if (std::fwrite(data, 1, length, m_stream) != length) {
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        // claim consecutive slots; the consumer frees slots in order, so if
+        // the last one is free, all of them are
+        auto pos = m_head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            const auto last = pos + slots - 1;
+            const auto sequence = m_slots[last & m_mask].sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence - last);
+
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + slots, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                std::this_thread::yield(); // full
+                pos = m_head.load(std::memory_order_relaxed);
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        m_slots[pos & m_mask].length = uint32_t(length);
+
+        const auto bytes = static_cast<const char*>(data);
+        for (size_t i = 0; i < slots; ++i) {
+            auto& slot = m_slots[(pos + i) & m_mask];
+            const auto offset = i * SLOT_DATA;
+            std::memcpy(slot.data, bytes + offset, std::min(size_t(SLOT_DATA), length - offset));
+            slot.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+    }
+
+    SP_INLINE void AsyncStream::flush()
+    {
+        const auto target = m_head.load(std::memory_order_acquire);
+
+        while (m_written.load(std::memory_order_acquire) < target) {
+            std::this_thread::yield();
+        }
+
+        std::fflush(m_stream);
+    }
+
+    SP_INLINE bool AsyncStream::failed() const
+    {
+        return m_failed.load(std::memory_order_relaxed);
+    }
+
+    SP_INLINE void AsyncStream::run()
+    {
+        const auto capacity = m_mask + 1;
+        size_t tail = 0;
+
+        for (;;) {
+            // gather the ready messages into a single write; the batch can
+            // hold the whole ring, so no message is split
+            size_t batched = 0;
+
+            for (;;) {
+                auto& first = m_slots[tail & m_mask];
+
+                if (first.sequence.load(std::memory_order_acquire) != tail + 1) {
+                    break;
+                }
+
+                const size_t length = first.length;
+                const auto slots = (length + SLOT_DATA - 1) / SLOT_DATA;
+
+                if (batched + length > capacity * SLOT_DATA) {
+                    break;
+                }
+
+                for (size_t i = 0; i < slots; ++i) {
+                    auto& slot = m_slots[(tail + i) & m_mask];
+                    while (slot.sequence.load(std::memory_order_acquire) != tail + i + 1) {
+                        std::this_thread::yield();
+                    }
+
+                    const auto offset = i * SLOT_DATA;
+                    const auto toCopy = std::min(size_t(SLOT_DATA), length - offset);
+                    std::memcpy(m_batch + batched, slot.data, toCopy);
+                    batched += toCopy;
+                    slot.sequence.store(tail + i + capacity, std::memory_order_release);
+                }
+
+                tail += slots;
+            }
+
+            if (batched && std::fwrite(m_batch, 1, batched, m_stream) != batched) {
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+
+            m_written.store(tail, std::memory_order_release);
+
+            if (!batched) {
+                if (m_stop.load(std::memory_order_acquire) && m_head.load(std::memory_order_acquire) == tail) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+#endif
+
+    /// Header of a message in a `DeferredQueue`, followed by its arguments
+    /// and the data they reference.
+    struct DeferredRecord {
+        using FormatFn = void (*)(BufferedWriter& writer, const DeferredRecord& record, const FormatArgs& args);
+
+        uint32_t size = 0; //< Size of the whole message, in bytes.
+        int32_t argc = 0; //< Amount of arguments following the header.
+        FormatFn format = nullptr; //< Function formatting the message.
+        const void* compiled = nullptr; //< Pre-compiled format, if any.
+        StringView fmt; //< Format string, if not pre-compiled.
+    };
+
+    /// Single-producer, single-consumer queue of messages whose formatting is
+    /// deferred. Each message is stored as its format and its type-erased
+    /// arguments, along with copies of whatever the arguments reference. It
+    /// is meant to be owned by one producing thread, and attached to a
+    /// `DeferredWriter` that formats its messages in the background.
+    class DeferredQueue {
+    public:
+        /// Construct a queue holding at least `capacity` bytes of messages.
+        DeferredQueue(size_t capacity = 64 * 1024);
+
+        DeferredQueue(const DeferredQueue&) = delete;
+        DeferredQueue& operator=(const DeferredQueue&) = delete;
+
+        ~DeferredQueue();
+
+        /// Queue a message described by `record`, with the provided format
+        /// arguments. Use `sp::format(queue, ...)` rather than calling this
+        /// directly. Return `false` if the queue is full.
+        template <class... Args>
+        bool push(const DeferredRecord& record, Args&&... args);
+
+        /// Format the oldest queued message into the provided writer, and
+        /// remove it. Return `false` if the queue is empty.
+        bool pop(BufferedWriter& writer);
+
+        /// Return whether the queue is empty.
+        bool empty() const;
+
+    private:
+        friend class DeferredWriter;
+
+        static const int32_t SKIP = -1; //< `argc` of the padding before a wrap
+
+        char* m_data;
+        size_t m_mask;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+        DeferredQueue* m_next; //< in the list of the attached writer
+    };
+
+    /// Writer formatting the messages of any number of attached
+    /// `DeferredQueue`s into an `IWriter`, from a background thread.
+    class DeferredWriter {
+    public:
+        /// Construct a writer formatting into `writer`.
+        DeferredWriter(IWriter& writer);
+
+        DeferredWriter(const DeferredWriter&) = delete;
+        DeferredWriter& operator=(const DeferredWriter&) = delete;
+
+        /// Format all queued messages, and stop the background thread.
+        ~DeferredWriter();
+
+        /// Start formatting the messages of the provided queue. The queue
+        /// must be detached before it is destroyed.
+        void attach(DeferredQueue& queue);
+
+        /// Format the remaining messages of the provided queue, and stop
+        /// formatting its messages.
+        void detach(DeferredQueue& queue);
+
+        /// Wait for all messages queued so far to be written.
+        void flush();
+
+    private:
+        void run();
+
+        IWriter& m_writer;
+        DeferredQueue* m_queues;
+        std::mutex m_mutex; //< held while formatting, and to change `m_queues`
+        std::atomic<bool> m_stop;
+        std::thread m_thread;
+    };
+
+#if SP_DEFINE_ENGINE
+    SP_INLINE DeferredQueue::DeferredQueue(size_t capacity)
+        : m_head(0)
+        , m_tail(0)
+        , m_next(nullptr)
+    {
+        size_t size = 1;
+        while (size < capacity || size < 2 * sizeof(DeferredRecord)) {
+            size *= 2;
+        }
+
+        m_data = new char[size];
+        m_mask = size - 1;
+    }
+
+    SP_INLINE DeferredQueue::~DeferredQueue()
+    {
+        delete[] m_data;
+    }
+
+    SP_INLINE bool DeferredQueue::pop(BufferedWriter& writer)
+    {
+        const auto capacity = m_mask + 1;
+        auto tail = m_tail.load(std::memory_order_relaxed);
+
+        for (;;) {
+            if (tail == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            const auto offset = tail & m_mask;
+            const auto record = reinterpret_cast<const DeferredRecord*>(m_data + offset);
+
+            // messages never wrap; the producer skips to the start instead
+            if (capacity - offset < sizeof(DeferredRecord) || record->argc == SKIP) {
+                tail += capacity - offset;
+                m_tail.store(tail, std::memory_order_release);
+                continue;
+            }
+
+            const FormatArgs args(reinterpret_cast<const FormatArg*>(record + 1), record->argc);
+            record->format(writer, *record, args);
+
+            m_tail.store(tail + record->size, std::memory_order_release);
+            return true;
+        }
+    }
+
+    SP_INLINE bool DeferredQueue::empty() const
+    {
+        return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire);
+    }
+
+    SP_INLINE DeferredWriter::DeferredWriter(IWriter& writer)
+        : m_writer(writer)
+        , m_queues(nullptr)
+        , m_stop(false)
+    {
+        m_thread = std::thread(&DeferredWriter::run, this);
+    }
+
+    SP_INLINE DeferredWriter::~DeferredWriter()
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_thread.join();
+    }
+
+    SP_INLINE void DeferredWriter::attach(DeferredQueue& queue)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        queue.m_next = m_queues;
+        m_queues = &queue;
+    }
+
+    SP_INLINE void DeferredWriter::detach(DeferredQueue& queue)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        {
+            WriterBuffer buffered(m_writer);
+            while (queue.pop(buffered)) {
+            }
+        }
+
+        for (auto link = &m_queues; *link; link = &(*link)->m_next) {
+            if (*link == &queue) {
+                *link = queue.m_next;
+                queue.m_next = nullptr;
+                break;
+            }
+        }
+    }
+
+    SP_INLINE void DeferredWriter::flush()
+    {
+        // the lock is held while formatting, so once the queues are seen
+        // empty with it held, everything popped has been written too
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                auto queue = m_queues;
+                while (queue && queue->empty()) {
+                    queue = queue->m_next;
+                }
+
+                if (!queue) {
+                    return;
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    SP_INLINE void DeferredWriter::run()
+    {
+        for (;;) {
+            bool formatted = false;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                WriterBuffer buffered(m_writer);
+
+                for (auto queue = m_queues; queue; queue = queue->m_next) {
+                    while (queue->pop(buffered)) {
+                        formatted = true;
+                    }
+                }
+            }
+
+            if (!formatted) {
+                if (m_stop.load(std::memory_order_acquire)) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+#endif
+
+    /// Runs the tasks of a `format_batch`, such as on a thread pool.
+    struct IBatchExecutor {
+        using TaskFn = void (*)(void* context, size_t index);
+
+        /// Call `task(context, index)` for every `index` in [0, `count`),
+        /// from any threads, and return once all of the calls have returned.
+        virtual void run(size_t count, TaskFn task, void* context) = 0;
+    };
+
+    /// Executor running each batch on a pool of threads of its own, started
+    /// once on construction, along with the calling thread. Each thread takes
+    /// the next remaining task as it finishes one. Batches are run one at a
+    /// time, so tasks may not run batches on the same executor.
+    class ThreadExecutor final : public IBatchExecutor {
+    public:
+        /// Run on `threads` threads, or one per hardware thread if `0`.
+        ThreadExecutor(unsigned threads = 0);
+
+        ThreadExecutor(const ThreadExecutor&) = delete;
+        ThreadExecutor& operator=(const ThreadExecutor&) = delete;
+
+        /// Wait for the threads of the pool to stop.
+        ~ThreadExecutor();
+
+        void run(size_t count, TaskFn task, void* context) override;
+
+    private:
+        /// Call the task for indices of the current batch until none remain.
+        void take_tasks(TaskFn task, void* context, size_t count);
+
+        /// Run the tasks of each batch, on a thread of the pool.
+        void work();
+
+        std::mutex m_mutex; //< held to change anything but `m_next`
+        std::condition_variable m_started; //< signaled on a new batch, and to stop
+        std::condition_variable m_finished; //< signaled when `m_busy` drops to zero
+        std::thread* m_threads;
+        unsigned m_threadCount; //< amount of threads in the pool
+        TaskFn m_task;
+        void* m_context;
+        size_t m_count;
+        std::atomic<size_t> m_next; //< next index of the current batch
+        uint64_t m_batch; //< incremented for each batch
+        unsigned m_busy; //< threads of the pool taking tasks of the batch
+        bool m_running;
+        bool m_stop;
+    };
+
+#if SP_DEFINE_ENGINE
+    SP_INLINE ThreadExecutor::ThreadExecutor(unsigned threads)
+        : m_threads(nullptr)
+        , m_threadCount((threads ? threads : std::max(std::thread::hardware_concurrency(), 1u)) - 1)
+        , m_task(nullptr)
+        , m_context(nullptr)
+        , m_count(0)
+        , m_next(0)
+        , m_batch(0)
+        , m_busy(0)
+        , m_running(false)
+        , m_stop(false)
+    {
+        // the calling thread of `run` makes up the last one
+        if (m_threadCount) {
+            m_threads = new std::thread[m_threadCount];
+            for (unsigned i = 0; i < m_threadCount; ++i) {
+                m_threads[i] = std::thread([this] { work(); });
+            }
+        }
+    }
+
+    SP_INLINE ThreadExecutor::~ThreadExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_started.notify_all();
+        for (unsigned i = 0; i < m_threadCount; ++i) {
+            m_threads[i].join();
+        }
+
+        delete[] m_threads;
+    }
+
+    SP_INLINE void ThreadExecutor::run(size_t count, TaskFn task, void* context)
+    {
+        if (!count) {
+            return;
+        }
+
+        // threads still looking at the previous batch would take tasks of
+        // this one with the previous task, so wait for them to leave it
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.wait(lock, [this] { return !m_running && !m_busy; });
+
+            m_task = task;
+            m_context = context;
+            m_count = count;
+            m_next.store(0, std::memory_order_relaxed);
+            m_running = true;
+            ++m_batch;
+        }
+
+        if (m_threadCount && count > 1) {
+            m_started.notify_all();
+        }
+
+        take_tasks(task, context, count);
+
+        // every task has been taken, by this thread or by a busy one
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this] { return !m_busy; });
+        m_running = false;
+        m_finished.notify_all();
+    }
+
+    SP_INLINE void ThreadExecutor::take_tasks(TaskFn task, void* context, size_t count)
+    {
+        for (auto index = m_next.fetch_add(1, std::memory_order_relaxed); index < count; index = m_next.fetch_add(1, std::memory_order_relaxed)) {
+            task(context, index);
+        }
+    }
+
+    SP_INLINE void ThreadExecutor::work()
+    {
+        uint64_t batch = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        for (;;) {
+            m_started.wait(lock, [&] { return m_stop || (m_running && m_batch != batch); });
+            if (m_stop) {
+                break;
+            }
+
+            batch = m_batch;
+            const auto task = m_task;
+            const auto context = m_context;
+            const auto count = m_count;
+            ++m_busy;
+
+            lock.unlock();
+            take_tasks(task, context, count);
+            lock.lock();
+
+            if (!--m_busy) {
+                m_finished.notify_all();
+            }
+        }
+    }
+#endif
+
+#endif
+
+    /// Writer of binary log records into an `IWriter`, to be formatted later
+    /// by a `BinaryLogReader`, such as offline or in another process. Each
+    /// record holds the id of its format, followed by the arguments tagged by
+    /// their `FormatArg::Type`, with integers variable-length and strings
+    /// length-prefixed; values are in the byte order of the writing machine.
+    /// The first record of each format is preceded by its definition, so a
+    /// log decodes on its own. Formats are looked up by their address, and
+    /// a copy of their text is kept to tell whether the memory they were
+    /// read from has since changed, in which case the new text is defined
+    /// anew. It is meant to be owned by one thread.
+    class BinaryLogWriter {
+    public:
+        enum {
+            MAX_ARGS = 32, //< Largest amount of arguments of a record.
+        };
+
+        /// Construct a log writing its records into `writer`.
+        BinaryLogWriter(IWriter& writer);
+
+        BinaryLogWriter(const BinaryLogWriter&) = delete;
+        BinaryLogWriter& operator=(const BinaryLogWriter&) = delete;
+
+        ~BinaryLogWriter();
+
+        /// Write a record of the provided format and format arguments. Use
+        /// `sp::format(log, ...)` rather than calling this directly.
+        void write(const StringView& fmt, const FormatArgs& args);
+
+    private:
+        struct Entry {
+            const char* ptr = nullptr;
+            char* text = nullptr; //< copy of the format last defined
+            ptrdiff_t length = -1; //< `-1` for unused entries
+            uint32_t id = 0;
+        };
+
+        /// Return the entry of `fmt`, or the unused entry to store it in.
+        Entry* find_entry(const StringView& fmt);
+
+        /// Return the id of `fmt`, setting `added` if it is new.
+        uint32_t find_id(const StringView& fmt, bool* added);
+
+        IWriter& m_writer;
+        Entry* m_entries;
+        size_t m_mask;
+        uint32_t m_count;
+    };
+
+    /// Reader of the records written by a `BinaryLogWriter`, formatting each
+    /// of them as if its format and arguments had been passed to `sp::format`.
+    class BinaryLogReader {
+    public:
+        BinaryLogReader();
+
+        BinaryLogReader(const BinaryLogReader&) = delete;
+        BinaryLogReader& operator=(const BinaryLogReader&) = delete;
+
+        ~BinaryLogReader();
+
+        /// Format the records in the provided data into `writer`. A record cut
+        /// off at the end of the data is left unread, to be passed again with
+        /// the data following it. Return the amount of bytes read, or `-1` if
+        /// the data is not a valid log, such as when it uses a format that has
+        /// not been defined in the data read so far.
+        ptrdiff_t read(IWriter& writer, const void* data, size_t length);
+        ptrdiff_t read(BufferedWriter& writer, const void* data, size_t length);
+
+    private:
+        struct Format {
+            size_t offset; //< into `m_strings`
+            ptrdiff_t length;
+        };
+
+        /// Read the record at `*ptr`, advancing it. Return `0` if the record is
+        /// cut off at `end`, or `-1` if it is invalid.
+        int32_t read_record(BufferedWriter& writer, const char** ptr, const char* end);
+
+        char* m_strings;
+        size_t m_stringsLength;
+        size_t m_stringsCapacity;
+        Format* m_formats;
+        uint32_t m_formatCount;
+        uint32_t m_formatCapacity;
+    };
+
+#if SP_DEFINE_ENGINE
+    /// Write `value` as a little-endian base 128 varint.
+    inline void write_varint(BufferedWriter& writer, uint64_t value)
+    {
+        char bytes[10];
+        size_t length = 0;
+
+        while (value >= 0x80) {
+            bytes[length++] = char(0x80 | (value & 0x7f));
+            value >>= 7;
+        }
+        bytes[length++] = char(value);
+
+        writer.write(length, bytes);
+    }
+
+    /// Read a varint written by `write_varint` at `*ptr`, advancing it.
+    /// Return `1` if read, `0` if it is cut off at `end`, or `-1` if it is
+    /// longer than 64 bits.
+    inline int32_t read_varint(const char** ptr, const char* end, uint64_t* value)
+    {
+        uint64_t result = 0;
+
+        for (int32_t shift = 0; shift < 64; shift += 7) {
+            if (*ptr == end) {
+                return 0;
+            }
+
+            const auto byte = uint8_t(*(*ptr)++);
+            if (shift == 63 && byte > 1) {
+                return -1;
+            }
+
+            result |= uint64_t(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80)) {
+                *value = result;
+                return 1;
+            }
+        }
+
+        return -1;
+    }
+
+    SP_INLINE BinaryLogWriter::BinaryLogWriter(IWriter& writer)
+        : m_writer(writer)
+        , m_entries(new Entry[64])
+        , m_mask(63)
+        , m_count(0)
+    {
+    }
+
+    SP_INLINE BinaryLogWriter::~BinaryLogWriter()
+    {
+        for (size_t i = 0; i <= m_mask; ++i) {
+            delete[] m_entries[i].text;
+        }
+
+        delete[] m_entries;
+    }
+
+    SP_INLINE BinaryLogWriter::Entry* BinaryLogWriter::find_entry(const StringView& fmt)
+    {
+        // formats are mostly literals, so their address is a good hash
+        auto index = size_t((uint64_t(reinterpret_cast<uintptr_t>(fmt.ptr)) * 0x9e3779b97f4a7c15ull) >> 32);
+
+        for (;; ++index) {
+            const auto entry = &m_entries[index & m_mask];
+            if (entry->length < 0 || (entry->ptr == fmt.ptr && entry->length == fmt.length)) {
+                return entry;
+            }
+        }
+    }
+
+    SP_INLINE uint32_t BinaryLogWriter::find_id(const StringView& fmt, bool* added)
+    {
+        auto entry = find_entry(fmt);
+
+        if (entry->length >= 0) {
+            // the same memory may have been reused for another format
+            if (!fmt.length || std::memcmp(entry->text, fmt.ptr, size_t(fmt.length)) == 0) {
+                *added = false;
+                return entry->id;
+            }
+
+            std::memcpy(entry->text, fmt.ptr, size_t(fmt.length));
+            entry->id = m_count++;
+
+            *added = true;
+            return entry->id;
+        }
+
+        // keep the table at most half full
+        if (2 * (size_t(m_count) + 1) > m_mask + 1) {
+            const auto entries = m_entries;
+            const auto capacity = m_mask + 1;
+
+            m_entries = new Entry[2 * capacity];
+            m_mask = 2 * capacity - 1;
+
+            for (size_t i = 0; i < capacity; ++i) {
+                if (entries[i].length >= 0) {
+                    *find_entry(StringView(entries[i].ptr, entries[i].length)) = entries[i];
+                }
+            }
+
+            delete[] entries;
+            entry = find_entry(fmt);
+        }
+
+        entry->ptr = fmt.ptr;
+        entry->text = new char[size_t(fmt.length)];
+        entry->length = fmt.length;
+        entry->id = m_count++;
+        std::memcpy(entry->text, fmt.ptr, size_t(fmt.length));
+
+        *added = true;
+        return entry->id;
+    }
+
+    SP_INLINE void BinaryLogWriter::write(const StringView& fmt, const FormatArgs& args)
+    {
+        WriterBuffer buffered(m_writer);
+
+        // the low bit of the header tells definitions from messages
+        bool added;
+        const auto id = uint64_t(find_id(fmt, &added));
+
+        if (added) {
+            write_varint(buffered, (id << 1) | 1);
+            write_varint(buffered, uint64_t(fmt.length));
+            buffered.write(size_t(fmt.length), fmt.ptr);
+        }
+
+        write_varint(buffered, id << 1);
+        write_varint(buffered, uint64_t(args.size()));
+
+        for (int32_t i = 0; i < args.size(); ++i) {
+            const auto& arg = args[i];
+            const auto type = char(arg.type);
+
+            buffered.write(1, &type);
+
+            switch (arg.type) {
+            case FormatArg::TYPE_BOOL:
+                buffered.write(1, arg.value.b ? "\1" : "\0");
+                break;
+            case FormatArg::TYPE_CHAR:
+                write_varint(buffered, uint64_t(arg.value.c));
+                break;
+            case FormatArg::TYPE_INT:
+                // zigzag, so small negative values stay short too
+                write_varint(buffered, (uint64_t(arg.value.i) << 1) ^ uint64_t(arg.value.i >> 63));
+                break;
+            case FormatArg::TYPE_UINT:
+                write_varint(buffered, arg.value.u);
+                break;
+            case FormatArg::TYPE_FLOAT:
+                buffered.write(sizeof(arg.value.f), &arg.value.f);
+                break;
+            case FormatArg::TYPE_DOUBLE:
+                buffered.write(sizeof(arg.value.d), &arg.value.d);
+                break;
+            case FormatArg::TYPE_STRING:
+                write_varint(buffered, uint64_t(arg.value.string.length));
+                buffered.write(size_t(arg.value.string.length), arg.value.string.ptr);
+                break;
+            case FormatArg::TYPE_POINTER:
+                write_varint(buffered, uint64_t(reinterpret_cast<uintptr_t>(arg.value.p)));
+                break;
+            case FormatArg::TYPE_NONE:
+            case FormatArg::TYPE_CUSTOM:
+                break;
+            }
+        }
+    }
+
+    SP_INLINE BinaryLogReader::BinaryLogReader()
+        : m_strings(nullptr)
+        , m_stringsLength(0)
+        , m_stringsCapacity(0)
+        , m_formats(nullptr)
+        , m_formatCount(0)
+        , m_formatCapacity(0)
+    {
+    }
+
+    SP_INLINE BinaryLogReader::~BinaryLogReader()
+    {
+        delete[] m_strings;
+        delete[] m_formats;
+    }
+
+    SP_INLINE ptrdiff_t BinaryLogReader::read(IWriter& writer, const void* data, size_t length)
+    {
+        WriterBuffer buffered(writer);
+        return read(buffered, data, length);
+    }
+
+    SP_INLINE ptrdiff_t BinaryLogReader::read(BufferedWriter& writer, const void* data, size_t length)
+    {
+        const auto begin = static_cast<const char*>(data);
+        const auto end = begin + length;
+        auto ptr = begin;
+
+        for (;;) {
+            auto next = ptr;
+            const auto result = read_record(writer, &next, end);
+
+            if (result < 0) {
+                return -1;
+            }
+            if (!result) {
+                return ptr - begin;
+            }
+            ptr = next;
+        }
+    }
+
+    SP_INLINE int32_t BinaryLogReader::read_record(BufferedWriter& writer, const char** ptr, const char* end)
+    {
+        uint64_t header;
+        auto status = read_varint(ptr, end, &header);
+        if (status <= 0) {
+            return status;
+        }
+
+        const auto id = header >> 1;
+
+        // definitions of the formats are numbered in the order they appear
+        if (header & 1) {
+            uint64_t length;
+            status = read_varint(ptr, end, &length);
+            if (status <= 0) {
+                return status;
+            }
+            if (length > uint64_t(end - *ptr)) {
+                return 0;
+            }
+            if (id != m_formatCount) {
+                return -1;
+            }
+
+            if (m_stringsLength + length > m_stringsCapacity) {
+                const auto capacity = std::max(2 * m_stringsCapacity, m_stringsLength + size_t(length));
+                const auto strings = new char[capacity];
+                if (m_stringsLength) {
+                    std::memcpy(strings, m_strings, m_stringsLength);
+                }
+                delete[] m_strings;
+                m_strings = strings;
+                m_stringsCapacity = capacity;
+            }
+
+            if (m_formatCount == m_formatCapacity) {
+                const auto capacity = std::max(2 * m_formatCapacity, uint32_t(16));
+                const auto formats = new Format[capacity];
+                if (m_formatCount) {
+                    std::memcpy(formats, m_formats, m_formatCount * sizeof(Format));
+                }
+                delete[] m_formats;
+                m_formats = formats;
+                m_formatCapacity = capacity;
+            }
+
+            if (length) {
+                std::memcpy(m_strings + m_stringsLength, *ptr, size_t(length));
+            }
+            m_formats[m_formatCount].offset = m_stringsLength;
+            m_formats[m_formatCount].length = ptrdiff_t(length);
+            m_stringsLength += size_t(length);
+            ++m_formatCount;
+
+            *ptr += length;
+            return 1;
+        }
+
+        uint64_t argc;
+        status = read_varint(ptr, end, &argc);
+        if (status <= 0) {
+            return status;
+        }
+        if (id >= m_formatCount || argc > BinaryLogWriter::MAX_ARGS) {
+            return -1;
+        }
+
+        // strings reference the data, rather than being copied
+        FormatArg args[BinaryLogWriter::MAX_ARGS];
+
+        for (uint64_t i = 0; i < argc; ++i) {
+            if (*ptr == end) {
+                return 0;
+            }
+
+            auto& arg = args[i];
+            arg.type = FormatArg::Type(*(*ptr)++);
+            uint64_t value = 0;
+
+            switch (arg.type) {
+            case FormatArg::TYPE_BOOL:
+                if (*ptr == end) {
+                    return 0;
+                }
+                arg.value.b = *(*ptr)++ != 0;
+                break;
+            case FormatArg::TYPE_CHAR:
+                status = read_varint(ptr, end, &value);
+                if (status <= 0) {
+                    return status;
+                }
+                arg.value.c = char32_t(value);
+                break;
+            case FormatArg::TYPE_INT:
+                status = read_varint(ptr, end, &value);
+                if (status <= 0) {
+                    return status;
+                }
+                arg.value.i = (long long)((value >> 1) ^ (0 - (value & 1)));
+                break;
+            case FormatArg::TYPE_UINT:
+                status = read_varint(ptr, end, &value);
+                if (status <= 0) {
+                    return status;
+                }
+                arg.value.u = value;
+                break;
+            case FormatArg::TYPE_FLOAT:
+                if (end - *ptr < ptrdiff_t(sizeof(arg.value.f))) {
+                    return 0;
+                }
+                std::memcpy(&arg.value.f, *ptr, sizeof(arg.value.f));
+                *ptr += sizeof(arg.value.f);
+                break;
+            case FormatArg::TYPE_DOUBLE:
+                if (end - *ptr < ptrdiff_t(sizeof(arg.value.d))) {
+                    return 0;
+                }
+                std::memcpy(&arg.value.d, *ptr, sizeof(arg.value.d));
+                *ptr += sizeof(arg.value.d);
+                break;
+            case FormatArg::TYPE_STRING:
+                status = read_varint(ptr, end, &value);
+                if (status <= 0) {
+                    return status;
+                }
+                if (value > uint64_t(end - *ptr)) {
+                    return 0;
+                }
+                arg.value.string.ptr = *ptr;
+                arg.value.string.length = ptrdiff_t(value);
+                *ptr += value;
+                break;
+            case FormatArg::TYPE_POINTER:
+                status = read_varint(ptr, end, &value);
+                if (status <= 0) {
+                    return status;
+                }
+                arg.value.p = reinterpret_cast<const void*>(uintptr_t(value));
+                break;
+            case FormatArg::TYPE_NONE:
+            case FormatArg::TYPE_CUSTOM:
+            default:
+                return -1;
+            }
+        }
+
+        const auto& format = m_formats[id];
+        vformat(writer, StringView(m_strings + format.offset, format.length), FormatArgs(args, int32_t(argc)));
+        return 1;
+    }
+#endif
+
+    inline BufferedWriter::BufferedWriter(char* buffer, size_t size)
+        : m_begin(buffer)
+        , m_next(buffer)
+        , m_end(buffer + size)
+        , m_flushed(0)
+        , m_discarded(0)
+        , m_referenceSize(std::numeric_limits<size_t>::max())
+    {
+    }
+
+    enum {
+        SMALL_COPY_SIZE = 16, //< Largest copy done inline, rather than through `memcpy`.
+    };
+
+    /// Copy up to `SMALL_COPY_SIZE` `char`s with fixed-size, overlapping
+    /// moves. Most writes are only a few `char`s, for which calling out to
+    /// `memcpy` costs more than the copy itself.
+    inline void copy_small(char* dst, const char* src, size_t length)
+    {
+        if (length >= 8) {
+            uint64_t head, tail;
+            std::memcpy(&head, src, 8);
+            std::memcpy(&tail, src + length - 8, 8);
+            std::memcpy(dst, &head, 8);
+            std::memcpy(dst + length - 8, &tail, 8);
+        } else if (length >= 4) {
+            uint32_t head, tail;
+            std::memcpy(&head, src, 4);
+            std::memcpy(&tail, src + length - 4, 4);
+            std::memcpy(dst, &head, 4);
+            std::memcpy(dst + length - 4, &tail, 4);
+        } else if (length) {
+            const char first = src[0];
+            const char middle = src[length / 2];
+            const char last = src[length - 1];
+            dst[0] = first;
+            dst[length / 2] = middle;
+            dst[length - 1] = last;
+        }
+    }
+
+    /// Fill up to `SMALL_COPY_SIZE` `char`s with fixed-size, overlapping
+    /// stores.
+    inline void fill_small(char* dst, size_t count, char ch)
+    {
+        if (count >= 8) {
+            const uint64_t pattern = uint8_t(ch) * 0x0101010101010101ull;
+            std::memcpy(dst, &pattern, 8);
+            std::memcpy(dst + count - 8, &pattern, 8);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                dst[i] = ch;
+            }
+        }
+    }
+
+    inline size_t BufferedWriter::write(size_t length, const void* data)
+    {
+        if (length <= size_t(m_end - m_next)) {
+            // either pointer may be null when there is nothing to copy
+            if (length <= SMALL_COPY_SIZE) {
+                copy_small(m_next, static_cast<const char*>(data), length);
+            } else {
+                std::memcpy(m_next, data, length);
+            }
+            m_next += length;
+            return length;
+        }
+
+        return write_slow(length, static_cast<const char*>(data));
+    }
+
+    inline size_t BufferedWriter::fill(size_t count, char ch)
+    {
+        if (count <= size_t(m_end - m_next)) {
+            if (count <= SMALL_COPY_SIZE) {
+                fill_small(m_next, count, ch);
+            } else {
+                std::memset(m_next, ch, count);
+            }
+            m_next += count;
+            return count;
+        }
+
+        return fill_slow(count, ch);
+    }
+
+    inline size_t BufferedWriter::reference(size_t length, const void* data)
+    {
+        if (length >= m_referenceSize) {
+            return write_reference(length, static_cast<const char*>(data));
+        }
+
+        return write(length, data);
+    }
+
+    inline size_t BufferedWriter::write_reference(size_t length, const char* data)
+    {
+        return write(length, data);
+    }
+
+    inline void BufferedWriter::set_reference_size(size_t size)
+    {
+        m_referenceSize = size;
+    }
+
+    inline char* BufferedWriter::reserve(size_t length)
+    {
+        if (length > size_t(m_end - m_next)) {
+            if (!flush_buffer(length) || length > size_t(m_end - m_next)) {
+                return nullptr;
+            }
+        }
+
+        return m_next;
+    }
+
+    inline void BufferedWriter::commit(size_t length)
+    {
+        m_next += length;
+    }
+
+    inline size_t BufferedWriter::size() const
+    {
+        return m_flushed + size_t(m_next - m_begin);
+    }
+
+    inline size_t BufferedWriter::discarded() const
+    {
+        return m_discarded;
+    }
+
+    inline bool BufferedWriter::counting() const
+    {
+        return !m_begin;
+    }
+
+    inline void BufferedWriter::skip(size_t length)
+    {
+        m_flushed += length;
+    }
+
+    inline void BufferedWriter::set_buffer(char* buffer, size_t size, size_t flushed)
+    {
+        m_flushed += flushed;
+        m_begin = buffer;
+        m_next = buffer;
+        m_end = buffer + size;
+    }
+
+    inline void BufferedWriter::reset_buffer(char* buffer, size_t size, size_t used)
+    {
+        m_flushed = 0;
+        m_discarded = 0;
+        m_begin = buffer;
+        m_next = buffer + used;
+        m_end = buffer + size;
+    }
+
+    inline char* BufferedWriter::buffer() const
+    {
+        return m_begin;
+    }
+
+    inline size_t BufferedWriter::buffered() const
+    {
+        return size_t(m_next - m_begin);
+    }
+
+#if SP_DEFINE_ENGINE
+    SP_INLINE size_t BufferedWriter::write_slow(size_t length, const char* data)
+    {
+        size_t written = 0;
+
+        while (written < length) {
+            auto avail = size_t(m_end - m_next);
+
+            if (!avail) {
+                if (!flush_buffer(length - written)) {
+                    discard(length - written);
+                    break;
+                }
+                continue;
+            }
+
+            const auto toCopy = std::min(avail, length - written);
+            std::memcpy(m_next, data + written, toCopy);
+            m_next += toCopy;
+            written += toCopy;
+        }
+
+        return written;
+    }
+
+    SP_INLINE void BufferedWriter::discard(size_t length)
+    {
+        m_flushed += length;
+        m_discarded += m_begin ? length : 0;
+    }
+
+    SP_INLINE size_t BufferedWriter::fill_slow(size_t count, char ch)
+    {
+        size_t written = 0;
+
+        while (written < count) {
+            auto avail = size_t(m_end - m_next);
+
+            if (!avail) {
+                if (!flush_buffer(count - written)) {
+                    discard(count - written);
+                    break;
+                }
+                continue;
+            }
+
+            const auto toFill = std::min(avail, count - written);
+            std::memset(m_next, ch, toFill);
+            m_next += toFill;
+            written += toFill;
+        }
+
+        return written;
+    }
+#endif
+
+    inline void write_char(IWriter& writer, char ch)
+    {
+        writer.write(1, &ch);
+    }
+
+    constexpr StringView::StringView() {}
+
+    inline StringView::StringView(const char str[])
+        : ptr(str)
+        , length(str ? ptrdiff_t(std::strlen(str)) : 0)
+    {
+    }
+
+    constexpr StringView::StringView(const char str[], ptrdiff_t length)
+        : ptr(str)
+        , length(length)
+    {
+    }
+
+    inline StaticString static_string(const StringView& str)
+    {
+        StaticString result;
+        result.str = str;
+        return result;
+    }
+
+    constexpr bool is_digit(char ch)
+    {
+        return ch >= '0' && ch <= '9';
+    }
+
+    constexpr bool is_align(char ch)
+    {
+        return (ch >= '<' && ch <= '>') || ch == '^';
+    }
+
+    constexpr bool is_int_type(char type)
+    {
+        return type == 'b' || type == 'c' || type == 'd' || type == 'o' || type == 'x' || type == 'X';
+    }
+
+    constexpr bool is_float_type(char type)
+    {
+        return type == 'e' || type == 'E' || type == 'f' || type == 'F' || type == 'g' || type == 'G' || type == '%';
+    }
+
+    constexpr bool is_type(char type)
+    {
+        return is_int_type(type) || is_float_type(type) || type == 's' || type == 'j' || type == 'q';
+    }
+
+    /// Reads the characters of a format specifier for `parse_flags`.
+    struct SpecReader {
+        const char* next;
+        const char* term;
+
+        /// Read the character `offset` characters ahead into `ch`. Return
+        /// `false` if there is none.
+        SP_CONSTEXPR14 bool peek(int32_t offset, char* ch) const
+        {
+            if (term - next <= offset) {
+                return false;
+            }
+            *ch = next[offset];
+            return true;
+        }
+
+        /// Advance past `count` characters.
+        SP_CONSTEXPR14 void skip(int32_t count)
+        {
+            next += count;
+        }
+
+        /// Read a number substituted into the specifier at the current
+        /// position, if there is one. Plain text never holds one.
+        SP_CONSTEXPR14 bool number(int32_t*)
+        {
+            return false;
+        }
+    };
+
+    /// Parse a format specifier from the provided reader into `flags`. Widths
+    /// and precisions that don't fit in an `int32_t` are invalid.
+    template <class Reader>
+    SP_CONSTEXPR14 bool parse_flags(Reader& reader, FormatFlags* flags)
+    {
+        const int32_t MAX_FLAG_VALUE = (std::numeric_limits<int32_t>::max() - 9) / 10;
+        char ch = 0;
+        char next = 0;
+        int32_t number = 0;
+        *flags = FormatFlags{};
+
+        // [[fill]align]
+        if (reader.peek(0, &ch)) {
+            if (reader.peek(1, &next) && is_align(next)) {
+                flags->fill = ch;
+                flags->align = next;
+                reader.skip(2);
+            } else if (is_align(ch)) {
+                flags->align = ch;
+                reader.skip(1);
+            }
+        }
+
+        // [sign]
+        if (reader.peek(0, &ch) && (ch == '+' || ch == '-' || ch == ' ')) {
+            flags->sign = ch;
+            reader.skip(1);
+        }
+
+        // [#]
+        if (reader.peek(0, &ch) && ch == '#') {
+            flags->alternate = true;
+            reader.skip(1);
+        }
+
+        // [width]
+        if (reader.number(&number)) {
+            flags->width = number;
+        }
+
+        while (reader.peek(0, &ch) && is_digit(ch)) {
+            if (flags->width < 0) {
+                if (ch == '0') {
+                    flags->fill = flags->fill ? flags->fill : '0';
+                    flags->align = flags->align ? flags->align : '=';
+                }
+                flags->width = 0;
+            }
+            if (flags->width > MAX_FLAG_VALUE) {
+                return false;
+            }
+            flags->width = (flags->width * 10) + (ch - '0');
+            reader.skip(1);
+        }
+
+        // [.precision]
+        if (reader.peek(0, &ch) && ch == '.' && reader.peek(1, &next) && is_digit(next)) {
+            reader.skip(1);
+            flags->precision = reader.number(&number) ? number : 0;
+
+            while (reader.peek(0, &ch) && is_digit(ch)) {
+                if (flags->precision > MAX_FLAG_VALUE) {
+                    return false;
+                }
+                flags->precision = (flags->precision * 10) + (ch - '0');
+                reader.skip(1);
+            }
+        }
+
+        // [type]
+        if (reader.peek(0, &ch) && is_type(ch)) {
+            flags->type = ch;
+            reader.skip(1);
+        }
+
+        // anything after the flags makes them invalid
+        return !reader.peek(0, &ch);
+    }
+
+    inline SP_CONSTEXPR14 bool parse_format(const StringView& fmt, FormatFlags* flags)
+    {
+        SpecReader reader{ fmt.ptr, fmt.ptr + fmt.length };
+        return parse_flags(reader, flags);
+    }
+
+#if SP_DEFINE_ENGINE
+    inline int32_t trailing_zeros(uint64_t value)
+    {
+    #if defined(__GNUC__) || defined(__clang__)
+        return value ? __builtin_ctzll(value) : 64;
+    #else
+        int32_t zeros = 0;
+        while (zeros < 64 && !(value & 1)) {
+            value >>= 1;
+            ++zeros;
+        }
+        return zeros;
+    #endif
+    }
+
+    /// Skip past the literal text at `next` a block at a time, and return
+    /// either the first brace, or a position at most a block before it (or
+    /// before `term`).
+    SP_INLINE const char* skip_literal(const char* next, const char* term)
+    {
+    #if defined(SP_SIMD_AVX2)
+        const auto open32 = _mm256_set1_epi8('{');
+        const auto close32 = _mm256_set1_epi8('}');
+
+        while (term - next >= 32) {
+            const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next));
+            const auto braces = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, open32), _mm256_cmpeq_epi8(chunk, close32));
+            const auto mask = uint32_t(_mm256_movemask_epi8(braces));
+
+            if (mask) {
+                return next + trailing_zeros(mask);
+            }
+            next += 32;
+        }
+    #endif
+
+    #if defined(SP_SIMD_SSE2)
+        const auto open = _mm_set1_epi8('{');
+        const auto close = _mm_set1_epi8('}');
+
+        while (term - next >= 16) {
+            const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(next));
+            const auto braces = _mm_or_si128(_mm_cmpeq_epi8(chunk, open), _mm_cmpeq_epi8(chunk, close));
+            const auto mask = uint32_t(_mm_movemask_epi8(braces));
+
+            if (mask) {
+                return next + trailing_zeros(mask);
+            }
+            next += 16;
+        }
+    #elif defined(SP_SIMD_NEON)
+        const auto open = vdupq_n_u8('{');
+        const auto close = vdupq_n_u8('}');
+
+        while (term - next >= 16) {
+            const auto chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(next));
+            const auto braces = vorrq_u8(vceqq_u8(chunk, open), vceqq_u8(chunk, close));
+
+            // narrow each byte of the comparison to 4 bits
+            const auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(braces), 4);
+            const auto mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+
+            if (mask) {
+                return next + trailing_zeros(mask) / 4;
+            }
+            next += 16;
+        }
+    #else
+        // eight bytes at a time, leaving the exact position to the caller
+        const uint64_t ones = 0x0101010101010101ull;
+        const uint64_t highs = 0x8080808080808080ull;
+
+        while (term - next >= 8) {
+            uint64_t word;
+            std::memcpy(&word, next, sizeof(word));
+
+            const auto open = word ^ (ones * '{');
+            const auto close = word ^ (ones * '}');
+
+            if (((open - ones) & ~open & highs) | ((close - ones) & ~close & highs)) {
+                return next;
+            }
+            next += 8;
+        }
+    #endif
+
+        return next;
+    }
+#else
+    const char* skip_literal(const char* next, const char* term);
+#endif
+
+    /// Return the first `{` or `}` in `[next, term)`, or `term` if there is
+    /// none.
+    inline SP_CONSTEXPR14 const char* find_brace(const char* next, const char* term)
+    {
+        if (!SP_CONSTANT_EVALUATED()) {
+            next = skip_literal(next, term);
+        }
+
+        while (next < term && *next != '{' && *next != '}') {
+            ++next;
+        }
+
+        return next;
+    }
+
+    inline SP_CONSTEXPR14 FormatTokenizer::FormatTokenizer(const StringView& fmt, int32_t* prevIndex)
+        : m_next(fmt.ptr)
+        , m_term(fmt.ptr + fmt.length)
+        , m_prevIndex(prevIndex)
+    {
+    }
+
+    inline SP_CONSTEXPR14 bool FormatTokenizer::next(FormatToken* token)
+    {
+        if (m_next == m_term) {
+            return false;
+        }
+
+        const auto start = m_next;
+        const auto term = m_term;
+        auto next = m_next;
+        *token = FormatToken{};
+
+        while (next < term) {
+            const auto ptr = find_brace(next, term);
+
+            if (ptr == term) {
+                break;
+            }
+            next = ptr + 1;
+
+            // closing braces are output as-is, with `}}` collapsing into one
+            if (*ptr == '}') {
+                token->literal = StringView(start, next - start);
+                m_next = (next < term && *next == '}') ? next + 1 : next;
+                return true;
+            }
+
+            // a trailing `{` can't open a field, so it's just a literal
+            if (next == term) {
+                continue;
+            }
+
+            // `{{` collapses into a single brace
+            if (*next == '{') {
+                token->literal = StringView(start, next - start);
+                m_next = next + 1;
+                return true;
+            }
+
+            // replacement field
+            auto end = next;
+            auto index = -1;
+
+            while (end < term && is_digit(*end)) {
+                index = (index < 0)
+                    ? (*end - '0')
+                    : (index * 10) + (*end - '0');
+                ++end;
+            }
+
+            if (end == term) {
+                break;
+            }
+
+            if (index < 0) {
+                index = *m_prevIndex + 1;
+            }
+            *m_prevIndex = index;
+
+            auto spec = StringView();
+            auto nested = false;
+
+            if (*end == ':') {
+                const auto specStart = ++end;
+                auto opened = 0;
+
+                while (end < term && (*end != '}' || opened > 0)) {
+                    if (*end == '{') {
+                        ++opened;
+                        nested = true;
+                    } else if (*end == '}') {
+                        --opened;
+                    }
+                    ++end;
+                }
+
+                if (end == term) {
+                    break;
+                }
+
+                spec = StringView(specStart, end - specStart);
+            } else if (*end != '}') {
+                // invalid field, which is output as-is (minus the character
+                // that made it invalid, which is consumed)
+                next = end + 1;
+                continue;
+            }
+
+            ++end;
+            token->literal = StringView(start, ptr - start);
+            token->hasField = true;
+            token->field.spec = spec;
+            token->field.raw = StringView(ptr, end - ptr);
+            token->field.index = index;
+            token->field.nested = nested;
+            m_next = end;
+            return true;
+        }
+
+        token->literal = StringView(start, term - start);
+        m_next = term;
+        return true;
+    }
+
+    /// Advance `prevIndex` past the fields of the provided format, the same
+    /// way formatting it would.
+    inline SP_CONSTEXPR14 void skip_fields(const StringView& fmt, int32_t* prevIndex)
+    {
+        FormatTokenizer tokenizer(fmt, prevIndex);
+        FormatToken token;
+
+        while (tokenizer.next(&token)) {
+            if (token.hasField && token.field.nested) {
+                skip_fields(token.field.spec, prevIndex);
+            }
+        }
+    }
+
+    inline SP_CONSTEXPR14 size_t string_length(const char str[], size_t maxLength)
+    {
+        size_t length = 0;
+
+        while (length < maxLength && str[length]) {
+            ++length;
+        }
+
+        return length;
+    }
+
+    template <size_t N>
+    template <size_t L>
+    inline SP_CONSTEXPR14 CompiledFormat<N>::CompiledFormat(const char (&fmt)[L])
+        : m_source(fmt, ptrdiff_t(string_length(fmt, L)))
+    {
+        compile();
+    }
+
+    template <size_t N>
+    inline SP_CONSTEXPR14 CompiledFormat<N>::CompiledFormat(const StringView& fmt)
+        : m_source(fmt)
+    {
+        compile();
+    }
+
+    template <size_t N>
+    constexpr const StringView& CompiledFormat<N>::source() const
+    {
+        return m_source;
+    }
+
+    template <size_t N>
+    constexpr bool CompiledFormat<N>::compiled() const
+    {
+        return m_compiled;
+    }
+
+    template <size_t N>
+    constexpr const FormatSegment* CompiledFormat<N>::begin() const
+    {
+        return m_segments;
+    }
+
+    template <size_t N>
+    constexpr const FormatSegment* CompiledFormat<N>::end() const
+    {
+        return m_segments + m_count;
+    }
+
+    template <size_t N>
+    inline SP_CONSTEXPR14 void CompiledFormat<N>::compile()
+    {
+        int32_t prevIndex = -1;
+        FormatTokenizer tokenizer(m_source, &prevIndex);
+        FormatToken token;
+
+        while (tokenizer.next(&token)) {
+            if (m_count == N) {
+                m_count = 0;
+                return;
+            }
+
+            auto& segment = m_segments[m_count++];
+            segment.token = token;
+
+            // nested specs depend on the arguments, so those can only be
+            // parsed once formatting
+            if (token.hasField) {
+                if (token.field.nested) {
+                    skip_fields(token.field.spec, &prevIndex);
+                } else {
+                    segment.parsed = parse_format(token.field.spec, &segment.flags);
+                }
+            }
+        }
+
+        m_compiled = true;
+    }
+
+    template <class T>
+    struct FormatArgType {
+        static const FormatArg::Type value = FormatArg::TYPE_CUSTOM;
+    };
+
+    template <class T> struct FormatArgType<T*> { static const FormatArg::Type value = FormatArg::TYPE_POINTER; };
+    template <> struct FormatArgType<std::nullptr_t> { static const FormatArg::Type value = FormatArg::TYPE_POINTER; };
+    template <> struct FormatArgType<bool> { static const FormatArg::Type value = FormatArg::TYPE_BOOL; };
+    template <> struct FormatArgType<char> { static const FormatArg::Type value = FormatArg::TYPE_CHAR; };
+    template <> struct FormatArgType<char16_t> { static const FormatArg::Type value = FormatArg::TYPE_CHAR; };
+    template <> struct FormatArgType<char32_t> { static const FormatArg::Type value = FormatArg::TYPE_CHAR; };
+    template <> struct FormatArgType<wchar_t> { static const FormatArg::Type value = FormatArg::TYPE_CHAR; };
+    template <> struct FormatArgType<signed char> { static const FormatArg::Type value = FormatArg::TYPE_INT; };
+    template <> struct FormatArgType<short> { static const FormatArg::Type value = FormatArg::TYPE_INT; };
+    template <> struct FormatArgType<int> { static const FormatArg::Type value = FormatArg::TYPE_INT; };
+    template <> struct FormatArgType<long> { static const FormatArg::Type value = FormatArg::TYPE_INT; };
+    template <> struct FormatArgType<long long> { static const FormatArg::Type value = FormatArg::TYPE_INT; };
+    template <> struct FormatArgType<unsigned char> { static const FormatArg::Type value = FormatArg::TYPE_UINT; };
+    template <> struct FormatArgType<unsigned short> { static const FormatArg::Type value = FormatArg::TYPE_UINT; };
+    template <> struct FormatArgType<unsigned> { static const FormatArg::Type value = FormatArg::TYPE_UINT; };
+    template <> struct FormatArgType<unsigned long> { static const FormatArg::Type value = FormatArg::TYPE_UINT; };
+    template <> struct FormatArgType<unsigned long long> { static const FormatArg::Type value = FormatArg::TYPE_UINT; };
+    template <> struct FormatArgType<float> { static const FormatArg::Type value = FormatArg::TYPE_FLOAT; };
+    template <> struct FormatArgType<double> { static const FormatArg::Type value = FormatArg::TYPE_DOUBLE; };
+    template <> struct FormatArgType<char*> { static const FormatArg::Type value = FormatArg::TYPE_STRING; };
+    template <> struct FormatArgType<const char*> { static const FormatArg::Type value = FormatArg::TYPE_STRING; };
+    template <> struct FormatArgType<StringView> { static const FormatArg::Type value = FormatArg::TYPE_STRING; };
+    template <> struct FormatArgType<StaticString> { static const FormatArg::Type value = FormatArg::TYPE_STRING; };
+
+    /// Whether the provided flags apply to arguments of the provided type.
+    inline SP_CONSTEXPR14 bool accepts_flags(FormatArg::Type type, const FormatFlags& flags)
+    {
+        switch (type) {
+        case FormatArg::TYPE_BOOL:
+            return !flags.type || flags.type == 's' || flags.type == 'j' || is_int_type(flags.type);
+        case FormatArg::TYPE_CHAR:
+        case FormatArg::TYPE_POINTER:
+            return (!flags.type || is_int_type(flags.type)) && flags.precision < 0;
+        case FormatArg::TYPE_INT:
+        case FormatArg::TYPE_UINT:
+            return (!flags.type || flags.type == 'j' || is_int_type(flags.type)) && flags.precision < 0;
+        case FormatArg::TYPE_FLOAT:
+        case FormatArg::TYPE_DOUBLE:
+            return !flags.type || flags.type == 'j' || is_float_type(flags.type);
+        case FormatArg::TYPE_STRING:
+            return !flags.type || flags.type == 's' || flags.type == 'j' || flags.type == 'q';
+        default:
+            return true;
+        }
+    }
+
+    inline SP_CONSTEXPR14 FormatCheck check_fields(const StringView& fmt, const FormatArg::Type* types, int32_t count, int32_t* prevIndex, uint64_t* used)
+    {
+        const auto term = fmt.ptr + fmt.length;
+        FormatTokenizer tokenizer(fmt, prevIndex);
+        FormatToken token;
+
+        while (tokenizer.next(&token)) {
+            // an opening brace in literal text is only valid as the first of
+            // an escaped `{{`, which ends the literal
+            const auto& literal = token.literal;
+
+            for (ptrdiff_t i = 0; i < literal.length; ++i) {
+                const auto next = literal.ptr + i + 1;
+
+                if (literal.ptr[i] == '{' && (i + 1 < literal.length || next == term || *next != '{')) {
+                    return FORMAT_INVALID_FIELD;
+                }
+            }
+
+            if (!token.hasField) {
+                continue;
+            }
+
+            const auto index = token.field.index;
+
+            if (index >= count) {
+                return FORMAT_MISSING_ARG;
+            }
+            if (index < 64) {
+                *used |= uint64_t(1) << index;
+            }
+
+            if (token.field.nested) {
+                const auto result = check_fields(token.field.spec, types, count, prevIndex, used);
+                if (result != FORMAT_OK) {
+                    return result;
+                }
+            } else if (types[index] != FormatArg::TYPE_CUSTOM) {
+                FormatFlags flags;
+                if (!parse_format(token.field.spec, &flags)) {
+                    return FORMAT_INVALID_SPEC;
+                }
+                if (!accepts_flags(types[index], flags)) {
+                    return FORMAT_TYPE_MISMATCH;
+                }
+            }
+        }
+
+        return FORMAT_OK;
+    }
+
+    inline SP_CONSTEXPR14 FormatCheck check_format(const StringView& fmt, const FormatArg::Type* types, int32_t count)
+    {
+        int32_t prevIndex = -1;
+        uint64_t used = 0;
+        const auto result = check_fields(fmt, types, count, &prevIndex, &used);
+
+        if (result != FORMAT_OK) {
+            return result;
+        }
+
+        const auto all = count >= 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+        return used == all ? FORMAT_OK : FORMAT_UNUSED_ARG;
+    }
+
+#if SP_HAS_CONSTEXPR14
+    /// Amount of segments a `CompiledFormat` of the provided format needs.
+    constexpr size_t count_segments(const StringView& fmt)
+    {
+        int32_t prevIndex = -1;
+        FormatTokenizer tokenizer(fmt, &prevIndex);
+        FormatToken token;
+        size_t count = 0;
+
+        while (tokenizer.next(&token)) {
+            ++count;
+        }
+
+        return count;
+    }
+
+    template <class S>
+    struct LiteralFormat {
+        using Compiled = CompiledFormat<count_segments(StringView(S::data(), S::size()))>;
+
+        static constexpr Compiled compiled = Compiled(StringView(S::data(), S::size()));
+
+        static constexpr const Compiled& get()
+        {
+            return compiled;
+        }
+    };
+
+    template <class S>
+    constexpr typename LiteralFormat<S>::Compiled LiteralFormat<S>::compiled;
+#else
+    template <class S>
+    struct LiteralFormat {
+        static constexpr StringView get()
+        {
+            return StringView(S::data(), S::size());
+        }
+    };
+#endif
+
+#if SP_DEFINE_ENGINE
+    inline int32_t bit_length(uint64_t value)
+    {
+    #if defined(__GNUC__) || defined(__clang__)
+        return value ? 64 - __builtin_clzll(value) : 0;
+    #else
+        int32_t bits = 0;
+        for (int32_t step = 32; step; step >>= 1) {
+            if (value >> step) {
+                value >>= step;
+                bits += step;
+            }
+        }
+        return bits + int32_t(value);
+    #endif
+    }
+
+    inline uint64_t pow10_u64(int32_t exponent)
+    {
+        static const uint64_t powers[] = {
+            1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+            100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+            10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+            100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+        };
+        return powers[exponent];
+    }
+
+    /// Number of decimal digits in `value`, from its bit length.
+    inline int32_t decimal_length(uint64_t value)
+    {
+        // bits * log10(2), which is either exact or one too high
+        value |= 1;
+        const auto guess = (bit_length(value) * 1233) >> 12;
+        return guess + 1 - (value < pow10_u64(guess));
+    }
+
+    /// Writes the decimal digits of `value` backwards from `end`, two at a
+    /// time, and returns the first digit.
+    inline char* write_decimal(char* end, uint64_t value)
+    {
+        static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+        while (value >= 100) {
+            const auto pair = size_t(value % 100) * 2;
+            value /= 100;
+            *(--end) = pairs[pair + 1];
+            *(--end) = pairs[pair];
+        }
+
+        if (value >= 10) {
+            const auto pair = size_t(value) * 2;
+            *(--end) = pairs[pair + 1];
+            *(--end) = pairs[pair];
+        } else {
+            *(--end) = char('0' + value);
+        }
+
+        return end;
+    }
+
+    /// Writes the digits of `value` in base `2^shift` backwards from `end`,
+    /// and returns the first digit.
+    inline char* write_pow2(char* end, uint64_t value, int32_t shift, const char* digitchars)
+    {
+        const auto mask = (uint64_t(1) << shift) - 1;
+
+        do {
+            *(--end) = digitchars[value & mask];
+            value >>= shift;
+        } while (value);
+
+        return end;
+    }
+
+    /// Write the UTF-8 encoding of the code point `value` before `end`, and
+    /// return its start.
+    inline char* write_utf8(char* end, uint32_t value)
+    {
+        if (value < 0x80) {
+            *(--end) = char(value);
+            return end;
+        }
+
+        // continuation bytes, until the rest fits in the leading byte
+        uint32_t lead = 0x80;
+        uint32_t limit = 0x40;
+
+        while (value >= limit) {
+            *(--end) = char(0x80 | (value & 0x3f));
+            value >>= 6;
+            lead = (lead >> 1) | 0x80;
+            limit >>= 1;
+        }
+
+        *(--end) = char(lead | value);
+        return end;
+    }
+
+    inline bool format_int(BufferedWriter& writer, const FormatFlags& flags, bool isNegative, uint64_t value)
+    {
+        // determine base
+        int32_t base = 10;
+
+        switch (flags.type) {
+        case 'b':
+            base = 2;
+            break;
+        case 'o':
+            base = 8;
+            break;
+        case 'c':
+        case 'x':
+        case 'X':
+            base = 16;
+            break;
+        }
+
+        const int32_t shift = base == 16 ? 4 : (base == 8 ? 3 : 1);
+
+        // when only counting, the length is all that matters
+        if (writer.counting() && flags.type != 'c') {
+            auto nchars = base == 10 ? decimal_length(value) : (bit_length(value | 1) + shift - 1) / shift;
+            nchars += (flags.alternate && base != 10) ? 2 : 0;
+            nchars += (isNegative || flags.sign == '+' || flags.sign == ' ') ? 1 : 0;
+            writer.skip(size_t(std::max(flags.width, nchars)));
+            return true;
+        }
+
+        // count digits, and copy them to a buffer (so we don't have to repeat
+        // this later)
+        char buffer[67]; // max needed; 64-bit binary + sign + alternate prefix
+        char* digits = buffer + sizeof(buffer);
+        char* prefix = buffer + 3;
+        int32_t ndigits = 0;
+        int32_t nprefix = 0;
+        char type = flags.type;
+
+        const bool isChar = type == 'c';
+#if defined(SP_ENABLE_UTF8)
+        // code points, excluding the surrogates
+        const bool charAsUtf8 = !isNegative && value <= 0x10ffff && (value < 0xd800 || value > 0xdfff);
+#else
+        const bool charAsUtf8 = !isNegative && value < 0x80;
+#endif
+        const bool charAsHex = !charAsUtf8;
+        int32_t ncontinuations = 0; //< bytes of the character that don't take up width
+
+        if (isChar) {
+            if (charAsHex) {
+                *(--digits) = ')';
+                ndigits = 1;
+            } else {
+                const auto end = digits;
+                digits = write_utf8(end, uint32_t(value));
+                ndigits = int32_t(end - digits);
+                ncontinuations = ndigits - 1;
+            }
+        }
+
+        if (!isChar || charAsHex) {
+            const auto digitchars = (flags.type == 'X')
+                ? "0123456789ABCDEFX"
+                : "0123456789abcdefx";
+
+            if (base == 10) {
+                ndigits += decimal_length(value);
+                digits = write_decimal(digits, value);
+            } else {
+                ndigits += (bit_length(value | 1) + shift - 1) / shift;
+                digits = write_pow2(digits, value, shift, digitchars);
+            }
+
+            if (flags.alternate) {
+                switch (base) {
+                case 2:
+                    *(--prefix) = 'b';
+                    *(--prefix) = '0';
+                    nprefix += 2;
+                    break;
+                case 8:
+                    *(--prefix) = 'o';
+                    *(--prefix) = '0';
+                    nprefix += 2;
+                    break;
+                case 16:
+                    *(--prefix) = digitchars[16];
+                    *(--prefix) = '0';
+                    nprefix += 2;
+                    break;
+                }
+            }
+        }
+
+        // determine sign
+        if (isNegative) {
+            *(--prefix) = '-';
+            ++nprefix;
+        } else if (flags.sign == '+' || flags.sign == ' ') {
+            *(--prefix) = flags.sign;
+            ++nprefix;
+        }
+
+        // for hex chars, the prefix should be part of the value
+        if (isChar && charAsHex) {
+            if (nprefix) {
+                digits -= nprefix;
+                ndigits += nprefix;
+                memcpy(digits, prefix, nprefix);
+                nprefix = 0;
+            }
+            *(--digits) = '(';
+            ++ndigits;
+        }
+
+        // determine spacing
+        int32_t leadSpace = 0;
+        int32_t tailSpace = 0;
+        {
+            int32_t nchars = ndigits + nprefix - ncontinuations;
+            int32_t width = std::max(flags.width, nchars);
+
+            switch (flags.align) {
+            case '^':
+                leadSpace = (width / 2) - ((nchars + 1) / 2); // nchars rounded up
+                tailSpace = ((width + 1) / 2) - (nchars / 2); // width rounded up
+                leadSpace += (width & 1) & (nchars & 1); // if both are odd, we need to add one for correction
+                tailSpace -= (width & 1) & (nchars & 1); // if both are odd, we need to remove one for correction
+                break;
+            case '<':
+                tailSpace = width - nchars;
+                break;
+            case '>':
+            case '=':
+            default:
+                leadSpace = width - nchars;
+                break;
+            }
+        }
+
+        // print sign and alternate prefix, if they should be before the padding
+        if (nprefix) {
+            switch (flags.align) {
+            case '^':
+            case '>':
+                break;
+            case '<':
+            case '=':
+            default:
+                writer.write(nprefix, prefix);
+                nprefix = 0;
+                break;
+            }
+        }
+
+        // apply the leading padding
+        const char fill = flags.fill ? flags.fill : ' ';
+
+        if (leadSpace > 0) {
+            writer.fill(size_t(leadSpace), fill);
+        }
+
+        // print the prefix, if it should be after the padding
+        if (nprefix) {
+            writer.write(nprefix, prefix);
+        }
+
+        // print digits
+        writer.write(ndigits, digits);
+
+        // print tailing padding
+        if (tailSpace > 0) {
+            writer.fill(size_t(tailSpace), fill);
+        }
+
+        return true;
+    }
+
+    /// Significant decimal digits of a floating point value, read as
+    /// `d.ddd * 10^exponent`. Digits past `count` are implicitly zero, and a
+    /// count of zero is the value zero.
+    struct FloatDigits {
+        char digits[768]; //< the longest exact expansion of a double is 767 digits
+        int32_t count = 0;
+        int32_t exponent = 0;
+    };
+
+    /// Binary decomposition of a finite, non-negative float: `mantissa * 2^exponent`.
+    struct FloatParts {
+        uint64_t mantissa;
+        int32_t exponent;
+        bool lowerCloser; //< lower neighbour is half as far away (power of two)
+    };
+
+    inline FloatParts float_parts(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        const auto biased = int32_t((bits >> 52) & 0x7ff);
+        const auto fraction = bits & ((uint64_t(1) << 52) - 1);
+
+        if (biased) {
+            return { fraction | (uint64_t(1) << 52), biased - 1075, fraction == 0 && biased > 1 };
+        }
+
+        return { fraction, -1074, false };
+    }
+
+    inline FloatParts float_parts(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        const auto biased = int32_t((bits >> 23) & 0xff);
+        const auto fraction = bits & ((uint32_t(1) << 23) - 1);
+
+        if (biased) {
+            return { fraction | (uint32_t(1) << 23), biased - 150, fraction == 0 && biased > 1 };
+        }
+
+        return { fraction, -149, false };
+    }
+
+    inline void set_float_digits(FloatDigits* out, uint64_t value, int32_t exponent)
+    {
+        if (!value) {
+            out->count = 0;
+            out->exponent = 0;
+            return;
+        }
+
+        const auto length = decimal_length(value);
+        write_decimal(out->digits + length, value);
+
+        out->count = length;
+        out->exponent = exponent + length - 1;
+    }
+
+    /// Estimate of floor(log10(mantissa * 2^exponent)); either exact or one too low.
+    inline int32_t estimate_log10(uint64_t mantissa, int32_t exponent)
+    {
+        return int32_t(std::ceil((exponent + bit_length(mantissa) - 1) * 0.30102999566398114 - 1e-10)) - 1;
+    }
+
+    struct Uint128 {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    inline Uint128 multiply_u64(uint64_t a, uint64_t b)
+    {
+    #if defined(__SIZEOF_INT128__)
+        const auto product = static_cast<unsigned __int128>(a) * b;
+        return { uint64_t(product >> 64), uint64_t(product) };
+    #else
+        const uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+        const uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+        const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+        const uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+        return { p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32), (mid << 32) | (p00 & 0xffffffff) };
+    #endif
+    }
+
+    inline int compare_u128(const Uint128& a, const Uint128& b)
+    {
+        if (a.hi != b.hi) {
+            return a.hi < b.hi ? -1 : 1;
+        }
+        return a.lo < b.lo ? -1 : (a.lo > b.lo ? 1 : 0);
+    }
+
+    /// Rounds `value * 10^scale` to an integer, ties to even, using 128-bit
+    /// arithmetic. Returns false if the inputs are out of range for this path.
+    inline bool round_scaled(const FloatParts& parts, int32_t scale, uint64_t* result)
+    {
+        const auto m = parts.mantissa;
+        const auto e = parts.exponent;
+
+        if (e >= 0) {
+            // the value is an integer
+            if (bit_length(m) + e > 64) {
+                return false;
+            }
+
+            const auto value = m << e;
+
+            if (scale >= 0) {
+                if (scale > 19 || value > UINT64_MAX / pow10_u64(scale)) {
+                    return false;
+                }
+                *result = value * pow10_u64(scale);
+                return true;
+            }
+
+            if (-scale > 19) {
+                *result = 0; // < 2^64 / 10^20, rounds to zero
+                return true;
+            }
+
+            const auto divisor = pow10_u64(-scale);
+            const auto rem = value % divisor;
+            auto quot = value / divisor;
+            if (rem > divisor - rem || (rem == divisor - rem && (quot & 1))) {
+                ++quot;
+            }
+            *result = quot;
+            return true;
+        }
+
+        const auto shift = -e;
+
+        if (scale >= 0) {
+            if (scale > 19) {
+                return false;
+            }
+
+            const auto product = multiply_u64(m, pow10_u64(scale));
+
+            if (shift >= 128) {
+                *result = 0; // < 2^117 / 2^128, rounds to zero
+                return true;
+            }
+
+            // split the product at the binary point
+            Uint128 quot, rem, half;
+            if (shift >= 64) {
+                quot = { 0, product.hi >> (shift - 64) };
+                rem = { product.hi & ((uint64_t(1) << (shift - 64)) - 1), product.lo };
+                half = shift == 64 ? Uint128 { 0, uint64_t(1) << 63 } : Uint128 { uint64_t(1) << (shift - 65), 0 };
+            } else {
+                quot = { product.hi >> shift, (product.lo >> shift) | (product.hi << (64 - shift)) };
+                rem = { 0, product.lo & ((uint64_t(1) << shift) - 1) };
+                half = { 0, uint64_t(1) << (shift - 1) };
+            }
+
+            if (quot.hi || quot.lo == UINT64_MAX) {
+                return false;
+            }
+
+            const auto cmp = compare_u128(rem, half);
+            *result = quot.lo + (cmp > 0 || (cmp == 0 && (quot.lo & 1)));
+            return true;
+        }
+
+        // value / (10^-scale * 2^shift), for moderately sized non-integers
+        if (-scale > 19 || shift >= 64) {
+            return false;
+        }
+
+        const auto divisor = pow10_u64(-scale);
+        const auto q1 = m / divisor;
+        const auto r1 = m % divisor;
+        const auto low = q1 & ((uint64_t(1) << shift) - 1);
+        auto quot = q1 >> shift;
+
+        // compare the fraction (low * divisor + r1) / (2^shift * divisor) with one half
+        auto rem = multiply_u64(low, divisor);
+        rem.lo += r1;
+        rem.hi += rem.lo < r1;
+        const auto half = multiply_u64(uint64_t(1) << (shift - 1), divisor);
+        const auto cmp = compare_u128(rem, half);
+        if (cmp > 0 || (cmp == 0 && (quot & 1))) {
+            ++quot;
+        }
+        *result = quot;
+        return true;
+    }
+
+    /// Fixed-capacity unsigned big integer, large enough for the exact
+    /// arithmetic on any double.
+    class Bignum {
+    public:
+        Bignum() = default;
+
+        explicit Bignum(uint64_t value)
+        {
+            while (value) {
+                m_limbs[m_size++] = uint32_t(value);
+                value >>= 32;
+            }
+        }
+
+        bool is_zero() const { return m_size == 0; }
+
+        void shift_left(int32_t bits)
+        {
+            if (!m_size || !bits) {
+                return;
+            }
+
+            const auto limbs = bits / 32;
+            const auto rest = bits % 32;
+
+            if (rest) {
+                m_limbs[m_size] = 0;
+                for (auto i = m_size; i > 0; --i) {
+                    m_limbs[i] = (m_limbs[i] << rest) | (m_limbs[i - 1] >> (32 - rest));
+                }
+                m_limbs[0] <<= rest;
+                if (m_limbs[m_size]) {
+                    ++m_size;
+                }
+            }
+
+            if (limbs) {
+                for (auto i = m_size; i--;) {
+                    m_limbs[i + limbs] = m_limbs[i];
+                }
+                for (int32_t i = 0; i < limbs; ++i) {
+                    m_limbs[i] = 0;
+                }
+                m_size += limbs;
+            }
+        }
+
+        void multiply(uint32_t factor)
+        {
+            uint64_t carry = 0;
+            for (int32_t i = 0; i < m_size; ++i) {
+                carry += uint64_t(m_limbs[i]) * factor;
+                m_limbs[i] = uint32_t(carry);
+                carry >>= 32;
+            }
+            if (carry) {
+                m_limbs[m_size++] = uint32_t(carry);
+            }
+        }
+
+        void multiply_pow10(int32_t exponent)
+        {
+            for (; exponent >= 9; exponent -= 9) {
+                multiply(1000000000);
+            }
+            if (exponent) {
+                multiply(uint32_t(pow10_u64(exponent)));
+            }
+        }
+
+        void add(const Bignum& other)
+        {
+            uint64_t carry = 0;
+            const auto size = std::max(m_size, other.m_size);
+            for (int32_t i = 0; i < size; ++i) {
+                carry += uint64_t(i < m_size ? m_limbs[i] : 0) + (i < other.m_size ? other.m_limbs[i] : 0);
+                m_limbs[i] = uint32_t(carry);
+                carry >>= 32;
+            }
+            m_size = size;
+            if (carry) {
+                m_limbs[m_size++] = uint32_t(carry);
+            }
+        }
+
+        /// Divides by `divisor`, keeping the remainder. The quotient must fit a single digit.
+        uint32_t divide(const Bignum& divisor)
+        {
+            const auto n = divisor.m_size;
+            if (m_size < n) {
+                return 0;
+            }
+
+            // never overestimates, so the subtraction can't underflow
+            uint64_t top = m_limbs[n - 1];
+            if (m_size > n) {
+                top |= uint64_t(m_limbs[n]) << 32;
+            }
+            auto quot = uint32_t(top / (uint64_t(divisor.m_limbs[n - 1]) + 1));
+
+            if (quot) {
+                uint64_t carry = 0;
+                int64_t borrow = 0;
+                for (int32_t i = 0; i < m_size; ++i) {
+                    if (i < n) {
+                        carry += uint64_t(divisor.m_limbs[i]) * quot;
+                    }
+                    borrow += int64_t(m_limbs[i]) - int64_t(uint32_t(carry));
+                    carry >>= 32;
+                    m_limbs[i] = uint32_t(borrow);
+                    borrow >>= 32;
+                }
+                trim();
+            }
+
+            while (compare(*this, divisor) >= 0) {
+                subtract(divisor);
+                ++quot;
+            }
+
+            return quot;
+        }
+
+        static int compare(const Bignum& a, const Bignum& b)
+        {
+            if (a.m_size != b.m_size) {
+                return a.m_size < b.m_size ? -1 : 1;
+            }
+            for (auto i = a.m_size; i--;) {
+                if (a.m_limbs[i] != b.m_limbs[i]) {
+                    return a.m_limbs[i] < b.m_limbs[i] ? -1 : 1;
+                }
+            }
+            return 0;
+        }
+
+        /// Compares `a + b` with `c`.
+        static int compare_sum(const Bignum& a, const Bignum& b, const Bignum& c)
+        {
+            Bignum sum = a;
+            sum.add(b);
+            return compare(sum, c);
+        }
+
+    private:
+        void subtract(const Bignum& other)
+        {
+            int64_t borrow = 0;
+            for (int32_t i = 0; i < m_size; ++i) {
+                borrow += int64_t(m_limbs[i]) - (i < other.m_size ? int64_t(other.m_limbs[i]) : 0);
+                m_limbs[i] = uint32_t(borrow);
+                borrow >>= 32;
+            }
+            trim();
+        }
+
+        void trim()
+        {
+            while (m_size && !m_limbs[m_size - 1]) {
+                --m_size;
+            }
+        }
+
+        uint32_t m_limbs[40]; //< 1280 bits; doubles need up to ~1090
+        int32_t m_size = 0;
+    };
+
+    /// Sets up `value = r / s` scaled so that `r / s` is in [0.1, 1), and
+    /// returns the decimal exponent that was divided out.
+    inline int32_t scale_digits(const FloatParts& parts, Bignum* r, Bignum* s, Bignum* mplus, Bignum* mminus, bool inclusive)
+    {
+        auto k = estimate_log10(parts.mantissa, parts.exponent) + 1;
+
+        if (k >= 0) {
+            s->multiply_pow10(k);
+        } else {
+            r->multiply_pow10(-k);
+            if (mplus) {
+                mplus->multiply_pow10(-k);
+                mminus->multiply_pow10(-k);
+            }
+        }
+
+        // the estimate may be one too low
+        if (mplus ? Bignum::compare_sum(*r, *mplus, *s) >= (inclusive ? 0 : 1) : Bignum::compare(*r, *s) >= 0) {
+            s->multiply(10);
+            ++k;
+        }
+
+        return k;
+    }
+
+    /// Exact digits of `parts`, either `count` significant digits or, if
+    /// `fixed` is set, all digits down to `10^-count`. Rounds ties to even.
+    inline void exact_digits(const FloatParts& parts, bool fixed, int32_t count, FloatDigits* out)
+    {
+        Bignum r(parts.mantissa);
+        Bignum s(1);
+        r.shift_left(std::max(parts.exponent, 0));
+        s.shift_left(std::max(-parts.exponent, 0));
+
+        const auto k = scale_digits(parts, &r, &s, nullptr, nullptr, false);
+        const auto ndigits = fixed ? k + count : count;
+
+        out->count = 0;
+        out->exponent = 0;
+
+        if (ndigits < 0) {
+            return; // below half of the last digit
+        }
+
+        out->exponent = k - 1;
+
+        // generate digits, until we run out of requested or non-zero ones
+        auto n = std::min(ndigits, int32_t(sizeof(out->digits)));
+        int32_t i = 0;
+        for (; i < n && !r.is_zero(); ++i) {
+            r.multiply(10);
+            out->digits[i] = char('0' + r.divide(s));
+        }
+        out->count = i;
+
+        if (r.is_zero()) {
+            return;
+        }
+
+        // round the remainder
+        r.shift_left(1);
+        const auto cmp = Bignum::compare(r, s);
+        const bool odd = i ? ((out->digits[i - 1] - '0') & 1) : false;
+
+        if (cmp > 0 || (cmp == 0 && odd)) {
+            while (i > 0 && out->digits[i - 1] == '9') {
+                --i;
+            }
+            if (i) {
+                ++out->digits[i - 1];
+                out->count = i;
+            } else {
+                out->digits[0] = '1';
+                out->count = 1;
+                ++out->exponent;
+            }
+        } else if (!i) {
+            out->exponent = 0;
+        }
+    }
+
+    /// Digits of `value * 10^scale` rounded to an integer, when 64 bits suffice.
+    inline bool scaled_digits(const FloatParts& parts, int32_t scale, FloatDigits* out)
+    {
+        uint64_t value;
+        if (!round_scaled(parts, scale, &value)) {
+            return false;
+        }
+        set_float_digits(out, value, -scale);
+        return true;
+    }
+
+    /// Digits down to `10^-precision`.
+    inline void fixed_digits(double value, int32_t precision, FloatDigits* out)
+    {
+        const auto parts = float_parts(value);
+        if (!parts.mantissa) {
+            out->count = out->exponent = 0;
+        } else if (!scaled_digits(parts, precision, out)) {
+            exact_digits(parts, true, precision, out);
+        }
+    }
+
+    /// The first `count` significant digits.
+    inline void precision_digits(double value, int32_t count, FloatDigits* out)
+    {
+        const auto parts = float_parts(value);
+        if (!parts.mantissa) {
+            out->count = out->exponent = 0;
+            return;
+        }
+
+        if (count <= 19) {
+            const auto limit = pow10_u64(count);
+            auto exponent = estimate_log10(parts.mantissa, parts.exponent);
+            uint64_t scaled;
+            bool valid = round_scaled(parts, count - 1 - exponent, &scaled);
+
+            // the estimate may be one too low, and rounding may carry into a
+            // new digit; in both cases scale one step further down
+            while (valid && scaled >= limit) {
+                ++exponent;
+                valid = round_scaled(parts, count - 1 - exponent, &scaled);
+            }
+
+            if (valid) {
+                set_float_digits(out, scaled, exponent - count + 1);
+                return;
+            }
+        }
+
+        exact_digits(parts, false, count, out);
+    }
+
+    struct DiyFp {
+        uint64_t f;
+        int32_t e;
+    };
+
+    inline DiyFp normalize(DiyFp value)
+    {
+        while (!(value.f & (uint64_t(1) << 63))) {
+            value.f <<= 1;
+            --value.e;
+        }
+        return value;
+    }
+
+    /// Product of two normalized values, rounded to 64 bits.
+    inline DiyFp multiply(const DiyFp& a, const DiyFp& b)
+    {
+        const auto product = multiply_u64(a.f, b.f);
+        return { product.hi + (product.lo >> 63), a.e + b.e + 64 };
+    }
+
+    struct CachedPower {
+        uint64_t significand;
+        int16_t binaryExponent;
+        int16_t decimalExponent;
+    };
+
+    /// Returns the cached power of ten that scales a value with binary
+    /// exponent `exponent` into the [-60, -32] range Grisu works in.
+    inline const CachedPower& cached_power(int32_t exponent)
+    {
+        static const CachedPower powers[] = {
+            { 0xfa8fd5a0081c0288ull, -1220, -348 },
+            { 0xbaaee17fa23ebf76ull, -1193, -340 },
+            { 0x8b16fb203055ac76ull, -1166, -332 },
+            { 0xcf42894a5dce35eaull, -1140, -324 },
+            { 0x9a6bb0aa55653b2dull, -1113, -316 },
+            { 0xe61acf033d1a45dfull, -1087, -308 },
+            { 0xab70fe17c79ac6caull, -1060, -300 },
+            { 0xff77b1fcbebcdc4full, -1034, -292 },
+            { 0xbe5691ef416bd60cull, -1007, -284 },
+            { 0x8dd01fad907ffc3cull, -980, -276 },
+            { 0xd3515c2831559a83ull, -954, -268 },
+            { 0x9d71ac8fada6c9b5ull, -927, -260 },
+            { 0xea9c227723ee8bcbull, -901, -252 },
+            { 0xaecc49914078536dull, -874, -244 },
+            { 0x823c12795db6ce57ull, -847, -236 },
+            { 0xc21094364dfb5637ull, -821, -228 },
+            { 0x9096ea6f3848984full, -794, -220 },
+            { 0xd77485cb25823ac7ull, -768, -212 },
+            { 0xa086cfcd97bf97f4ull, -741, -204 },
+            { 0xef340a98172aace5ull, -715, -196 },
+            { 0xb23867fb2a35b28eull, -688, -188 },
+            { 0x84c8d4dfd2c63f3bull, -661, -180 },
+            { 0xc5dd44271ad3cdbaull, -635, -172 },
+            { 0x936b9fcebb25c996ull, -608, -164 },
+            { 0xdbac6c247d62a584ull, -582, -156 },
+            { 0xa3ab66580d5fdaf6ull, -555, -148 },
+            { 0xf3e2f893dec3f126ull, -529, -140 },
+            { 0xb5b5ada8aaff80b8ull, -502, -132 },
+            { 0x87625f056c7c4a8bull, -475, -124 },
+            { 0xc9bcff6034c13053ull, -449, -116 },
+            { 0x964e858c91ba2655ull, -422, -108 },
+            { 0xdff9772470297ebdull, -396, -100 },
+            { 0xa6dfbd9fb8e5b88full, -369, -92 },
+            { 0xf8a95fcf88747d94ull, -343, -84 },
+            { 0xb94470938fa89bcfull, -316, -76 },
+            { 0x8a08f0f8bf0f156bull, -289, -68 },
+            { 0xcdb02555653131b6ull, -263, -60 },
+            { 0x993fe2c6d07b7facull, -236, -52 },
+            { 0xe45c10c42a2b3b06ull, -210, -44 },
+            { 0xaa242499697392d3ull, -183, -36 },
+            { 0xfd87b5f28300ca0eull, -157, -28 },
+            { 0xbce5086492111aebull, -130, -20 },
+            { 0x8cbccc096f5088ccull, -103, -12 },
+            { 0xd1b71758e219652cull, -77, -4 },
+            { 0x9c40000000000000ull, -50, 4 },
+            { 0xe8d4a51000000000ull, -24, 12 },
+            { 0xad78ebc5ac620000ull, 3, 20 },
+            { 0x813f3978f8940984ull, 30, 28 },
+            { 0xc097ce7bc90715b3ull, 56, 36 },
+            { 0x8f7e32ce7bea5c70ull, 83, 44 },
+            { 0xd5d238a4abe98068ull, 109, 52 },
+            { 0x9f4f2726179a2245ull, 136, 60 },
+            { 0xed63a231d4c4fb27ull, 162, 68 },
+            { 0xb0de65388cc8ada8ull, 189, 76 },
+            { 0x83c7088e1aab65dbull, 216, 84 },
+            { 0xc45d1df942711d9aull, 242, 92 },
+            { 0x924d692ca61be758ull, 269, 100 },
+            { 0xda01ee641a708deaull, 295, 108 },
+            { 0xa26da3999aef774aull, 322, 116 },
+            { 0xf209787bb47d6b85ull, 348, 124 },
+            { 0xb454e4a179dd1877ull, 375, 132 },
+            { 0x865b86925b9bc5c2ull, 402, 140 },
+            { 0xc83553c5c8965d3dull, 428, 148 },
+            { 0x952ab45cfa97a0b3ull, 455, 156 },
+            { 0xde469fbd99a05fe3ull, 481, 164 },
+            { 0xa59bc234db398c25ull, 508, 172 },
+            { 0xf6c69a72a3989f5cull, 534, 180 },
+            { 0xb7dcbf5354e9beceull, 561, 188 },
+            { 0x88fcf317f22241e2ull, 588, 196 },
+            { 0xcc20ce9bd35c78a5ull, 614, 204 },
+            { 0x98165af37b2153dfull, 641, 212 },
+            { 0xe2a0b5dc971f303aull, 667, 220 },
+            { 0xa8d9d1535ce3b396ull, 694, 228 },
+            { 0xfb9b7cd9a4a7443cull, 720, 236 },
+            { 0xbb764c4ca7a44410ull, 747, 244 },
+            { 0x8bab8eefb6409c1aull, 774, 252 },
+            { 0xd01fef10a657842cull, 800, 260 },
+            { 0x9b10a4e5e9913129ull, 827, 268 },
+            { 0xe7109bfba19c0c9dull, 853, 276 },
+            { 0xac2820d9623bf429ull, 880, 284 },
+            { 0x80444b5e7aa7cf85ull, 907, 292 },
+            { 0xbf21e44003acdd2dull, 933, 300 },
+            { 0x8e679c2f5e44ff8full, 960, 308 },
+            { 0xd433179d9c8cb841ull, 986, 316 },
+            { 0x9e19db92b4e31ba9ull, 1013, 324 },
+            { 0xeb96bf6ebadf77d9ull, 1039, 332 },
+            { 0xaf87023b9bf0ee6bull, 1066, 340 },
+        };
+
+        const auto k = int32_t(std::ceil((-60 - (exponent + 64) + 63) * 0.30102999566398114));
+        return powers[(348 + k - 1) / 8 + 1];
+    }
+
+    /// Nudges the last generated digit closer to the real value, and checks
+    /// that the result is guaranteed to be the shortest, closest one.
+    inline bool round_weed(char* digits, int32_t length, uint64_t distanceTooHighW, uint64_t unsafeInterval, uint64_t rest, uint64_t tenKappa, uint64_t unit)
+    {
+        const auto smallDistance = distanceTooHighW - unit;
+        const auto bigDistance = distanceTooHighW + unit;
+
+        while (rest < smallDistance
+            && unsafeInterval - rest >= tenKappa
+            && (rest + tenKappa < smallDistance || smallDistance - rest >= rest + tenKappa - smallDistance)) {
+            --digits[length - 1];
+            rest += tenKappa;
+        }
+
+        if (rest < bigDistance
+            && unsafeInterval - rest >= tenKappa
+            && (rest + tenKappa < bigDistance || bigDistance - rest > rest + tenKappa - bigDistance)) {
+            return false;
+        }
+
+        return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+    }
+
+    /// Shortest digits using Grisu3 (Loitsch, "Printing Floating-Point Numbers
+    /// Quickly and Accurately with Integers"). Fails for ~0.5% of values,
+    /// which need the exact fallback.
+    inline bool grisu_digits(const FloatParts& parts, FloatDigits* out)
+    {
+        const auto w = normalize({ parts.mantissa, parts.exponent });
+        const auto plus = normalize({ (parts.mantissa << 1) + 1, parts.exponent - 1 });
+        auto minus = parts.lowerCloser
+            ? DiyFp { (parts.mantissa << 2) - 1, parts.exponent - 2 }
+            : DiyFp { (parts.mantissa << 1) - 1, parts.exponent - 1 };
+        minus.f <<= minus.e - plus.e;
+        minus.e = plus.e;
+
+        const auto& power = cached_power(w.e);
+        const DiyFp ten = { power.significand, power.binaryExponent };
+        const auto scaled = multiply(w, ten);
+        const auto tooLow = multiply(minus, ten).f - 1;
+        const auto tooHigh = multiply(plus, ten).f + 1;
+
+        const auto shift = -scaled.e;
+        const auto one = uint64_t(1) << shift;
+        const auto distance = tooHigh - scaled.f;
+        auto unsafeInterval = tooHigh - tooLow;
+        auto integrals = uint32_t(tooHigh >> shift);
+        auto fractionals = tooHigh & (one - 1);
+        uint64_t unit = 1;
+
+        int32_t kappa = 0;
+        uint32_t divisor = 1;
+        if (integrals) {
+            for (kappa = 1; integrals / divisor >= 10; ++kappa) {
+                divisor *= 10;
+            }
+        }
+
+        int32_t length = 0;
+        bool result;
+
+        for (;;) {
+            if (kappa > 0) {
+                out->digits[length++] = char('0' + integrals / divisor);
+                integrals %= divisor;
+                --kappa;
+
+                const auto rest = (uint64_t(integrals) << shift) + fractionals;
+                if (rest < unsafeInterval) {
+                    result = round_weed(out->digits, length, distance, unsafeInterval, rest, uint64_t(divisor) << shift, unit);
+                    break;
+                }
+                divisor /= 10;
+            } else {
+                fractionals *= 10;
+                unit *= 10;
+                unsafeInterval *= 10;
+
+                out->digits[length++] = char('0' + (fractionals >> shift));
+                fractionals &= one - 1;
+                --kappa;
+
+                if (fractionals < unsafeInterval) {
+                    result = round_weed(out->digits, length, distance * unit, unsafeInterval, fractionals, one, unit);
+                    break;
+                }
+            }
+        }
+
+        out->count = length;
+        out->exponent = kappa - power.decimalExponent + length - 1;
+        return result;
+    }
+
+    /// Shortest digits using exact arithmetic (Burger & Dybvig's free-format
+    /// algorithm), for the values Grisu3 can't decide.
+    inline void exact_shortest(const FloatParts& parts, FloatDigits* out)
+    {
+        const bool even = !(parts.mantissa & 1);
+        const int32_t closer = parts.lowerCloser ? 1 : 0;
+
+        // value = r / s, with the distances to the halfway points to the
+        // neighbouring values as mplus / s and mminus / s
+        Bignum r(parts.mantissa);
+        Bignum s(1);
+        Bignum mplus(1);
+        Bignum mminus(1);
+
+        if (parts.exponent >= 0) {
+            r.shift_left(parts.exponent + 1 + closer);
+            s.shift_left(1 + closer);
+            mplus.shift_left(parts.exponent + closer);
+            mminus.shift_left(parts.exponent);
+        } else {
+            r.shift_left(1 + closer);
+            s.shift_left(-parts.exponent + 1 + closer);
+            mplus.shift_left(closer);
+        }
+
+        const auto k = scale_digits(parts, &r, &s, &mplus, &mminus, even);
+
+        int32_t length = 0;
+        for (;;) {
+            r.multiply(10);
+            mplus.multiply(10);
+            mminus.multiply(10);
+
+            auto digit = r.divide(s);
+            const auto low = Bignum::compare(r, mminus);
+            const auto high = Bignum::compare_sum(r, mplus, s);
+            const bool lowDone = even ? low <= 0 : low < 0;
+            const bool highDone = even ? high >= 0 : high > 0;
+
+            if (lowDone && highDone) {
+                r.shift_left(1);
+                const auto cmp = Bignum::compare(r, s);
+                digit += (cmp > 0 || (cmp == 0 && (digit & 1))) ? 1 : 0;
+            } else if (highDone) {
+                ++digit;
+            }
+
+            out->digits[length++] = char('0' + digit);
+
+            if (lowDone || highDone) {
+                break;
+            }
+        }
+
+        out->count = length;
+        out->exponent = k - 1;
+    }
+
+    /// The shortest digits that read back as `value`, closest to it if there
+    /// are several.
+    template <class F>
+    void shortest_digits(F value, FloatDigits* out)
+    {
+        const auto parts = float_parts(value);
+        if (!parts.mantissa) {
+            out->count = out->exponent = 0;
+        } else if (!grisu_digits(parts, out)) {
+            exact_shortest(parts, out);
+        }
+    }
+
+    /// Writes `digits` in fixed or scientific notation, with `decimals`
+    /// digits after the decimal point. Returns the length; with a null
+    /// writer, only measures it.
+    inline int32_t write_float_digits(BufferedWriter* writer, const FloatDigits& digits, bool scientific, int32_t decimals, bool upper)
+    {
+        int32_t length = 0;
+
+        const auto put = [&](const char* str, int32_t count) {
+            if (count > 0) {
+                if (writer) {
+                    writer->write(size_t(count), str);
+                }
+                length += count;
+            }
+        };
+
+        const auto zeros = [&](int32_t count) {
+            if (count > 0) {
+                if (writer) {
+                    writer->fill(size_t(count), '0');
+                }
+                length += count;
+            }
+        };
+
+        const auto count = digits.count;
+        const auto exponent = digits.exponent;
+
+        if (scientific) {
+            put(count ? digits.digits : "0", 1);
+
+            if (decimals > 0) {
+                const auto n = std::max(std::min(count - 1, decimals), 0);
+                put(".", 1);
+                put(digits.digits + 1, n);
+                zeros(decimals - n);
+            }
+
+            // at least two exponent digits, like printf
+            char buffer[5];
+            char* end = buffer + sizeof(buffer);
+            char* start = end;
+            auto value = exponent < 0 ? -exponent : exponent;
+            do {
+                *(--start) = char('0' + value % 10);
+                value /= 10;
+            } while (value);
+            if (end - start < 2) {
+                *(--start) = '0';
+            }
+            *(--start) = exponent < 0 ? '-' : '+';
+            *(--start) = upper ? 'E' : 'e';
+            put(start, int32_t(end - start));
+        } else if (exponent >= 0) {
+            const auto n = std::min(count, exponent + 1);
+            put(digits.digits, n);
+            zeros(exponent + 1 - n);
+
+            if (decimals > 0) {
+                const auto f = std::min(std::max(count - exponent - 1, 0), decimals);
+                put(".", 1);
+                put(digits.digits + n, f);
+                zeros(decimals - f);
+            }
+        } else {
+            put("0", 1);
+
+            if (decimals > 0) {
+                const auto lead = std::min(-exponent - 1, decimals);
+                const auto f = std::min(count, decimals - lead);
+                put(".", 1);
+                zeros(lead);
+                put(digits.digits, f);
+                zeros(decimals - lead - f);
+            }
+        }
+
+        return length;
+    }
+
+    /// Formats `value` without the C runtime; it reads neither the locale
+    /// nor any other global state, and allocates nothing, so threads never
+    /// contend on it.
+    template <class F>
+    bool format_float(BufferedWriter& writer, const FormatFlags& flags, F value)
+    {
+        const bool upper = flags.type >= 'A' && flags.type <= 'Z';
+        const bool percent = flags.type == '%';
+
+        if (percent) {
+            value *= 100;
+        }
+
+        // produce the digits
+        const bool special = std::isnan(value) || std::isinf(value);
+        const F magnitude = value < 0 ? -value : value;
+        FloatDigits digits;
+        bool scientific = false;
+        int32_t decimals = 0;
+        int32_t precision = -1;
+
+        switch (flags.type) {
+        case 'f':
+        case 'F':
+        case '%':
+            decimals = flags.precision >= 0 ? flags.precision : 6;
+            if (!special) {
+                fixed_digits(magnitude, decimals, &digits);
+            }
+            break;
+        case 'e':
+        case 'E':
+            decimals = flags.precision >= 0 ? flags.precision : 6;
+            scientific = true;
+            if (!special) {
+                precision_digits(magnitude, decimals + 1, &digits);
+            }
+            break;
+        case 'g':
+        case 'G':
+            precision = (flags.precision != 0)
+                ? (flags.precision > 0 ? flags.precision : 6)
+                : 1;
+            break;
+        default:
+            // without a precision, the shortest digits that round-trip
+            precision = flags.precision >= 0 ? std::max(flags.precision, 1) : 0;
+            break;
+        }
+
+        if (precision >= 0 && !special) {
+            // general format; switch to scientific for large and small exponents
+            int32_t limit = precision;
+
+            if (precision) {
+                precision_digits(magnitude, precision, &digits);
+            } else {
+                shortest_digits(magnitude, &digits);
+                limit = std::numeric_limits<F>::digits10;
+            }
+
+            while (digits.count && digits.digits[digits.count - 1] == '0') {
+                --digits.count;
+            }
+
+            scientific = digits.exponent < -4 || digits.exponent >= limit;
+            decimals = std::max(scientific ? digits.count - 1 : digits.count - 1 - digits.exponent, 0);
+        }
+
+        int32_t ndigits = 3;
+        if (!special) {
+            ndigits = write_float_digits(nullptr, digits, scientific, decimals, upper) + (percent ? 1 : 0);
+        }
+
+        // determine sign
+        char sign = 0;
+
+        if (value < 0) {
+            sign = '-';
+        } else if (flags.sign == '+' || flags.sign == ' ') {
+            sign = flags.sign;
+        }
+
+        // determine width
+        const int nchars = sign ? ndigits + 1 : ndigits;
+        const int32_t width = std::max(flags.width, nchars);
+
+        if (writer.counting()) {
+            writer.skip(size_t(width));
+            return true;
+        }
+
+        // determine alignment
+        int32_t leadSpace = 0;
+        int32_t tailSpace = 0;
+
+        switch (flags.align) {
+        case '^':
+            leadSpace = (width / 2) - ((nchars + 1) / 2); // nchars rounded up
+            tailSpace = ((width + 1) / 2) - (nchars / 2); // width rounded up
+            leadSpace += (width & 1) & (nchars & 1); // if both are odd, we need to add one for correction
+            tailSpace -= (width & 1) & (nchars & 1); // if both are odd, we need to remove one for correction
+            break;
+        case '<':
+            tailSpace = width - nchars;
+            break;
+        case '>':
+        default:
+            leadSpace = width - nchars;
+            break;
+        }
+
+        // print sign, if it should be before the padding
+        if (sign && flags.align == '=') {
+            writer.write(1, &sign);
+        }
+
+        // apply leading padding
+        const char fill = flags.fill ? flags.fill : ' ';
+
+        if (leadSpace > 0) {
+            writer.fill(size_t(leadSpace), fill);
+        }
+
+        // print sign, if it should be after the padding
+        if (sign && flags.align != '=') {
+            writer.write(1, &sign);
+        }
+
+        // write the number
+        if (std::isnan(value)) {
+            writer.write(3, upper ? "NAN" : "nan");
+        } else if (special) {
+            writer.write(3, upper ? "INF" : "inf");
+        } else {
+            write_float_digits(&writer, digits, scientific, decimals, upper);
+            if (percent) {
+                writer.write(1, "%");
+            }
+        }
+
+        // apply tailing padding
+        if (tailSpace > 0) {
+            writer.fill(size_t(tailSpace), fill);
+        }
+
+        return true;
+    }
+
+#if defined(SP_ENABLE_UTF8)
+    inline int32_t count_ones(uint64_t value)
+    {
+    #if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(value);
+    #else
+        int32_t ones = 0;
+        for (; value; value &= value - 1) {
+            ++ones;
+        }
+        return ones;
+    #endif
+    }
+
+    /// Return the amount of code points in the UTF-8 text at `ptr`, i.e. the
+    /// amount of bytes that don't continue a sequence (`10xxxxxx`).
+    inline ptrdiff_t count_code_points(const char* ptr, ptrdiff_t length)
+    {
+        const auto term = ptr + length;
+        ptrdiff_t continuations = 0;
+
+    #if defined(SP_SIMD_AVX2)
+        // continuation bytes are 0x80-0xbf, the signed bytes below -64
+        const auto lead32 = _mm256_set1_epi8(-64);
+
+        while (term - ptr >= 32) {
+            const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+            const auto mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpgt_epi8(lead32, chunk)));
+            continuations += count_ones(mask);
+            ptr += 32;
+        }
+    #endif
+
+    #if defined(SP_SIMD_SSE2)
+        const auto lead = _mm_set1_epi8(-64);
+
+        while (term - ptr >= 16) {
+            const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+            const auto mask = uint32_t(_mm_movemask_epi8(_mm_cmplt_epi8(chunk, lead)));
+            continuations += count_ones(mask);
+            ptr += 16;
+        }
+    #elif defined(SP_SIMD_NEON)
+        const auto lead = vdupq_n_s8(-64);
+
+        while (term - ptr >= 16) {
+            const auto chunk = vld1q_s8(reinterpret_cast<const int8_t*>(ptr));
+            const auto ones = vshrq_n_u8(vcltq_s8(chunk, lead), 7);
+            const auto sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(ones)));
+            continuations += ptrdiff_t(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+            ptr += 16;
+        }
+    #else
+        // eight bytes at a time; the high bit of each byte that has it set,
+        // without the bit below it
+        while (term - ptr >= 8) {
+            uint64_t word;
+            std::memcpy(&word, ptr, sizeof(word));
+            continuations += count_ones(word & ~(word << 1) & 0x8080808080808080ull);
+            ptr += 8;
+        }
+    #endif
+
+        for (; ptr < term; ++ptr) {
+            continuations += (uint8_t(*ptr) & 0xc0) == 0x80 ? 1 : 0;
+        }
+
+        return length - continuations;
+    }
+
+    /// Return the length in bytes of the first `count` code points of the
+    /// UTF-8 text at `ptr`.
+    inline ptrdiff_t code_point_bytes(const char* ptr, ptrdiff_t length, ptrdiff_t count)
+    {
+        enum { BLOCK_SIZE = 64 };
+
+        // skip blocks with no more code points than remain
+        ptrdiff_t offset = 0;
+        while (length - offset >= BLOCK_SIZE) {
+            const auto points = count_code_points(ptr + offset, BLOCK_SIZE);
+            if (points > count) {
+                break;
+            }
+            count -= points;
+            offset += BLOCK_SIZE;
+        }
+
+        for (; offset < length; ++offset) {
+            if ((uint8_t(ptr[offset]) & 0xc0) != 0x80 && !count--) {
+                break;
+            }
+        }
+
+        return offset;
+    }
+#endif
+
+    /// Whether `ch` has to be escaped in a string of presentation type
+    /// `type`; `j` for JSON, or `q` for CSV.
+    inline bool needs_escape(char ch, char type)
+    {
+        return ch == '"' || (type == 'j' && (ch == '\\' || uint8_t(ch) < 0x20));
+    }
+
+    /// Return the first character in `[next, term)` that has to be escaped
+    /// in a string of presentation type `type`, or `term` if there is none.
+    inline const char* find_escape(const char* next, const char* term, char type)
+    {
+        const bool json = type == 'j';
+
+    #if defined(SP_SIMD_AVX2)
+        const auto quote32 = _mm256_set1_epi8('"');
+        const auto backslash32 = _mm256_set1_epi8('\\');
+        const auto control32 = _mm256_set1_epi8(0x1f);
+        const auto zero32 = _mm256_setzero_si256();
+
+        while (term - next >= 32) {
+            const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next));
+            auto special = _mm256_cmpeq_epi8(chunk, quote32);
+
+            if (json) {
+                const auto controls = _mm256_cmpeq_epi8(_mm256_subs_epu8(chunk, control32), zero32);
+                special = _mm256_or_si256(special, _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash32), controls));
+            }
+
+            const auto mask = uint32_t(_mm256_movemask_epi8(special));
+            if (mask) {
+                return next + trailing_zeros(mask);
+            }
+            next += 32;
+        }
+    #endif
+
+    #if defined(SP_SIMD_SSE2)
+        const auto quote = _mm_set1_epi8('"');
+        const auto backslash = _mm_set1_epi8('\\');
+        const auto control = _mm_set1_epi8(0x1f);
+        const auto zero = _mm_setzero_si128();
+
+        while (term - next >= 16) {
+            const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(next));
+            auto special = _mm_cmpeq_epi8(chunk, quote);
+
+            if (json) {
+                // bytes up to 0x1f saturate to zero
+                const auto controls = _mm_cmpeq_epi8(_mm_subs_epu8(chunk, control), zero);
+                special = _mm_or_si128(special, _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), controls));
+            }
+
+            const auto mask = uint32_t(_mm_movemask_epi8(special));
+            if (mask) {
+                return next + trailing_zeros(mask);
+            }
+            next += 16;
+        }
+    #elif defined(SP_SIMD_NEON)
+        const auto quote = vdupq_n_u8('"');
+        const auto backslash = vdupq_n_u8('\\');
+        const auto control = vdupq_n_u8(0x20);
+
+        while (term - next >= 16) {
+            const auto chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(next));
+            auto special = vceqq_u8(chunk, quote);
+
+            if (json) {
+                special = vorrq_u8(special, vorrq_u8(vceqq_u8(chunk, backslash), vcltq_u8(chunk, control)));
+            }
+
+            // narrow each byte of the comparison to 4 bits
+            const auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(special), 4);
+            const auto mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+
+            if (mask) {
+                return next + trailing_zeros(mask) / 4;
+            }
+            next += 16;
+        }
+    #else
+        // eight bytes at a time, leaving the exact position to the loop below
+        const uint64_t ones = 0x0101010101010101ull;
+        const uint64_t highs = 0x8080808080808080ull;
+
+        while (term - next >= 8) {
+            uint64_t word;
+            std::memcpy(&word, next, sizeof(word));
+
+            const auto quote = word ^ (ones * '"');
+            auto special = (quote - ones) & ~quote;
+
+            if (json) {
+                const auto backslash = word ^ (ones * '\\');
+                special |= ((backslash - ones) & ~backslash) | ((word - ones * 0x20) & ~word);
+            }
+
+            if (special & highs) {
+                break;
+            }
+            next += 8;
+        }
+    #endif
+
+        while (next < term && !needs_escape(*next, type)) {
+            ++next;
+        }
+
+        return next;
+    }
+
+    /// Writes `str` quoted and escaped for presentation type `type`; `j` for
+    /// a JSON string, or `q` for a CSV field. Clean runs are written whole.
+    /// Returns the length; with a null writer, only measures it.
+    inline ptrdiff_t write_escaped(BufferedWriter* writer, const StringView& str, char type)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        ptrdiff_t length = 2;
+        auto next = str.ptr;
+        const auto term = str.ptr + str.length;
+
+        if (writer) {
+            writer->write(1, "\"");
+        }
+
+        while (next < term) {
+            const auto special = find_escape(next, term, type);
+
+            if (special != next) {
+                if (writer) {
+                    writer->reference(size_t(special - next), next);
+                }
+                length += special - next;
+            }
+
+            if (special == term) {
+                break;
+            }
+
+            char escape[6] = { '\\', *special };
+            size_t count = 2;
+
+            if (type == 'q') {
+                escape[0] = '"';
+            } else {
+                switch (*special) {
+                case '\b':
+                    escape[1] = 'b';
+                    break;
+                case '\f':
+                    escape[1] = 'f';
+                    break;
+                case '\n':
+                    escape[1] = 'n';
+                    break;
+                case '\r':
+                    escape[1] = 'r';
+                    break;
+                case '\t':
+                    escape[1] = 't';
+                    break;
+                case '"':
+                case '\\':
+                    break;
+                default:
+                    escape[1] = 'u';
+                    escape[2] = '0';
+                    escape[3] = '0';
+                    escape[4] = hex[uint8_t(*special) >> 4];
+                    escape[5] = hex[*special & 0xf];
+                    count = 6;
+                    break;
+                }
+            }
+
+            if (writer) {
+                writer->write(count, escape);
+            }
+            length += ptrdiff_t(count);
+            next = special + 1;
+        }
+
+        if (writer) {
+            writer->write(1, "\"");
+        }
+
+        return length;
+    }
+
+    inline bool format_string(BufferedWriter& writer, const sp::FormatFlags& flags, const StringView& str)
+    {
+        // determine the amount of bytes to write; with UTF-8, the precision
+        // is in code points
+        auto nbytes = str.length;
+
+        if (flags.precision >= 0) {
+#if defined(SP_ENABLE_UTF8)
+            nbytes = code_point_bytes(str.ptr, str.length, flags.precision);
+#else
+            nbytes = std::min(ptrdiff_t(flags.precision), nbytes);
+#endif
+        }
+
+        // escaped strings only need measuring when they may be padded, as
+        // they are at least two quotes longer
+        const StringView text(str.ptr, nbytes);
+        const bool escaped = flags.type == 'j' || flags.type == 'q';
+
+        if (escaped && (flags.width > nbytes + 2 || writer.counting())) {
+            nbytes = write_escaped(nullptr, text, flags.type);
+        } else if (escaped) {
+            nbytes += 2;
+        }
+
+        // determine the padding; with UTF-8, the width is in code points,
+        // and escapes are all single-byte
+        ptrdiff_t padding = 0;
+
+        if (flags.width > 0) {
+            auto nchars = nbytes;
+#if defined(SP_ENABLE_UTF8)
+            nchars -= text.length - count_code_points(text.ptr, text.length);
+#endif
+            padding = std::max(ptrdiff_t(flags.width) - nchars, ptrdiff_t(0));
+        }
+
+        if (writer.counting()) {
+            writer.skip(size_t(nbytes + padding));
+            return true;
+        }
+
+        // determine alignment
+        ptrdiff_t leadSpace = 0;
+        ptrdiff_t tailSpace = 0;
+
+        switch (flags.align) {
+        case '^':
+            leadSpace = padding / 2;
+            tailSpace = padding - leadSpace;
+            break;
+        case '>':
+            leadSpace = padding;
+            break;
+        case '<':
+        default:
+            tailSpace = padding;
+            break;
+        }
+
+        // apply leading padding
+        const char fill = flags.fill ? flags.fill : ' ';
+
+        if (leadSpace > 0) {
+            writer.fill(size_t(leadSpace), fill);
+        }
+
+        // write string
+        if (escaped) {
+            write_escaped(&writer, text, flags.type);
+        } else {
+            writer.reference(size_t(nbytes), str.ptr);
+        }
+
+        // apply tailing padding
+        if (tailSpace > 0) {
+            writer.fill(size_t(tailSpace), fill);
+        }
+
+        return true;
+    }
+
+    inline bool format_int(BufferedWriter& writer, const FormatFlags& flags, long long value)
+    {
+        static_assert(sizeof(value) == sizeof(uint64_t), "invalid cast on negation");
+
+        const auto abs = (value >= 0 || value == std::numeric_limits<long long>::min())
+            ? uint64_t(value)
+            : uint64_t(-value);
+
+        return format_int(writer, flags, value < 0, abs);
+    }
+
+    inline bool format_bool(BufferedWriter& writer, const FormatFlags& flags, bool value)
+    {
+        switch (flags.type) {
+            case 'b':
+            case 'c':
+            case 'd':
+            case 'o':
+            case 'x':
+            case 'X':
+                return format_int(writer, flags, false, (uint64_t)value);
+            case 'j': {
+                // JSON booleans are unquoted
+                auto plainFlags = flags;
+                plainFlags.type = 0;
+                return format_string(writer, plainFlags, value ? "true" : "false");
+            }
+            default:
+                return format_string(writer, flags, value ? "true" : "false");
+        }
+    }
+
+    inline bool format_char(BufferedWriter& writer, const FormatFlags& flags, char32_t value)
+    {
+        auto charFlags = flags;
+
+        if (!charFlags.type) {
+            charFlags.type = 'c';
+        }
+
+        if (!charFlags.align) {
+            charFlags.align = '<';
+        }
+
+        return format_int(writer, charFlags, false, uint64_t(value));
+    }
+
+    SP_INLINE bool format_pointer(BufferedWriter& writer, const FormatFlags& flags, const void* value)
+    {
+        auto pointerFlags = flags;
+
+        if (!pointerFlags.type) {
+            pointerFlags.type = 'x';
+        }
+
+        return format_int(writer, pointerFlags, false, uint64_t(value));
+    }
+
+#if defined(SP_ENABLE_CHRONO)
+    enum {
+        TIME_PATTERN_SIZE = 64, //< Longest time specifier.
+        TIME_TEXT_SIZE = 128, //< Longest formatted time.
+        TIME_FRACTIONS = 4, //< Most `%f` in a time specifier.
+        TIME_CACHE_SIZE = 4, //< Time specifiers cached per thread.
+    };
+
+    /// Output of a time specifier for a second, with the microseconds left
+    /// out.
+    struct TimeText {
+        char pattern[TIME_PATTERN_SIZE];
+        ptrdiff_t patternLength = -1;
+        long long second = 0;
+        char text[TIME_TEXT_SIZE];
+        int32_t length = 0;
+        int32_t fractions[TIME_FRACTIONS]; //< offsets of the microseconds
+        int32_t fractionCount = 0;
+    };
+
+    inline void write_fixed(char* out, uint32_t value, int32_t digits)
+    {
+        while (digits--) {
+            out[digits] = char('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    /// Render `pattern` for the second `second` since the epoch into `time`.
+    /// Return `false` if the pattern is invalid, or its output too long.
+    inline bool render_time(TimeText* time, const StringView& pattern, long long second)
+    {
+        // civil date of the day, after Howard Hinnant's `civil_from_days`
+        const auto days = second / 86400 - (second % 86400 < 0 ? 1 : 0);
+        const auto seconds = uint32_t(second - days * 86400);
+        const auto shifted = days + 719468;
+        const auto era = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+        const auto dayOfEra = uint32_t(shifted - era * 146097);
+        const auto yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        const auto dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        const auto monthIndex = (5 * dayOfYear + 2) / 153;
+        const auto day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+        const auto month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+        const auto year = (long long)yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+        char* out = time->text;
+        const auto term = time->text + TIME_TEXT_SIZE;
+        time->fractionCount = 0;
+
+        for (ptrdiff_t i = 0; i < pattern.length; ++i) {
+            // room for the longest directive
+            if (term - out < 24) {
+                return false;
+            }
+
+            if (pattern.ptr[i] != '%') {
+                *out++ = pattern.ptr[i];
+                continue;
+            }
+            if (++i == pattern.length) {
+                return false;
+            }
+
+            switch (pattern.ptr[i]) {
+            case 'Y':
+            case 'F':
+                if (year >= 0 && year <= 9999) {
+                    write_fixed(out, uint32_t(year), 4);
+                    out += 4;
+                } else {
+                    char digits[24];
+                    const auto end = digits + sizeof(digits);
+                    auto start = write_decimal(end, uint64_t(year < 0 ? -year : year));
+                    if (year < 0) {
+                        *(--start) = '-';
+                    }
+                    std::memcpy(out, start, size_t(end - start));
+                    out += end - start;
+                }
+                if (pattern.ptr[i] == 'F') {
+                    out[0] = '-';
+                    write_fixed(out + 1, month, 2);
+                    out[3] = '-';
+                    write_fixed(out + 4, day, 2);
+                    out += 6;
+                }
+                break;
+            case 'm':
+                write_fixed(out, month, 2);
+                out += 2;
+                break;
+            case 'd':
+                write_fixed(out, day, 2);
+                out += 2;
+                break;
+            case 'H':
+                write_fixed(out, seconds / 3600, 2);
+                out += 2;
+                break;
+            case 'M':
+                write_fixed(out, seconds / 60 % 60, 2);
+                out += 2;
+                break;
+            case 'S':
+                write_fixed(out, seconds % 60, 2);
+                out += 2;
+                break;
+            case 'T':
+                write_fixed(out, seconds / 3600, 2);
+                out[2] = ':';
+                write_fixed(out + 3, seconds / 60 % 60, 2);
+                out[5] = ':';
+                write_fixed(out + 6, seconds % 60, 2);
+                out += 8;
+                break;
+            case 'f':
+                if (time->fractionCount == TIME_FRACTIONS) {
+                    return false;
+                }
+                time->fractions[time->fractionCount++] = int32_t(out - time->text);
+                out += 6;
+                break;
+            case '%':
+                *out++ = '%';
+                break;
+            default:
+                return false;
+            }
+        }
+
+        time->length = int32_t(out - time->text);
+        return true;
+    }
+
+    SP_INLINE bool format_time(IWriter& writer, const StringView& spec, long long micros)
+    {
+        static thread_local TimeText cache[TIME_CACHE_SIZE];
+        static thread_local uint32_t replaced = 0;
+
+        const auto pattern = spec.length ? spec : StringView("%Y-%m-%d %H:%M:%S", 17);
+        const auto second = micros / 1000000 - (micros % 1000000 < 0 ? 1 : 0);
+        const auto fraction = uint32_t(micros - second * 1000000);
+
+        if (pattern.length > TIME_PATTERN_SIZE) {
+            return false;
+        }
+
+        TimeText* time = nullptr;
+        for (auto& entry : cache) {
+            if (entry.patternLength == pattern.length && std::memcmp(entry.pattern, pattern.ptr, size_t(pattern.length)) == 0) {
+                time = &entry;
+                break;
+            }
+        }
+
+        // render everything but the microseconds once per second
+        if (!time || time->second != second) {
+            if (!time) {
+                time = &cache[replaced++ % TIME_CACHE_SIZE];
+                std::memcpy(time->pattern, pattern.ptr, size_t(pattern.length));
+            }
+
+            time->patternLength = -1;
+            if (!render_time(time, pattern, second)) {
+                return false;
+            }
+            time->patternLength = pattern.length;
+            time->second = second;
+        }
+
+        char text[TIME_TEXT_SIZE];
+        std::memcpy(text, time->text, size_t(time->length));
+        for (int32_t i = 0; i < time->fractionCount; ++i) {
+            write_fixed(text + time->fractions[i], fraction, 6);
+        }
+
+        writer.write(size_t(time->length), text);
+        return true;
+    }
+#endif
+#else
+    bool format_pointer(BufferedWriter& writer, const FormatFlags& flags, const void* value);
+#if defined(SP_ENABLE_CHRONO)
+    bool format_time(IWriter& writer, const StringView& spec, long long micros);
+#endif
+#endif
+
+    template <size_t S> struct WcharSelector;
+    template<> struct WcharSelector<2> { using Type = char16_t; };
+    template<> struct WcharSelector<4> { using Type = char32_t; };
+
+    struct DummyArg {
+    };
+
+    inline bool format_value(IWriter&, const StringView&, const DummyArg&)
+    {
+        return false;
+    }
+
+    /// Whether `T` may be formatted from already parsed `FormatFlags`, rather
+    /// than from the raw format specifier.
+    template <class T>
+    struct AcceptsFormatFlags {
+        template <class U>
+        static auto test(int) -> decltype(format_value(std::declval<IWriter&>(), std::declval<const FormatFlags&>(), std::declval<U>()), std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Whether `T` has a `Formatter` specialization.
+    template <class T>
+    struct HasFormatter {
+        template <class U>
+        static auto test(int) -> decltype(Formatter<U>::parse(std::declval<const StringView&>(), std::declval<typename Formatter<U>::State*>()), std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Whether `T` may be formatted from the raw format specifier.
+    template <class T>
+    struct HasFormatValue {
+        template <class U>
+        static auto test(int) -> decltype(format_value(std::declval<IWriter&>(), std::declval<const StringView&>(), std::declval<U>()), std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Whether `T` can be iterated with `std::begin` and `std::end`, over
+    /// elements other than `char`.
+    template <class T>
+    struct IsRange {
+        template <class U, class E = typename std::decay<decltype(*std::begin(std::declval<const U&>()))>::type>
+        static auto test(int) -> decltype(std::begin(std::declval<const U&>()) != std::end(std::declval<const U&>()), std::integral_constant<bool, !std::is_same<E, char>::value>());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Whether `T` is a range of key-value pairs, such as `std::map`.
+    template <class T>
+    struct IsMap {
+        template <class U>
+        static auto test(int) -> decltype(std::declval<typename U::key_type>(), std::declval<typename U::mapped_type>(), std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Whether `T` supports `std::tuple_size`, such as `std::pair`.
+    template <class T>
+    struct IsTuple {
+        template <class U>
+        static auto test(int) -> decltype(std::tuple_size<U>::value, std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    /// Per-thread cache of the states parsed by `Formatter<T>`, mapped by
+    /// format specifier. Specifiers longer than `MAX_SPEC` are not cached.
+    template <class T>
+    class FormatterCache {
+    public:
+        using State = typename Formatter<T>::State;
+
+        /// Return the cache of the calling thread.
+        static FormatterCache& get();
+
+        /// Return the state parsed from `spec` in `state`, parsing it only if
+        /// it is not already cached. Return `false` if `spec` is invalid.
+        bool parse(const StringView& spec, State* state);
+
+    private:
+        enum {
+            ENTRY_COUNT = 16,
+            MAX_SPEC = 32,
+        };
+
+        struct Entry {
+            State state;
+            ptrdiff_t length = -1;
+            char spec[MAX_SPEC];
+        };
+
+        Entry m_entries[ENTRY_COUNT];
+    };
+
+    template <class T>
+    FormatterCache<T>& FormatterCache<T>::get()
+    {
+        static thread_local FormatterCache cache;
+        return cache;
+    }
+
+    template <class T>
+    bool FormatterCache<T>::parse(const StringView& spec, State* state)
+    {
+        uint32_t hash = 2166136261u;
+        for (ptrdiff_t i = 0; i < spec.length; ++i) {
+            hash = (hash ^ uint8_t(spec.ptr[i])) * 16777619u;
+        }
+
+        // the state is copied out rather than referenced, as formatting may
+        // recurse into the same cache and evict the entry
+        auto& entry = m_entries[hash % ENTRY_COUNT];
+        if (entry.length == spec.length && (!spec.length || std::memcmp(entry.spec, spec.ptr, size_t(spec.length)) == 0)) {
+            *state = entry.state;
+            return true;
+        }
+
+        if (!Formatter<T>::parse(spec, state)) {
+            return false;
+        }
+
+        if (spec.length <= MAX_SPEC) {
+            entry.state = *state;
+            entry.length = spec.length;
+            if (spec.length) {
+                std::memcpy(entry.spec, spec.ptr, size_t(spec.length));
+            }
+        }
+
+        return true;
+    }
+
+    struct FormatterTag {
+    };
+
+    struct RangeTag {
+    };
+
+    struct TupleTag {
+    };
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags*, const T& value, FormatterTag)
+    {
+        typename Formatter<T>::State state;
+        return FormatterCache<T>::get().parse(spec, &state)
+            && Formatter<T>::format(writer, state, value);
+    }
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const T& value, std::true_type)
+    {
+        FormatFlags parsed;
+
+        if (!flags) {
+            if (!parse_format(spec, &parsed)) {
+                return false;
+            }
+            flags = &parsed;
+        }
+
+        return format_value(writer, *flags, value);
+    }
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags*, const T& value, std::false_type)
+    {
+        return format_value(writer, spec, value);
+    }
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const void* value)
+    {
+        using Accepts = std::integral_constant<bool, AcceptsFormatFlags<const T&>::value>;
+        using Fallback = typename std::conditional<!Accepts::value && !HasFormatValue<const T&>::value && IsRange<T>::value, RangeTag,
+            typename std::conditional<!Accepts::value && !HasFormatValue<const T&>::value && IsTuple<T>::value, TupleTag, Accepts>::type>::type;
+        using Tag = typename std::conditional<HasFormatter<T>::value, FormatterTag, Fallback>::type;
+        return format_custom(writer, spec, flags, *static_cast<const T*>(value), Tag());
+    }
+
+    inline FormatArg make_format_arg(std::nullptr_t)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_POINTER;
+        arg.value.p = nullptr;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(bool value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_BOOL;
+        arg.value.b = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(float value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_FLOAT;
+        arg.value.f = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(double value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_DOUBLE;
+        arg.value.d = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(char32_t value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_CHAR;
+        arg.value.c = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(char value)
+    {
+        return make_format_arg(char32_t(value));
+    }
+
+    inline FormatArg make_format_arg(char16_t value)
+    {
+        return make_format_arg(char32_t(value));
+    }
+
+    inline FormatArg make_format_arg(wchar_t value)
+    {
+        using CharType = typename WcharSelector<sizeof(wchar_t)>::Type;
+        return make_format_arg(char32_t(CharType(value)));
+    }
+
+    inline FormatArg make_format_arg(long long value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_INT;
+        arg.value.i = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(unsigned long long value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_UINT;
+        arg.value.u = value;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(signed char value)
+    {
+        return make_format_arg((long long)value);
+    }
+
+    inline FormatArg make_format_arg(unsigned char value)
+    {
+        return make_format_arg((unsigned long long)value);
+    }
+
+    inline FormatArg make_format_arg(short value)
+    {
+        return make_format_arg((long long)value);
+    }
+
+    inline FormatArg make_format_arg(unsigned short value)
+    {
+        return make_format_arg((unsigned long long)value);
+    }
+
+    inline FormatArg make_format_arg(int value)
+    {
+        return make_format_arg((long long)value);
+    }
+
+    inline FormatArg make_format_arg(unsigned value)
+    {
+        return make_format_arg((unsigned long long)value);
+    }
+
+    inline FormatArg make_format_arg(long value)
+    {
+        return make_format_arg((long long)value);
+    }
+
+    inline FormatArg make_format_arg(unsigned long value)
+    {
+        return make_format_arg((unsigned long long)value);
+    }
+
+    inline FormatArg make_format_arg(const StringView& value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_STRING;
+        arg.value.string.ptr = value.ptr;
+        arg.value.string.length = value.length;
+        return arg;
+    }
+
+    inline FormatArg make_format_arg(const StaticString& value)
+    {
+        return make_format_arg(value.str);
+    }
+
+    inline FormatArg make_format_arg(char value[])
+    {
+        return make_format_arg(StringView(value));
+    }
+
+    inline FormatArg make_format_arg(const char value[])
+    {
+        return make_format_arg(StringView(value));
+    }
+
+    template <class T>
+    FormatArg make_format_arg(T* value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_POINTER;
+        arg.value.p = value;
+        return arg;
+    }
+
+    template <class T>
+    FormatArg make_format_arg(const T& value)
+    {
+        FormatArg arg;
+        arg.type = FormatArg::TYPE_CUSTOM;
+        arg.value.custom.value = &value;
+        arg.value.custom.format = &format_custom<T>;
+        return arg;
+    }
+
+    template <class... Args>
+    FormatArgStore<sizeof...(Args)> make_format_args(Args&&... args)
+    {
+        return FormatArgStore<sizeof...(Args)>{ { make_format_arg(args)... } };
+    }
+
+    /// Parse the specifier of a range or tuple; an optional `n` to leave out
+    /// the brackets, followed by `:` and the specifier of the elements.
+    inline bool parse_range_spec(const StringView& spec, bool* brackets, StringView* elements)
+    {
+        ptrdiff_t pos = 0;
+
+        *brackets = !(pos < spec.length && spec.ptr[pos] == 'n' && ++pos);
+
+        if (pos < spec.length && spec.ptr[pos++] != ':') {
+            return false;
+        }
+
+        *elements = StringView(spec.ptr + pos, spec.length - pos);
+        return true;
+    }
+
+    /// Whether any of `Types` is formatted as a custom type, which may not
+    /// use the standard format specifier syntax.
+    template <class... Types>
+    struct AnyCustomArg;
+
+    template <>
+    struct AnyCustomArg<> {
+        static const bool value = false;
+    };
+
+    template <class T, class... Types>
+    struct AnyCustomArg<T, Types...> {
+        static const bool value = FormatArgType<typename std::decay<T>::type>::value == FormatArg::TYPE_CUSTOM
+            || AnyCustomArg<Types...>::value;
+    };
+
+    template <class T, class Map = std::integral_constant<bool, IsMap<T>::value>>
+    struct RangeElements {
+        static const bool custom = AnyCustomArg<decltype(*std::begin(std::declval<const T&>()))>::value;
+    };
+
+    template <class T>
+    struct RangeElements<T, std::true_type> {
+        static const bool custom = AnyCustomArg<typename T::key_type, typename T::mapped_type>::value;
+    };
+
+    template <class T>
+    bool format_range_value(BufferedWriter& writer, const StringView& spec, const FormatFlags*, const T& value, std::false_type)
+    {
+        return format_range(writer, spec, std::begin(value), std::end(value), ", ");
+    }
+
+    template <class T>
+    bool format_range_value(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const T& value, std::true_type)
+    {
+        const auto begin = std::begin(value);
+        const auto end = std::end(value);
+
+        for (auto it = begin; it != end; ++it) {
+            if (it != begin) {
+                writer.write(2, ", ");
+            }
+
+            if (!format_arg(writer, spec, flags, make_format_arg(it->first))) {
+                return false;
+            }
+            writer.write(2, ": ");
+            if (!format_arg(writer, spec, flags, make_format_arg(it->second))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags*, const T& value, RangeTag)
+    {
+        using Map = std::integral_constant<bool, IsMap<T>::value>;
+
+        bool brackets;
+        StringView elements;
+        FormatFlags parsed;
+
+        if (!parse_range_spec(spec, &brackets, &elements)) {
+            return false;
+        }
+
+        // fail before writing anything if no element can use the specifier
+        const auto flags = parse_format(elements, &parsed) ? &parsed : nullptr;
+        if (!flags && !RangeElements<T>::custom) {
+            return false;
+        }
+
+        if (brackets) {
+            writer.write(1, Map::value ? "{" : "[");
+        }
+        if (!format_range_value(writer, elements, flags, value, Map())) {
+            return false;
+        }
+        if (brackets) {
+            writer.write(1, Map::value ? "}" : "]");
+        }
+
+        return true;
+    }
+
+    template <size_t I, class T>
+    bool format_tuple_elements(BufferedWriter&, const StringView&, const FormatFlags*, const T&, std::false_type)
+    {
+        return true;
+    }
+
+    template <size_t I, class T>
+    bool format_tuple_elements(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const T& value, std::true_type)
+    {
+        using More = std::integral_constant<bool, (I + 1 < std::tuple_size<T>::value)>;
+
+        if (I) {
+            writer.write(2, ", ");
+        }
+
+        return format_arg(writer, spec, flags, make_format_arg(std::get<I>(value)))
+            && format_tuple_elements<I + 1>(writer, spec, flags, value, More());
+    }
+
+    /// Whether any element of a tuple-like `T` is a custom type; assumed for
+    /// tuple-like types other than `std::pair` and `std::tuple`.
+    template <class T>
+    struct TupleElements {
+        static const bool custom = true;
+    };
+
+    template <class... Types>
+    struct TupleElements<std::tuple<Types...>> {
+        static const bool custom = AnyCustomArg<Types...>::value;
+    };
 
-            if (flags.alternate) {
-                switch (base) {
-                case 2:
-                    *(--prefix) = 'b';
-                    *(--prefix) = '0';
-                    nprefix += 2;
+    template <class First, class Second>
+    struct TupleElements<std::pair<First, Second>> {
+        static const bool custom = AnyCustomArg<First, Second>::value;
+    };
+
+    template <class T>
+    bool format_custom(BufferedWriter& writer, const StringView& spec, const FormatFlags*, const T& value, TupleTag)
+    {
+        using Any = std::integral_constant<bool, (std::tuple_size<T>::value > 0)>;
+
+        bool brackets;
+        StringView elements;
+        FormatFlags parsed;
+
+        if (!parse_range_spec(spec, &brackets, &elements)) {
+            return false;
+        }
+
+        // fail before writing anything if no element can use the specifier
+        const auto flags = parse_format(elements, &parsed) ? &parsed : nullptr;
+        if (!flags && !TupleElements<T>::custom) {
+            return false;
+        }
+
+        if (brackets) {
+            writer.write(1, "(");
+        }
+        if (!format_tuple_elements<0>(writer, elements, flags, value, Any())) {
+            return false;
+        }
+        if (brackets) {
+            writer.write(1, ")");
+        }
+
+        return true;
+    }
+
+#if defined(SP_ENABLE_CHRONO)
+    template <class Duration>
+    bool format_value(IWriter& writer, const StringView& spec, const std::chrono::time_point<std::chrono::system_clock, Duration>& value)
+    {
+        const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(value.time_since_epoch());
+        return format_time(writer, spec, (long long)micros.count());
+    }
+
+    template <class Period>
+    const char* duration_suffix() { return nullptr; }
+    template <> inline const char* duration_suffix<std::nano>() { return "ns"; }
+    template <> inline const char* duration_suffix<std::micro>() { return "us"; }
+    template <> inline const char* duration_suffix<std::milli>() { return "ms"; }
+    template <> inline const char* duration_suffix<std::ratio<1>>() { return "s"; }
+    template <> inline const char* duration_suffix<std::ratio<60>>() { return "min"; }
+    template <> inline const char* duration_suffix<std::ratio<3600>>() { return "h"; }
+    template <> inline const char* duration_suffix<std::ratio<86400>>() { return "d"; }
+
+    template <class Rep, class Period>
+    bool format_value(IWriter& writer, const StringView& spec, const std::chrono::duration<Rep, Period>& value)
+    {
+        WriterBuffer buffered(writer);
+
+        if (!format_arg(buffered, spec, nullptr, make_format_arg(value.count()))) {
+            return false;
+        }
+
+        // other units are written as the ratio of seconds they count
+        if (const auto suffix = duration_suffix<typename Period::type>()) {
+            buffered.write(std::strlen(suffix), suffix);
+        } else if (Period::den == 1) {
+            format(buffered, "[{}]s", (long long)Period::num);
+        } else {
+            format(buffered, "[{}/{}]s", (long long)Period::num, (long long)Period::den);
+        }
+
+        return true;
+    }
+#endif
+
+    template <size_t N>
+    FormatArgStore<N>::operator FormatArgs() const
+    {
+        return FormatArgs(args, int32_t(N));
+    }
+
+    inline FormatArgs::FormatArgs()
+        : m_args(nullptr)
+        , m_count(0)
+    {
+    }
+
+    inline FormatArgs::FormatArgs(const FormatArg args[], int32_t count)
+        : m_args(args)
+        , m_count(count)
+    {
+    }
+
+    inline int32_t FormatArgs::size() const
+    {
+        return m_count;
+    }
+
+    inline const FormatArg& FormatArgs::operator[](int32_t index) const
+    {
+        static const FormatArg none;
+        return (index >= 0 && index < m_count) ? m_args[index] : none;
+    }
+
+    /// Retained rendering of a compiled format, for formats such as status
+    /// lines that are rendered over and over with mostly the same arguments.
+    /// Only the fields whose arguments changed since the last render are
+    /// formatted again, and patched into the output in place as long as their
+    /// length stays the same. Arithmetic arguments are compared by value, while
+    /// strings, custom types and nested fields are formatted every time. The
+    /// compiled format must outlive the rendering.
+    class RenderedFormat {
+    public:
+        /// Construct a rendering of the provided format. Formats that did not
+        /// fit in their segment capacity are rendered in full every time.
+        template <size_t N>
+        RenderedFormat(const CompiledFormat<N>& fmt)
+            : m_source(fmt.source())
+            , m_begin(fmt.compiled() ? fmt.begin() : nullptr)
+            , m_end(fmt.compiled() ? fmt.end() : nullptr)
+            , m_slots(new Slot[size_t(m_end - m_begin) + 1])
+            , m_formatted(0)
+            , m_rendered(false)
+        {
+        }
+
+        RenderedFormat(const RenderedFormat&) = delete;
+        RenderedFormat& operator=(const RenderedFormat&) = delete;
+
+        ~RenderedFormat()
+        {
+            delete[] m_slots;
+        }
+
+        /// Render the format with the provided format arguments, and return
+        /// the output. The output remains valid until the next render.
+        template <class... Args>
+        StringView render(Args&&... args)
+        {
+            return vrender(make_format_args(std::forward<Args>(args)...));
+        }
+        StringView vrender(const FormatArgs& args);
+
+        /// Return the output of the last render.
+        StringView output() const
+        {
+            return StringView(m_output.data(), ptrdiff_t(m_output.length()));
+        }
+
+        /// Return the amount of fields formatted by the last render.
+        size_t formatted() const
+        {
+            return m_formatted;
+        }
+
+    private:
+        struct Slot {
+            size_t offset = 0; //< of the field in the output
+            size_t length = 0;
+            FormatArg arg; //< last formatted by the field
+        };
+
+        /// Return whether the field of segment `index` has to be formatted again.
+        bool changed(size_t index, const FormatArgs& args) const;
+
+        /// Format the field of segment `index` into `writer`.
+        void format_field(BufferedWriter& writer, size_t index, const FormatArgs& args);
+
+        StringView m_source;
+        const FormatSegment* m_begin;
+        const FormatSegment* m_end;
+        Slot* m_slots; //< per segment
+        MemoryWriter m_output;
+        MemoryWriter m_spare; //< output being laid out again
+        MemoryWriter m_scratch; //< field being patched
+        size_t m_formatted;
+        bool m_rendered;
+    };
+
+#if SP_DEFINE_ENGINE
+    /// Format the provided argument, using `flags` if they have already been
+    /// parsed from `spec`.
+    SP_INLINE bool format_arg(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const FormatArg& arg)
+    {
+        const auto& value = arg.value;
+
+        if (arg.type == FormatArg::TYPE_CUSTOM) {
+            return value.custom.format(writer, spec, flags, value.custom.value);
+        }
+
+        FormatFlags parsed;
+
+        if (!flags) {
+            if (!parse_format(spec, &parsed)) {
+                return false;
+            }
+            flags = &parsed;
+        }
+
+        switch (arg.type) {
+        case FormatArg::TYPE_BOOL:
+            return format_bool(writer, *flags, value.b);
+        case FormatArg::TYPE_CHAR:
+            return format_char(writer, *flags, value.c);
+        case FormatArg::TYPE_INT:
+            return format_int(writer, *flags, value.i);
+        case FormatArg::TYPE_UINT:
+            return format_int(writer, *flags, false, value.u);
+        case FormatArg::TYPE_FLOAT:
+            return format_float(writer, *flags, value.f);
+        case FormatArg::TYPE_DOUBLE:
+            return format_float(writer, *flags, value.d);
+        case FormatArg::TYPE_STRING:
+            return format_string(writer, *flags, StringView(value.string.ptr, value.string.length));
+        case FormatArg::TYPE_POINTER:
+            return format_pointer(writer, *flags, value.p);
+        default:
+            return false;
+        }
+    }
+
+    void do_format(BufferedWriter& writer, const StringView& fmt, int32_t* prevIndex, const FormatArgs& args);
+
+    /// Reads a format specifier with nested fields, as the text that the
+    /// fields resolve to. Fields of integers are provided as numbers too, so
+    /// that widths and precisions don't have to be parsed back from text.
+    class NestedSpecReader {
+    public:
+        /// Resolve the nested fields of `spec`. Return `false` if any of them
+        /// can only be resolved by formatting it.
+        bool resolve(const StringView& spec, int32_t* prevIndex, const FormatArgs& args);
+
+        bool peek(int32_t offset, char* ch) const;
+        void skip(int32_t count);
+        bool number(int32_t* value);
+
+    private:
+        enum {
+            MAX_PIECES = 8,
+        };
+
+        struct Piece {
+            StringView text;
+            int32_t number; //< or `-1` if it can't be used as one
+            char buffer[24];
+        };
+
+        bool add(const StringView& text);
+        void advance();
+
+        Piece m_pieces[MAX_PIECES];
+        int32_t m_count = 0;
+        int32_t m_piece = 0;
+        ptrdiff_t m_offset = 0;
+    };
+
+    inline bool NestedSpecReader::resolve(const StringView& spec, int32_t* prevIndex, const FormatArgs& args)
+    {
+        FormatTokenizer tokenizer(spec, prevIndex);
+        FormatToken token;
+
+        while (tokenizer.next(&token)) {
+            if (token.literal.length && !add(token.literal)) {
+                return false;
+            }
+
+            if (!token.hasField) {
+                continue;
+            }
+
+            const auto& arg = args[token.field.index];
+
+            if (token.field.spec.length || !add(StringView())) {
+                return false;
+            }
+
+            auto& piece = m_pieces[m_count - 1];
+            const auto end = piece.buffer + sizeof(piece.buffer);
+
+            switch (arg.type) {
+            case FormatArg::TYPE_INT:
+            case FormatArg::TYPE_UINT: {
+                const auto negative = arg.type == FormatArg::TYPE_INT && arg.value.i < 0;
+                const auto value = negative ? 0 - arg.value.u : arg.value.u;
+                auto first = write_decimal(end, value);
+
+                if (negative) {
+                    *--first = '-';
+                } else if (value > 0 && value < 1000000000) {
+                    piece.number = int32_t(value);
+                }
+
+                piece.text = StringView(first, end - first);
+                break;
+            }
+            case FormatArg::TYPE_CHAR:
+                if (arg.value.c > 0x7f) {
+                    return false;
+                }
+                piece.buffer[0] = char(arg.value.c);
+                piece.text = StringView(piece.buffer, 1);
+                break;
+            case FormatArg::TYPE_STRING:
+                piece.text = StringView(arg.value.string.ptr, arg.value.string.length);
+                break;
+            default:
+                return false;
+            }
+        }
+
+        advance();
+        return true;
+    }
+
+    inline bool NestedSpecReader::peek(int32_t offset, char* ch) const
+    {
+        auto piece = m_piece;
+        ptrdiff_t pos = m_offset + offset;
+
+        while (piece < m_count && pos >= m_pieces[piece].text.length) {
+            pos -= m_pieces[piece].text.length;
+            ++piece;
+        }
+
+        if (piece == m_count) {
+            return false;
+        }
+
+        *ch = m_pieces[piece].text.ptr[pos];
+        return true;
+    }
+
+    inline void NestedSpecReader::skip(int32_t count)
+    {
+        m_offset += count;
+        advance();
+    }
+
+    inline bool NestedSpecReader::number(int32_t* value)
+    {
+        if (m_piece == m_count || m_offset || m_pieces[m_piece].number < 0) {
+            return false;
+        }
+
+        *value = m_pieces[m_piece++].number;
+        advance();
+        return true;
+    }
+
+    inline bool NestedSpecReader::add(const StringView& text)
+    {
+        if (m_count == MAX_PIECES) {
+            return false;
+        }
+
+        auto& piece = m_pieces[m_count++];
+        piece.text = text;
+        piece.number = -1;
+        return true;
+    }
+
+    inline void NestedSpecReader::advance()
+    {
+        while (m_piece < m_count && m_offset >= m_pieces[m_piece].text.length) {
+            m_offset -= m_pieces[m_piece].text.length;
+            ++m_piece;
+        }
+    }
+
+    inline bool format_field(BufferedWriter& writer, const FormatField& field, int32_t* prevIndex, const FormatArgs& args)
+    {
+        const auto& arg = args[field.index];
+
+        if (!field.nested) {
+            return format_arg(writer, field.spec, nullptr, arg);
+        }
+
+        // resolve the nested fields straight into the flags if possible.
+        // custom types are passed the specifier as text, so theirs are always
+        // formatted
+        if (arg.type != FormatArg::TYPE_CUSTOM) {
+            NestedSpecReader reader;
+            auto index = *prevIndex;
+
+            if (reader.resolve(field.spec, &index, args)) {
+                FormatFlags flags;
+                *prevIndex = index;
+                return parse_flags(reader, &flags) && format_arg(writer, field.spec, &flags, arg);
+            }
+        }
+
+        MemoryWriter spec;
+        do_format(spec, field.spec, prevIndex, args);
+        return format_arg(writer, StringView(spec.data(), ptrdiff_t(spec.length())), nullptr, arg);
+    }
+
+    inline void do_format(BufferedWriter& writer, const StringView& fmt, int32_t* prevIndex, const FormatArgs& args)
+    {
+        FormatTokenizer tokenizer(fmt, prevIndex);
+        FormatToken token;
+
+        while (tokenizer.next(&token)) {
+            if (token.literal.length) {
+                writer.reference(token.literal.length, token.literal.ptr);
+            }
+
+            // fields that fail to format are output as-is
+            if (token.hasField && !format_field(writer, token.field, prevIndex, args)) {
+                writer.write(token.field.raw.length, token.field.raw.ptr);
+            }
+        }
+    }
+
+#if defined(SP_ENABLE_STATS)
+    SP_INLINE uint64_t stats_ticks()
+    {
+    #if defined(SP_STATS_RDTSC)
+        return uint64_t(__rdtsc());
+    #else
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    #endif
+    }
+
+    /// Counters of a format string, updated from any thread. The key and
+    /// text are written once, by the thread claiming the entry, before it
+    /// publishes them through `ready`.
+    struct StatsEntry {
+        std::atomic<bool> claimed;
+        std::atomic<bool> ready;
+        uint64_t hash;
+        ptrdiff_t length;
+        char text[SP_STATS_FORMAT_LENGTH];
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> truncations;
+        std::atomic<uint64_t> ticks;
+    };
+
+    /// Return the table of counters, mapped by the text of their format
+    /// strings. Entries are never removed, so the table is only ever locked
+    /// per entry, when claiming it.
+    inline StatsEntry* stats_entries()
+    {
+        // zero-initialized, as it has static storage
+        static StatsEntry entries[SP_STATS_CAPACITY];
+        return entries;
+    }
+
+    /// Return the counters of the provided format string, or `nullptr` if
+    /// the table is full.
+    inline StatsEntry* stats_entry(const StringView& fmt)
+    {
+        if (!fmt.ptr) {
+            return nullptr;
+        }
+
+        // only the kept text is compared, so only it needs hashing, a word
+        // at a time
+        const auto kept = size_t(std::min(fmt.length, ptrdiff_t(SP_STATS_FORMAT_LENGTH)));
+        uint64_t hash = uint64_t(fmt.length) * 0x9e3779b97f4a7c15ull;
+        size_t i = 0;
+
+        for (; i + 8 <= kept; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, fmt.ptr + i, 8);
+            hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+            hash ^= hash >> 32;
+        }
+        for (; i < kept; ++i) {
+            hash = (hash ^ uint8_t(fmt.ptr[i])) * 0x9e3779b97f4a7c15ull;
+        }
+        hash ^= hash >> 32;
+
+        const auto entries = stats_entries();
+
+        for (size_t probe = 0; probe < SP_STATS_CAPACITY; ++probe) {
+            auto& entry = entries[(size_t(hash >> 32) + probe) % SP_STATS_CAPACITY];
+
+            if (!entry.ready.load(std::memory_order_acquire)) {
+                bool claimed = false;
+                if (entry.claimed.compare_exchange_strong(claimed, true, std::memory_order_acq_rel)) {
+                    entry.hash = hash;
+                    entry.length = fmt.length;
+                    std::memcpy(entry.text, fmt.ptr, kept);
+                    entry.ready.store(true, std::memory_order_release);
+                    return &entry;
+                }
+
+                // another thread is claiming it, possibly for the same format
+                while (!entry.ready.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            }
+
+            if (entry.hash == hash && entry.length == fmt.length && std::memcmp(entry.text, fmt.ptr, kept) == 0) {
+                return &entry;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /// Adds a single call formatting `fmt` into `writer` to the counters of
+    /// `fmt`, once the scope ends.
+    class StatsScope {
+    public:
+        StatsScope(const BufferedWriter& writer, const StringView& fmt)
+            : m_writer(writer)
+            , m_entry(stats_entry(fmt))
+            , m_size(writer.size())
+            , m_discarded(writer.discarded())
+            , m_start(stats_ticks())
+        {
+        }
+
+        StatsScope(const StatsScope&) = delete;
+        StatsScope& operator=(const StatsScope&) = delete;
+
+        ~StatsScope()
+        {
+            if (m_entry) {
+                const auto ticks = stats_ticks() - m_start;
+                const auto truncated = m_writer.discarded() != m_discarded;
+                m_entry->calls.fetch_add(1, std::memory_order_relaxed);
+                m_entry->bytes.fetch_add(m_writer.size() - m_size, std::memory_order_relaxed);
+                if (truncated) {
+                    m_entry->truncations.fetch_add(1, std::memory_order_relaxed);
+                }
+                m_entry->ticks.fetch_add(ticks, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        const BufferedWriter& m_writer;
+        StatsEntry* m_entry;
+        size_t m_size;
+        size_t m_discarded;
+        uint64_t m_start;
+    };
+
+    SP_INLINE size_t format_stats(FormatStats stats[], size_t capacity)
+    {
+        const auto entries = stats_entries();
+        size_t count = 0;
+
+        for (size_t i = 0; i < SP_STATS_CAPACITY; ++i) {
+            const auto& entry = entries[i];
+            if (!entry.ready.load(std::memory_order_acquire)) {
+                continue;
+            }
+
+            const auto calls = entry.calls.load(std::memory_order_relaxed);
+            if (!calls) {
+                continue;
+            }
+
+            if (count < capacity) {
+                auto& out = stats[count];
+                out.format = StringView(entry.text, std::min(entry.length, ptrdiff_t(SP_STATS_FORMAT_LENGTH)));
+                out.length = entry.length;
+                out.calls = calls;
+                out.bytes = entry.bytes.load(std::memory_order_relaxed);
+                out.truncations = entry.truncations.load(std::memory_order_relaxed);
+                out.ticks = entry.ticks.load(std::memory_order_relaxed);
+            }
+
+            ++count;
+        }
+
+        return count;
+    }
+
+    SP_INLINE void reset_format_stats()
+    {
+        const auto entries = stats_entries();
+
+        for (size_t i = 0; i < SP_STATS_CAPACITY; ++i) {
+            entries[i].calls.store(0, std::memory_order_relaxed);
+            entries[i].bytes.store(0, std::memory_order_relaxed);
+            entries[i].truncations.store(0, std::memory_order_relaxed);
+            entries[i].ticks.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// Format into `writer` without counting the call, so the stats don't
+    /// count their own output.
+    template <class... Args>
+    void format_uncounted(BufferedWriter& writer, const StringView& fmt, Args&&... args)
+    {
+        int32_t prevIndex = -1;
+        do_format(writer, fmt, &prevIndex, make_format_args(std::forward<Args>(args)...));
+    }
+
+    SP_INLINE void dump_format_stats(IWriter& writer)
+    {
+        const auto stats = static_cast<FormatStats*>(std::malloc(SP_STATS_CAPACITY * sizeof(FormatStats)));
+        if (!stats) {
+            return;
+        }
+
+        const auto count = std::min(format_stats(stats, SP_STATS_CAPACITY), size_t(SP_STATS_CAPACITY));
+        std::sort(stats, stats + count, [](const FormatStats& a, const FormatStats& b) {
+            return a.ticks > b.ticks;
+        });
+
+        WriterBuffer buffered(writer);
+        format_uncounted(buffered, "{:>12} {:>14} {:>11} {:>16}  format\n", "calls", "bytes", "truncations", "ticks");
+
+        for (size_t i = 0; i < count; ++i) {
+            const auto& stat = stats[i];
+            format_uncounted(buffered, "{:>12} {:>14} {:>11} {:>16}  ", stat.calls, stat.bytes, stat.truncations, stat.ticks);
+
+            // keep each format on a line of its own
+            for (ptrdiff_t j = 0; j < stat.format.length; ++j) {
+                const auto ch = stat.format.ptr[j];
+                switch (ch) {
+                case '\n':
+                    buffered.write(2, "\\n");
                     break;
-                case 8:
-                    *(--prefix) = 'o';
-                    *(--prefix) = '0';
-                    nprefix += 2;
+                case '\r':
+                    buffered.write(2, "\\r");
                     break;
-                case 16:
-                    *(--prefix) = digitchars[16];
-                    *(--prefix) = '0';
-                    nprefix += 2;
+                case '\t':
+                    buffered.write(2, "\\t");
+                    break;
+                default:
+                    buffered.write(1, &ch);
                     break;
                 }
             }
+
+            if (stat.format.length < stat.length) {
+                buffered.write(3, "...");
+            }
+
+            buffered.write(1, "\n");
         }
 
-        // determine sign
-        if (isNegative) {
-            *(--prefix) = '-';
-            ++nprefix;
-        } else if (flags.sign == '+' || flags.sign == ' ') {
-            *(--prefix) = flags.sign;
-            ++nprefix;
+        std::free(stats);
+    }
+
+    SP_INLINE void dump_format_stats(std::FILE* file)
+    {
+        StreamWriter writer(file);
+        dump_format_stats(writer);
+    }
+#endif
+
+    SP_NOINLINE SP_INLINE void vformat(BufferedWriter& writer, const StringView& fmt, const FormatArgs& args)
+    {
+#if defined(SP_ENABLE_STATS)
+        StatsScope stats(writer, fmt);
+#endif
+        int32_t prevIndex = -1;
+        do_format(writer, fmt, &prevIndex, args);
+    }
+
+    SP_NOINLINE SP_INLINE void vformat(IWriter& writer, const StringView& fmt, const FormatArgs& args)
+    {
+        WriterBuffer buffered(writer);
+        vformat(buffered, fmt, args);
+    }
+
+    inline bool format_segment(BufferedWriter& writer, const FormatSegment& segment, const FormatArgs& args)
+    {
+        const auto& field = segment.token.field;
+
+        if (field.nested) {
+            auto prevIndex = field.index;
+            return format_field(writer, field, &prevIndex, args);
         }
 
-        // for hex chars, the prefix should be part of the value
-        if (isChar && charAsHex) {
-            if (nprefix) {
-                digits -= nprefix;
-                ndigits += nprefix;
-                memcpy(digits, prefix, nprefix);
-                nprefix = 0;
+        const auto flags = segment.parsed ? &segment.flags : nullptr;
+        return format_arg(writer, field.spec, flags, args[field.index]);
+    }
+
+    /// Formats the segments of a compiled format, shared by formats of all
+    /// capacities.
+    SP_NOINLINE SP_INLINE void format_segments(BufferedWriter& writer, const StringView& source, const FormatSegment* begin, const FormatSegment* end, const FormatArgs& args)
+    {
+#if defined(SP_ENABLE_STATS)
+        StatsScope stats(writer, source);
+#else
+        (void)source;
+#endif
+
+        for (auto it = begin; it != end; ++it) {
+            const auto& segment = *it;
+            const auto& token = segment.token;
+
+            if (token.literal.length) {
+                writer.reference(token.literal.length, token.literal.ptr);
+            }
+
+            // fields that fail to format are output as-is
+            if (token.hasField && !format_segment(writer, segment, args)) {
+                writer.write(token.field.raw.length, token.field.raw.ptr);
             }
-            *(--digits) = '(';
-            ++ndigits;
         }
+    }
 
-        // determine spacing
-        int32_t leadSpace = 0;
-        int32_t tailSpace = 0;
-        {
-            int32_t nchars = ndigits + nprefix;
-            int32_t width = std::max(flags.width, nchars);
+    SP_INLINE bool RenderedFormat::changed(size_t index, const FormatArgs& args) const
+    {
+        const auto& field = m_begin[index].token.field;
+        const auto& last = m_slots[index].arg;
+        const auto& arg = args[field.index];
 
-            switch (flags.align) {
-            case '^':
-                leadSpace = (width / 2) - ((nchars + 1) / 2); // nchars rounded up
-                tailSpace = ((width + 1) / 2) - (nchars / 2); // width rounded up
-                leadSpace += (width & 1) & (nchars & 1); // if both are odd, we need to add one for correction
-                tailSpace -= (width & 1) & (nchars & 1); // if both are odd, we need to remove one for correction
-                break;
-            case '<':
-                tailSpace = width - nchars;
-                break;
-            case '>':
-            case '=':
-            default:
-                leadSpace = width - nchars;
-                break;
+        // strings and custom types may change behind the same pointer
+        if (!m_rendered || field.nested || arg.type != last.type) {
+            return true;
+        }
+
+        switch (arg.type) {
+        case FormatArg::TYPE_STRING:
+        case FormatArg::TYPE_CUSTOM:
+            return true;
+        default:
+            return std::memcmp(&arg.value, &last.value, sizeof(arg.value)) != 0;
+        }
+    }
+
+    SP_INLINE void RenderedFormat::format_field(BufferedWriter& writer, size_t index, const FormatArgs& args)
+    {
+        const auto& segment = m_begin[index];
+        const auto& field = segment.token.field;
+
+        if (!format_segment(writer, segment, args)) {
+            writer.write(field.raw.length, field.raw.ptr);
+        }
+
+        m_slots[index].arg = args[field.index];
+        ++m_formatted;
+    }
+
+    SP_INLINE StringView RenderedFormat::vrender(const FormatArgs& args)
+    {
+        m_formatted = 0;
+
+        if (!m_begin) {
+            m_output.clear();
+            vformat(m_output, m_source, args);
+            return output();
+        }
+
+        const auto count = size_t(m_end - m_begin);
+        size_t index = 0;
+
+        // patch fields in place until one of them changes length
+        if (m_rendered) {
+            for (; index < count; ++index) {
+                if (!m_begin[index].token.hasField || !changed(index, args)) {
+                    continue;
+                }
+
+                const auto& slot = m_slots[index];
+                m_scratch.clear();
+                format_field(m_scratch, index, args);
+
+                if (m_scratch.length() != slot.length) {
+                    break;
+                }
+                if (slot.length) {
+                    std::memcpy(m_output.data() + slot.offset, m_scratch.data(), slot.length);
+                }
+            }
+
+            if (index == count) {
+                return output();
             }
         }
 
-        // print sign and alternate prefix, if they should be before the padding
-        if (nprefix) {
-            switch (flags.align) {
-            case '^':
-            case '>':
-                break;
-            case '<':
-            case '=':
-            default:
-                writer.write(nprefix, prefix);
-                nprefix = 0;
-                break;
+        // lay out the rest again, copying the fields that didn't change; a
+        // field that changed length is already in the scratch buffer
+        const bool pending = m_rendered;
+        const auto start = m_rendered ? m_slots[index].offset : 0;
+
+        m_spare.clear();
+        m_spare.write(start, m_output.data());
+
+        for (auto i = index; i < count; ++i) {
+            const auto& token = m_begin[i].token;
+            auto& slot = m_slots[i];
+
+            if (i != index || !pending) {
+                m_spare.write(size_t(token.literal.length), token.literal.ptr);
+            }
+
+            const auto offset = m_spare.length();
+
+            if (!token.hasField) {
+                slot.length = 0;
+            } else if (i == index && pending) {
+                m_spare.write(m_scratch.length(), m_scratch.data());
+            } else if (changed(i, args)) {
+                format_field(m_spare, i, args);
+            } else {
+                m_spare.write(slot.length, m_output.data() + slot.offset);
             }
+
+            slot.offset = offset;
+            slot.length = m_spare.length() - offset;
         }
 
-        // apply the leading padding
-        const char fill = flags.fill ? flags.fill : ' ';
+        std::swap(m_output, m_spare);
+        m_rendered = true;
+        return output();
+    }
+#else
+    bool format_arg(BufferedWriter& writer, const StringView& spec, const FormatFlags* flags, const FormatArg& arg);
+    void format_segments(BufferedWriter& writer, const StringView& source, const FormatSegment* begin, const FormatSegment* end, const FormatArgs& args);
+#endif
 
-        while (leadSpace--) {
-            write_char(writer, fill);
+    template <size_t F>
+    void vformat(BufferedWriter& writer, const CompiledFormat<F>& fmt, const FormatArgs& args)
+    {
+        if (fmt.compiled()) {
+            format_segments(writer, fmt.source(), fmt.begin(), fmt.end(), args);
+        } else {
+            vformat(writer, fmt.source(), args);
         }
+    }
 
-        // print the prefix, if it should be after the padding
-        if (nprefix) {
-            writer.write(nprefix, prefix);
+    template <size_t F>
+    void vformat(IWriter& writer, const CompiledFormat<F>& fmt, const FormatArgs& args)
+    {
+        WriterBuffer buffered(writer);
+        vformat(buffered, fmt, args);
+    }
+
+    /// Per-thread buffer for formatting whole messages.
+    struct MessageBuffer {
+        MemoryWriter writer;
+        bool busy = false;
+    };
+
+#if SP_DEFINE_ENGINE
+    SP_INLINE MessageBuffer& message_buffer()
+    {
+        static thread_local MessageBuffer buffer;
+        return buffer;
+    }
+#else
+    MessageBuffer& message_buffer();
+#endif
+
+    /// Format a whole message into the per-thread buffer, and hand it to
+    /// `emit` in one piece.
+    template <class Format, class Emit>
+    ptrdiff_t format_message(const Format& fmt, const FormatArgs& args, Emit emit)
+    {
+        auto& message = message_buffer();
+
+        // custom formatters may themselves print while being formatted, so
+        // those messages get a buffer of their own
+        if (message.busy) {
+            MemoryWriter writer;
+            vformat(writer, fmt, args);
+            return emit(writer.data(), writer.length()) ? writer.result() : -1;
         }
 
-        // print digits
-        writer.write(ndigits, digits);
+        message.busy = true;
+        message.writer.clear();
+        vformat(message.writer, fmt, args);
 
-        // print tailing padding
-        while (tailSpace--) {
-            write_char(writer, fill);
+        const auto length = message.writer.length();
+        const auto result = emit(message.writer.data(), length) ? message.writer.result() : -1;
+
+        // don't hold on to the memory of unusually large messages
+        if (length > 64 * 1024) {
+            message.writer = MemoryWriter();
         }
 
-        return true;
+        message.busy = false;
+        return result;
     }
 
-    template <class F>
-    bool format_float(IWriter& writer, const StringView& format, F value)
+    template <class Format>
+    ptrdiff_t format_message(std::FILE* file, const Format& fmt, const FormatArgs& args)
     {
-        FormatFlags flags;
+        return format_message(fmt, args, [file](const char* data, size_t length) {
+            return !length || std::fwrite(data, 1, length, file) == length;
+        });
+    }
 
-        if (!parse_format(format, &flags)) {
-            return false;
-        }
+#if defined(SP_ENABLE_ASYNC)
+    template <class Format>
+    ptrdiff_t format_message(AsyncStream& stream, const Format& fmt, const FormatArgs& args)
+    {
+        return format_message(fmt, args, [&stream](const char* data, size_t length) {
+            stream.write(length, data);
+            return true;
+        });
+    }
 
-        // I *really* have no interest in serializing floats/doubles... so
-        // let's not. Instead, let's build a format string for snprintf to do
-        // the heavy work, and we'll just do alignment and stuff.
-        const char* suffix = "";
-        int32_t precision;
-        char type;
+    template <class T>
+    size_t deferred_size(const T& value)
+    {
+        const auto arg = make_format_arg(value);
 
-        switch (flags.type) {
-        case 'f':
-        case 'F':
-        case 'e':
-        case 'E':
-            precision = flags.precision >= 0 ? flags.precision : 6;
-            type = flags.type;
-            break;
-        case 'g':
-        case 'G':
-            precision = (flags.precision != 0)
-                ? (flags.precision > 0 ? flags.precision : 6)
-                : 1;
-            type = flags.type;
-            break;
-        case '%':
-            precision = flags.precision >= 0 ? flags.precision : 6;
-            type = 'f';
-            value *= 100;
-            suffix = "%%";
-            break;
+        switch (arg.type) {
+        case FormatArg::TYPE_STRING:
+            return size_t(arg.value.string.length);
+        case FormatArg::TYPE_CUSTOM:
+            return sizeof(T) + alignof(T) - 1;
         default:
-            precision = flags.precision >= 0 ? flags.precision : std::numeric_limits<F>::digits10;
-            type = 'g';
-            break;
+            return 0;
         }
+    }
 
-        // produce the formatted value
-        char buffer[512];
-        const char* digits = buffer;
-        int32_t ndigits = 0;
+    inline size_t deferred_size(const StaticString&)
+    {
+        return 0;
+    }
 
-        if (std::isnan(value)) {
-            const char* str = std::isupper(flags.type) ? "NAN" : "nan";
-            strncpy(buffer, str, 3);
-            ndigits = 3;
-        } else if (std::isinf(value)) {
-            const char* str = std::isupper(flags.type) ? "INF" : "inf";
-            strncpy(buffer, str, 3);
-            ndigits = 3;
-        } else {
-            char numFormat[17];
-            snprintf(numFormat, sizeof(numFormat), "%%+.%d%c%s", precision, type, suffix);
+    template <class T>
+    const void* defer_custom(char** data, const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "deferred custom types must be trivially copyable");
 
-            // produce the formatted value
-    #if defined(__MINGW32__) || (defined(_MSC_VER) && _MSC_VER < 1900)
-            unsigned int prevOutputFormat = _set_output_format(_TWO_DIGIT_EXPONENT);
-    #endif
+        const auto mask = uintptr_t(alignof(T)) - 1;
+        const auto copy = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(*data) + mask) & ~mask);
+        std::memcpy(copy, &value, sizeof(T));
+        *data = copy + sizeof(T);
+        return copy;
+    }
 
-            ndigits = snprintf(buffer, sizeof(buffer), numFormat, value) - 1;
-            digits = buffer + 1;
+    /// Store the provided argument at `out`, copying whatever it references
+    /// to `data`.
+    template <class T>
+    void defer_arg(FormatArg* out, char** data, const T& value)
+    {
+        auto arg = make_format_arg(value);
 
-    #if defined(__MINGW32__) || (defined(_MSC_VER) && _MSC_VER < 1900)
-            _set_output_format(prevOutputFormat);
-    #endif
+        if (arg.type == FormatArg::TYPE_STRING) {
+            const auto length = size_t(arg.value.string.length);
+            if (length) {
+                std::memcpy(*data, arg.value.string.ptr, length);
+            }
+            arg.value.string.ptr = *data;
+            *data += length;
+        } else if (arg.type == FormatArg::TYPE_CUSTOM) {
+            arg.value.custom.value = defer_custom(data, value);
         }
 
-        // determine sign
-        char sign = 0;
+        std::memcpy(out, &arg, sizeof(arg));
+    }
 
-        if (value < 0) {
-            sign = '-';
-        } else if (flags.sign == '+' || flags.sign == ' ') {
-            sign = flags.sign;
+    inline void defer_arg(FormatArg* out, char**, const StaticString& value)
+    {
+        const auto arg = make_format_arg(value);
+        std::memcpy(out, &arg, sizeof(arg));
+    }
+
+    template <class... Args>
+    bool DeferredQueue::push(const DeferredRecord& record, Args&&... args)
+    {
+        const size_t argc = sizeof...(Args);
+        const size_t sizes[] = { 0, deferred_size(args)... };
+
+        size_t size = sizeof(DeferredRecord) + argc * sizeof(FormatArg);
+        for (const auto extra : sizes) {
+            size += extra;
         }
+        size = (size + alignof(DeferredRecord) - 1) & ~(alignof(DeferredRecord) - 1);
 
-        // determine width
-        const int nchars = sign ? ndigits + 1 : ndigits;
-        const int32_t width = std::max(flags.width, nchars);
+        // a message never wraps around the end, so skip to the start when
+        // the rest is too small
+        const auto capacity = m_mask + 1;
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto offset = head & m_mask;
+        const auto skip = capacity - offset < size ? capacity - offset : 0;
 
-        // determine alignment
-        int32_t leadSpace = 0;
-        int32_t tailSpace = 0;
+        if (skip + size > capacity - (head - m_tail.load(std::memory_order_acquire))) {
+            return false;
+        }
 
-        switch (flags.align) {
-        case '^':
-            leadSpace = (width / 2) - ((nchars + 1) / 2); // nchars rounded up
-            tailSpace = ((width + 1) / 2) - (nchars / 2); // width rounded up
-            leadSpace += (width & 1) & (nchars & 1); // if both are odd, we need to add one for correction
-            tailSpace -= (width & 1) & (nchars & 1); // if both are odd, we need to remove one for correction
-            break;
-        case '<':
-            tailSpace = width - nchars;
-            break;
-        case '>':
-        default:
-            leadSpace = width - nchars;
-            break;
+        if (skip >= sizeof(DeferredRecord)) {
+            DeferredRecord padding;
+            padding.argc = SKIP;
+            std::memcpy(m_data + offset, &padding, sizeof(padding));
         }
 
-        // print sign, if it should be before the padding
-        if (sign && flags.align == '=') {
-            write_char(writer, sign);
-        }
+        const auto header = m_data + ((head + skip) & m_mask);
+        auto out = reinterpret_cast<FormatArg*>(header + sizeof(DeferredRecord));
+        auto data = reinterpret_cast<char*>(out + argc);
+
+        DeferredRecord stored = record;
+        stored.size = uint32_t(size);
+        stored.argc = int32_t(argc);
+        std::memcpy(header, &stored, sizeof(stored));
+
+        const int expand[] = { 0, (defer_arg(out++, &data, args), 0)... };
+        (void)expand;
+
+        m_head.store(head + skip + size, std::memory_order_release);
+        return true;
+    }
+
+    inline void format_deferred(BufferedWriter& writer, const DeferredRecord& record, const FormatArgs& args)
+    {
+        vformat(writer, record.fmt, args);
+    }
+
+    template <size_t F>
+    void format_deferred_compiled(BufferedWriter& writer, const DeferredRecord& record, const FormatArgs& args)
+    {
+        vformat(writer, *static_cast<const CompiledFormat<F>*>(record.compiled), args);
+    }
+#endif
+
+    template <class... Args>
+    ptrdiff_t print(const StringView& fmt, Args&&... args)
+    {
+        return format_message(stdout, fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    void format(IWriter& writer, const StringView& fmt, Args&&... args)
+    {
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    void format(BufferedWriter& writer, const StringView& fmt, Args&&... args)
+    {
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    ptrdiff_t format(std::FILE* file, const StringView& fmt, Args&&... args)
+    {
+        return format_message(file, fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+#if defined(SP_ENABLE_ASYNC)
+    template <class... Args>
+    ptrdiff_t format(AsyncStream& stream, const StringView& fmt, Args&&... args)
+    {
+        return format_message(stream, fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    bool format(DeferredQueue& queue, const StringView& fmt, Args&&... args)
+    {
+        DeferredRecord record;
+        record.format = &format_deferred;
+        record.fmt = fmt;
+        return queue.push(record, std::forward<Args>(args)...);
+    }
+#endif
+
+    template <class... Args>
+    void format(BinaryLogWriter& log, const StringView& fmt, Args&&... args)
+    {
+        static_assert(!AnyCustomArg<Args...>::value, "binary log records only hold arithmetic types, pointers and strings");
+        static_assert(sizeof...(Args) <= BinaryLogWriter::MAX_ARGS, "too many arguments for a binary log record");
+        log.write(fmt, make_format_args(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    ptrdiff_t format(char buffer[], size_t size, const StringView& fmt, Args&&... args)
+    {
+        StringWriter writer(buffer, size);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
+
+    template <size_t N, class... Args>
+    ptrdiff_t format(char (&buffer)[N], const StringView& fmt, Args&&... args)
+    {
+        StringWriter writer(buffer, N);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
+
+    template <class... Args>
+    ptrdiff_t formatted_size(const StringView& fmt, Args&&... args)
+    {
+        SizeWriter writer;
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
 
-        // apply leading padding
-        const char fill = flags.fill ? flags.fill : ' ';
+    template <class... Args>
+    MemoryWriter format_to_string(const StringView& fmt, Args&&... args)
+    {
+        MemoryWriter writer;
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer;
+    }
 
-        while (leadSpace--) {
-            write_char(writer, fill);
-        }
+    template <class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const StringView& fmt, Args&&... args)
+    {
+        MemoryWriter writer(&allocator);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer;
+    }
 
-        // print sign, if it should be after the padding
-        if (sign && flags.align != '=') {
-            write_char(writer, sign);
-        }
+    template <size_t F, class... Args>
+    ptrdiff_t print(const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        return format_message(stdout, fmt, make_format_args(std::forward<Args>(args)...));
+    }
 
-        // write string
-        writer.write(ndigits, digits);
+    template <size_t F, class... Args>
+    void format(IWriter& writer, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+    }
 
-        // apply tailing padding
-        while (tailSpace--) {
-            write_char(writer, fill);
-        }
+    template <size_t F, class... Args>
+    void format(BufferedWriter& writer, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+    }
 
-        return true;
+    template <size_t F, class... Args>
+    ptrdiff_t format(std::FILE* file, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        return format_message(file, fmt, make_format_args(std::forward<Args>(args)...));
     }
 
-    inline bool format_string(IWriter& writer, const sp::FormatFlags& flags, const StringView& str)
+#if defined(SP_ENABLE_ASYNC)
+    template <size_t F, class... Args>
+    ptrdiff_t format(AsyncStream& stream, const CompiledFormat<F>& fmt, Args&&... args)
     {
-        // determine the amount of characters to write
-        auto nchars = str.length;
+        return format_message(stream, fmt, make_format_args(std::forward<Args>(args)...));
+    }
 
-        if (flags.precision >= 0) {
-            nchars = std::min(flags.precision, nchars);
-        }
+    template <size_t F, class... Args>
+    bool format(DeferredQueue& queue, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        DeferredRecord record;
+        record.format = &format_deferred_compiled<F>;
+        record.compiled = &fmt;
+        return queue.push(record, std::forward<Args>(args)...);
+    }
+#endif
 
-        // determine width
-        const int32_t width = std::max(flags.width, nchars);
+    template <size_t F, class... Args>
+    ptrdiff_t format(char buffer[], size_t size, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        StringWriter writer(buffer, size);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
 
-        // determine alignment
-        int32_t leadSpace = 0;
-        int32_t tailSpace = 0;
+    template <size_t N, size_t F, class... Args>
+    ptrdiff_t format(char (&buffer)[N], const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        StringWriter writer(buffer, N);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
 
-        switch (flags.align) {
-        case '^':
-            leadSpace = (width / 2) - ((nchars + 1) / 2); // nchars rounded up
-            tailSpace = ((width + 1) / 2) - (nchars / 2); // width rounded up
-            leadSpace += (width & 1) & (nchars & 1); // if both are odd, we need to add one for correction
-            tailSpace -= (width & 1) & (nchars & 1); // if both are odd, we need to remove one for correction
-            break;
-        case '>':
-            leadSpace = width - nchars;
-            break;
-        case '<':
-        default:
-            tailSpace = width - nchars;
-            break;
-        }
+    template <size_t F, class... Args>
+    ptrdiff_t formatted_size(const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        SizeWriter writer;
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer.result();
+    }
 
-        // apply leading padding
-        const char fill = flags.fill ? flags.fill : ' ';
+    template <size_t F, class... Args>
+    MemoryWriter format_to_string(const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        MemoryWriter writer;
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer;
+    }
 
-        while (leadSpace--) {
-            write_char(writer, fill);
-        }
+    template <size_t F, class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const CompiledFormat<F>& fmt, Args&&... args)
+    {
+        MemoryWriter writer(&allocator);
+        vformat(writer, fmt, make_format_args(std::forward<Args>(args)...));
+        return writer;
+    }
 
-        // write string
-        writer.write(nchars, str.ptr);
+    template <class Iterator>
+    bool format_range(IWriter& writer, const StringView& spec, Iterator begin, Iterator end, const StringView& separator)
+    {
+        WriterBuffer buffered(writer);
+        return format_range(buffered, spec, begin, end, separator);
+    }
 
-        // apply tailing padding
-        while (tailSpace--) {
-            write_char(writer, fill);
+    template <class Iterator>
+    bool format_range(BufferedWriter& writer, const StringView& spec, Iterator begin, Iterator end, const StringView& separator)
+    {
+        // custom types may not use the standard syntax, so they get the raw
+        // specifier if it doesn't parse
+        FormatFlags parsed;
+        const auto flags = parse_format(spec, &parsed) ? &parsed : nullptr;
+
+        for (auto it = begin; it != end; ++it) {
+            if (it != begin && separator.length) {
+                writer.write(separator.length, separator.ptr);
+            }
+
+            if (!format_arg(writer, spec, flags, make_format_arg(*it))) {
+                return false;
+            }
         }
 
         return true;
     }
 
-    struct DummyArg {
-    };
+    template <class... Columns>
+    void format_columns(IWriter& writer, const StringView& fmt, size_t count, const Columns*... columns)
+    {
+        WriterBuffer buffered(writer);
+        format_columns(buffered, fmt, count, columns...);
+    }
 
-    inline bool format_value(IWriter&, const StringView&, const DummyArg&)
+    template <class... Columns>
+    void format_columns(BufferedWriter& writer, const StringView& fmt, size_t count, const Columns*... columns)
     {
-        return false;
+        // room for a field per column, and a few escaped braces
+        const CompiledFormat<sizeof...(Columns) + 8> compiled(fmt);
+        format_columns(writer, compiled, count, columns...);
     }
 
-    inline bool format_index(IWriter&, const StringView&, int32_t)
+    template <size_t F, class... Columns>
+    void format_columns(IWriter& writer, const CompiledFormat<F>& fmt, size_t count, const Columns*... columns)
     {
-        return false;
+        WriterBuffer buffered(writer);
+        format_columns(buffered, fmt, count, columns...);
     }
 
-    template <class Arg, class... Rest>
-    bool format_index(IWriter& writer, const StringView& format, int32_t index, Arg&& arg, Rest&&... rest)
+    template <size_t F, class... Columns>
+    void format_columns(BufferedWriter& writer, const CompiledFormat<F>& fmt, size_t count, const Columns*... columns)
     {
-        if (!index) {
-            return format_value(writer, format, std::forward<Arg>(arg));
-        } else {
-            return format_index(writer, format, index - 1, std::forward<Rest>(rest)...);
+        static_assert(sizeof...(Columns) > 0, "at least one column is required");
+
+        for (size_t i = 0; i < count; ++i) {
+            const FormatArg args[] = { make_format_arg(columns[i])... };
+            vformat(writer, fmt, FormatArgs(args, int32_t(sizeof...(Columns))));
         }
     }
 
-    template <class... Args>
-    int32_t print(const StringView& fmt, Args&&... args)
+#if defined(SP_ENABLE_ASYNC)
+    enum {
+        BATCH_CHUNK = 512, //< Records per task of a batch.
+        BATCH_WINDOW = 64, //< Tasks formatted ahead of writing a batch to an `IWriter`.
+    };
+
+    template <class Fn>
+    void format_batch_chunk(BufferedWriter& writer, const Fn& fn, size_t count, size_t chunk)
     {
-        StreamWriter writer(stdout);
-        format(writer, fmt, std::forward<Args>(args)...);
-        return writer.result();
+        const auto end = std::min(count, (chunk + 1) * BATCH_CHUNK);
+
+        for (auto index = chunk * BATCH_CHUNK; index < end; ++index) {
+            fn(writer, index);
+        }
     }
 
-    template <class... Args>
-    void do_format(IWriter& writer, const StringView& fmt, int32_t* prevIndex, Args&&... args)
-    {
-        enum State {
-            STATE_OPENER,
-            STATE_INDEX,
-            STATE_MARKER,
-            STATE_FLAGS,
-            STATE_CLOSER,
+    template <class Fn>
+    ptrdiff_t format_batch(char buffer[], size_t size, size_t count, const Fn& fn, IBatchExecutor* executor)
+    {
+        struct Context {
+            const Fn* fn;
+            size_t count;
+            char* buffer;
+            size_t size;
+            size_t* offsets;
         };
 
-        auto state = STATE_OPENER;
-        auto next = fmt.ptr;
-        auto start = fmt.ptr;
-        auto term = fmt.ptr + fmt.length;
+        // the default pool is only started if needed, once per batch
+        const auto threads = executor ? nullptr : new ThreadExecutor();
+        if (!executor) {
+            executor = threads;
+        }
 
-        const char* formatStart = nullptr;
-        auto index = -1;
-        auto opened = 0;
-        auto nested = false;
+        const auto chunks = (count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+        Context context = { &fn, count, buffer, size, new size_t[chunks + 1] };
 
-        while (next < term) {
-            const auto ptr = next++;
-            const auto ch = *ptr;
-
-            switch (state) {
-            case STATE_OPENER:
-                if (ch == '{') {
-                    writer.write(int32_t(ptr - start), start);
-
-                    if (next < term) {
-                        if (*next != '{') {
-                            index = -1;
-                            start = ptr;
-                            nested = false;
-                            formatStart = nullptr;
-                            state = STATE_INDEX;
-                        } else {
-                            start = next++;
-                        }
-                    }
-                } else if (ch == '}') {
-                    writer.write(int32_t(next - start), start);
-                    if (next < term && *next == '}') {
-                        ++next;
-                    }
-                    start = next;
-                }
-                break;
+        // measure the chunks, and sum up where each of them starts
+        executor->run(chunks, [](void* data, size_t chunk) {
+            const auto& context = *static_cast<const Context*>(data);
+            SizeWriter writer;
+            format_batch_chunk(writer, *context.fn, context.count, chunk);
+            context.offsets[chunk + 1] = size_t(writer.result());
+        }, &context);
 
-            case STATE_INDEX:
-                if (ch >= '0' && ch <= '9') {
-                    index = (index < 0)
-                        ? (ch - '0')
-                        : (index * 10) + (ch - '0');
-                } else {
-                    if (index < 0) {
-                        index = *prevIndex + 1;
-                    }
-                    *prevIndex = index;
-                    state = STATE_MARKER;
-                    --next;
-                }
-                break;
+        context.offsets[0] = 0;
+        for (size_t i = 0; i < chunks; ++i) {
+            context.offsets[i + 1] += context.offsets[i];
+        }
 
-            case STATE_MARKER:
-                if (ch == ':') {
-                    state = STATE_FLAGS;
-                } else {
-                    state = STATE_CLOSER;
-                    --next;
-                }
-                break;
+        executor->run(chunks, [](void* data, size_t chunk) {
+            const auto& context = *static_cast<const Context*>(data);
+            const auto begin = std::min(context.offsets[chunk], context.size);
+            const auto end = std::min(context.offsets[chunk + 1], context.size);
 
-            case STATE_FLAGS:
-                if (!formatStart) {
-                    formatStart = ptr;
-                }
+            if (begin < end) {
+                StringWriter writer(context.buffer + begin, end - begin);
+                format_batch_chunk(writer, *context.fn, context.count, chunk);
+            }
+        }, &context);
 
-                switch (ch) {
-                case '{':
-                    ++opened;
-                    nested = true;
-                    break;
-                case '}':
-                    if (opened > 0) {
-                        --opened;
-                    }
-                    else {
-                        state = STATE_CLOSER;
-                        --next;
-                    }
-                    break;
-                }
+        const auto length = ptrdiff_t(context.offsets[chunks]);
+        delete[] context.offsets;
+        delete threads;
+        return length;
+    }
 
-                break;
+    template <class Fn>
+    ptrdiff_t format_batch(IWriter& writer, size_t count, const Fn& fn, IBatchExecutor* executor)
+    {
+        struct Context {
+            const Fn* fn;
+            size_t count;
+            size_t first;
+            MemoryWriter* outputs;
+        };
 
-            case STATE_CLOSER:
-                if (ch == '}') {
-                    StringView format = formatStart
-                        ? StringView(formatStart, int32_t(ptr - formatStart))
-                        : StringView();
-
-                    // handle nested format specifiers
-                    char buffer[64];
-
-                    if (nested) {
-                        StringWriter nestedWriter(buffer, sizeof(buffer));
-                        sp::do_format(nestedWriter, format, prevIndex, std::forward<Args>(args)...);
-                        const auto fullLen = nestedWriter.result();
-                        const auto realLen = std::min(size_t(fullLen), sizeof(buffer));
-                        format = StringView(buffer, int32_t(realLen));
-                    }
+        // the default pool is only started if needed, once per batch
+        const auto threads = executor ? nullptr : new ThreadExecutor();
+        if (!executor) {
+            executor = threads;
+        }
 
-                    if (format_index(writer, format, index, std::forward<Args>(args)...)) {
-                        start = next;
-                    }
-                }
-                state = STATE_OPENER;
-                break;
+        // the buffers of a window are reused for the next one
+        const auto chunks = (count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+        Context context = { &fn, count, 0, new MemoryWriter[BATCH_WINDOW] };
+        size_t written = 0;
+        bool failed = false;
+
+        for (; context.first < chunks && !failed; context.first += BATCH_WINDOW) {
+            const auto window = std::min(chunks - context.first, size_t(BATCH_WINDOW));
+
+            executor->run(window, [](void* data, size_t index) {
+                const auto& context = *static_cast<const Context*>(data);
+                auto& output = context.outputs[index];
+                output.clear();
+                format_batch_chunk(output, *context.fn, context.count, context.first + index);
+            }, &context);
+
+            for (size_t i = 0; i < window && !failed; ++i) {
+                const auto& output = context.outputs[i];
+                failed = output.result() < 0 || writer.write(output.length(), output.data()) != output.length();
+                written += failed ? 0 : output.length();
             }
         }
 
-        // Print remaining data
-        if (start != term) {
-            writer.write(int32_t(term - start), start);
-        }
+        delete[] context.outputs;
+        delete threads;
+        return failed ? -1 : ptrdiff_t(written);
     }
+#endif
 
-    template <class... Args>
-    void format(IWriter& writer, const StringView& fmt, Args&&... args)
+    /// Check the format literal `S` against `Args` at compile time, if
+    /// supported.
+    template <class S, class... Args>
+    void check_literal()
     {
-        int32_t prevIndex = -1;
-        do_format(writer, fmt, &prevIndex, std::forward<Args>(args)...);
+#if SP_HAS_CONSTEXPR14
+        constexpr FormatArg::Type types[] = { FormatArgType<typename std::decay<Args>::type>::value..., FormatArg::TYPE_NONE };
+        constexpr auto result = check_format(StringView(S::data(), S::size()), types, int32_t(sizeof...(Args)));
+
+        static_assert(result != FORMAT_INVALID_FIELD, "malformed replacement field in format");
+        static_assert(result != FORMAT_INVALID_SPEC, "invalid format specifier in format");
+        static_assert(result != FORMAT_TYPE_MISMATCH, "format specifier does not apply to the type of its argument");
+        static_assert(result != FORMAT_MISSING_ARG, "replacement field refers to an argument that was not provided");
+        static_assert(result != FORMAT_UNUSED_ARG, "argument is not used by the format");
+#endif
     }
 
-    template <class... Args>
-    int32_t format(std::FILE* file, const StringView& fmt, Args&&... args)
+    template <class S, class... Args>
+    ptrdiff_t print(const FormatLiteral<S>&, Args&&... args)
     {
-        StreamWriter writer(file);
-        format(writer, fmt, std::forward<Args>(args)...);
-        return writer.result();
+        check_literal<S, Args...>();
+        return print(LiteralFormat<S>::get(), std::forward<Args>(args)...);
     }
 
-    template <class... Args>
-    int32_t format(char buffer[], size_t size, const StringView& fmt, Args&&... args)
+    template <class Output, class S, class... Args>
+    auto format(Output&& output, const FormatLiteral<S>&, Args&&... args)
+        -> decltype(format(output, LiteralFormat<S>::get(), std::forward<Args>(args)...))
     {
-        StringWriter writer(buffer, size);
-        format(writer, fmt, std::forward<Args>(args)...);
-        return writer.result();
+        check_literal<S, Args...>();
+        return format(output, LiteralFormat<S>::get(), std::forward<Args>(args)...);
     }
 
-    template <size_t N, class... Args>
-    int32_t format(char (&buffer)[N], const StringView& fmt, Args&&... args)
+    template <class S, class... Args>
+    ptrdiff_t format(char buffer[], size_t size, const FormatLiteral<S>&, Args&&... args)
     {
-        StringWriter writer(buffer, N);
-        format(writer, fmt, std::forward<Args>(args)...);
-        return writer.result();
+        check_literal<S, Args...>();
+        return format(buffer, size, LiteralFormat<S>::get(), std::forward<Args>(args)...);
+    }
+
+    template <class S, class... Args>
+    ptrdiff_t formatted_size(const FormatLiteral<S>&, Args&&... args)
+    {
+        check_literal<S, Args...>();
+        return formatted_size(LiteralFormat<S>::get(), std::forward<Args>(args)...);
+    }
+
+    template <class S, class... Args>
+    MemoryWriter format_to_string(const FormatLiteral<S>&, Args&&... args)
+    {
+        check_literal<S, Args...>();
+        return format_to_string(LiteralFormat<S>::get(), std::forward<Args>(args)...);
+    }
+
+    template <class S, class... Args>
+    MemoryWriter format_to_string(IAllocator& allocator, const FormatLiteral<S>&, Args&&... args)
+    {
+        check_literal<S, Args...>();
+        return format_to_string(allocator, LiteralFormat<S>::get(), std::forward<Args>(args)...);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, std::nullptr_t)
+#if SP_DEFINE_ENGINE
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, std::nullptr_t)
     {
         return format_value(writer, fmt, (void*)0);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, bool value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, bool value)
     {
         FormatFlags flags;
 
-        if (parse_format(fmt, &flags)) {
-            switch (flags.type) {
-                case 'b':
-                case 'c':
-                case 'd':
-                case 'o':
-                case 'x':
-                case 'X':
-                    return format_int(writer, flags, false, (uint64_t)value);
-                default:
-                    return format_string(writer, flags, value ? "true" : "false");
-            }
-        }
-
-        return false;
+        return parse_format(fmt, &flags)
+            && format_value(writer, flags, value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, float value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, float value)
     {
-        return format_float(writer, fmt, value);
+        FormatFlags flags;
+
+        return parse_format(fmt, &flags)
+            && format_value(writer, flags, value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, double value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, double value)
     {
-        return format_float(writer, fmt, value);
+        FormatFlags flags;
+
+        return parse_format(fmt, &flags)
+            && format_value(writer, flags, value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, char value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, char value)
     {
         return format_value(writer, fmt, char32_t(value));
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, char16_t value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, char16_t value)
     {
         return format_value(writer, fmt, char32_t(value));
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, char32_t value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, char32_t value)
     {
         FormatFlags flags;
 
-        if (parse_format(fmt, &flags)) {
-            if (!flags.type) {
-                flags.type = 'c';
-            }
-
-            if (!flags.align) {
-                flags.align = '<';
-            }
-
-            return format_int(writer, flags, false, uint64_t(value));
-        }
-
-        return false;
+        return parse_format(fmt, &flags)
+            && format_value(writer, flags, value);
     }
 
-    template <size_t S> struct WcharSelector;
-    template<> struct WcharSelector<2> { using Type = char16_t; };
-    template<> struct WcharSelector<4> { using Type = char32_t; };
-
-    inline bool format_value(IWriter& writer, const StringView& fmt, wchar_t value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, wchar_t value)
     {
         using CharType = typename WcharSelector<sizeof(wchar_t)>::Type;
         return format_value(writer, fmt, CharType(value));
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, signed char value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, signed char value)
     {
         return format_value(writer, fmt, (long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, unsigned char value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, unsigned char value)
     {
         return format_value(writer, fmt, (unsigned long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, short value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, short value)
     {
         return format_value(writer, fmt, (long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, unsigned short value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, unsigned short value)
     {
         return format_value(writer, fmt, (unsigned long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, int value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, int value)
     {
         return format_value(writer, fmt, (long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, unsigned value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, unsigned value)
     {
         return format_value(writer, fmt, (unsigned long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, long value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, long value)
     {
         return format_value(writer, fmt, (long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, unsigned long value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, unsigned long value)
     {
         return format_value(writer, fmt, (unsigned long long)value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, long long value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, long long value)
     {
-        static_assert(sizeof(value) == sizeof(uint64_t), "invalid cast on negation");
-
-        const auto abs = (value >= 0 || value == std::numeric_limits<long long>::min())
-            ? uint64_t(value)
-            : uint64_t(-value);
-
         FormatFlags flags;
 
         return parse_format(fmt, &flags)
-            && format_int(writer, flags, value < 0, abs);
+            && format_value(writer, flags, value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, unsigned long long value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, unsigned long long value)
     {
         FormatFlags flags;
 
         return parse_format(fmt, &flags)
-            && format_int(writer, flags, false, uint64_t(value));
+            && format_value(writer, flags, value);
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, char value[])
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, char value[])
     {
         return format_value(writer, fmt, StringView(value));
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, const char value[])
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, const char value[])
     {
         return format_value(writer, fmt, StringView(value));
     }
 
-    inline bool format_value(IWriter& writer, const StringView& fmt, const StringView& value)
+    SP_INLINE bool format_value(IWriter& writer, const StringView& fmt, const StringView& value)
     {
         FormatFlags flags;
 
         return parse_format(fmt, &flags)
-            ? format_string(writer, flags, value)
-            : false;
+            && format_value(writer, flags, value);
     }
+#endif
 
     template <class T>
     bool format_value(IWriter& writer, const StringView& fmt, T* value)
     {
         FormatFlags flags;
 
-        if (parse_format(fmt, &flags)) {
-            if (!flags.type) {
-                flags.type = 'x';
-            }
+        return parse_format(fmt, &flags)
+            && format_value(writer, flags, value);
+    }
 
-            return format_int(writer, flags, false, uint64_t(value));
-        }
+#if SP_DEFINE_ENGINE
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, std::nullptr_t)
+    {
+        return format_value(writer, flags, (void*)0);
+    }
 
-        return false;
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, bool value)
+    {
+        WriterBuffer buffered(writer);
+        return format_bool(buffered, flags, value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, float value)
+    {
+        WriterBuffer buffered(writer);
+        return format_float(buffered, flags, value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, double value)
+    {
+        WriterBuffer buffered(writer);
+        return format_float(buffered, flags, value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, char value)
+    {
+        return format_value(writer, flags, char32_t(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, char16_t value)
+    {
+        return format_value(writer, flags, char32_t(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, char32_t value)
+    {
+        WriterBuffer buffered(writer);
+        return format_char(buffered, flags, value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, wchar_t value)
+    {
+        using CharType = typename WcharSelector<sizeof(wchar_t)>::Type;
+        return format_value(writer, flags, CharType(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, signed char value)
+    {
+        return format_value(writer, flags, (long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, unsigned char value)
+    {
+        return format_value(writer, flags, (unsigned long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, short value)
+    {
+        return format_value(writer, flags, (long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, unsigned short value)
+    {
+        return format_value(writer, flags, (unsigned long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, int value)
+    {
+        return format_value(writer, flags, (long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, unsigned value)
+    {
+        return format_value(writer, flags, (unsigned long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, long value)
+    {
+        return format_value(writer, flags, (long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, unsigned long value)
+    {
+        return format_value(writer, flags, (unsigned long long)value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, long long value)
+    {
+        WriterBuffer buffered(writer);
+        return format_int(buffered, flags, value);
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, unsigned long long value)
+    {
+        WriterBuffer buffered(writer);
+        return format_int(buffered, flags, false, uint64_t(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, char value[])
+    {
+        return format_value(writer, flags, StringView(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, const char value[])
+    {
+        return format_value(writer, flags, StringView(value));
+    }
+
+    SP_INLINE bool format_value(IWriter& writer, const FormatFlags& flags, const StringView& value)
+    {
+        WriterBuffer buffered(writer);
+        return format_string(buffered, flags, value);
+    }
+#endif
+
+    template <class T>
+    bool format_value(IWriter& writer, const FormatFlags& flags, T* value)
+    {
+        WriterBuffer buffered(writer);
+        return format_pointer(buffered, flags, value);
     }
 
 } // namespace sp
@@ -0,0 +1,23 @@
+// sp - string formatting micro-library
+//
+// Written in 2017 by Johan Sköld
+//
+// To the extent possible under law, the author(s) have dedicated all
+// copyright and related and neighboring rights to this software to the public
+// domain worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// The formatting engine of the tests built with SP_SEPARATE_IMPLEMENTATION,
+// with the same options as tests/main.cpp.
+
+#if !defined(_WIN32)
+#define SP_ENABLE_POSIX
+#endif
+
+#define SP_ENABLE_ASYNC
+#define SP_ENABLE_CHRONO
+#define SP_ENABLE_STATS
+#define SP_IMPLEMENTATION
+#include "../include/sp.hpp"
@@ -9,11 +9,34 @@
 // You should have received a copy of the CC0 Public Domain Dedication along
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 
+#include <algorithm> // std::count, std::find, std::find_if, std::min
+#include <array> // std::array
+#include <chrono> // std::chrono
 #include <cfloat> // DBL_MAX, FLT_MIN, FLT_MAX
+#include <clocale> // std::setlocale
+#include <cmath> // NAN, INFINITY
+#include <csignal> // std::signal, SIGXFSZ
 #include <cstdio> // std::printf, fmemopen
 #include <cstdlib> // std::malloc, std::free
+#include <cstring> // std::strlen
+#include <map> // std::map
+#include <mutex> // std::mutex, std::lock_guard
 #include <string> // std::string
+#include <thread> // std::thread
+#include <tuple> // std::tuple
+#include <vector> // std::vector
 
+#if !defined(_WIN32)
+#include <fcntl.h> // fcntl
+#include <sys/resource.h> // getrlimit, setrlimit
+#include <sys/uio.h> // writev
+#include <unistd.h> // read, lseek, pipe
+#define SP_ENABLE_POSIX
+#endif
+
+#define SP_ENABLE_ASYNC
+#define SP_ENABLE_CHRONO
+#define SP_ENABLE_STATS
 #include "../include/sp.hpp"
 
 static const char* s_testCaseDescr = nullptr;
@@ -44,21 +67,81 @@ static int s_failed = 0;
         break;                                                  \
     }
 
-#define TEST_FORMAT(expected, fmt, ...)                                                  \
-    for (;;) {                                                                           \
-        auto buffer = (char*)std::malloc(10 * 1024 * 1024);                              \
-        buffer[0] = 0;                                                                   \
-        const auto expectedLen = int32_t(std::strlen(expected));                         \
-        const auto actualLen = sp::format(buffer, 10 * 1024 * 1024, fmt, ##__VA_ARGS__); \
-        REQUIRE(std::memcmp(expected, buffer, actualLen) == 0);                          \
-        REQUIRE(expectedLen == actualLen);                                               \
-        std::free(buffer);                                                               \
-        break;                                                                           \
+#define TEST_FORMAT(expected, fmt, ...)                                                       \
+    for (;;) {                                                                                \
+        auto buffer = (char*)std::malloc(10 * 1024 * 1024);                                   \
+        buffer[0] = 0;                                                                        \
+        const auto expectedLen = int32_t(std::strlen(expected));                              \
+        const auto actualLen = sp::format(buffer, 10 * 1024 * 1024, fmt, ##__VA_ARGS__);      \
+        REQUIRE(std::memcmp(expected, buffer, actualLen) == 0);                               \
+        REQUIRE(expectedLen == actualLen);                                                    \
+        const sp::CompiledFormat<16> compiled(fmt);                                           \
+        REQUIRE(compiled.compiled());                                                         \
+        const auto compiledLen = sp::format(buffer, 10 * 1024 * 1024, compiled, ##__VA_ARGS__); \
+        REQUIRE(std::memcmp(expected, buffer, compiledLen) == 0);                             \
+        REQUIRE(expectedLen == compiledLen);                                                  \
+        REQUIRE(expectedLen == sp::formatted_size(fmt, ##__VA_ARGS__));                        \
+        std::free(buffer);                                                                    \
+        break;                                                                                \
     }
 
 struct Foo {
 };
 
+struct CountingWriter : sp::IWriter {
+    size_t writes = 0;
+    size_t length = 0;
+
+    size_t write(size_t len, const void*) override
+    {
+        ++writes;
+        length += len;
+        return len;
+    }
+};
+
+struct CountingAllocator : sp::IAllocator {
+    size_t allocations = 0;
+    size_t outstanding = 0;
+
+    void* allocate(size_t size) override
+    {
+        ++allocations;
+        outstanding += size;
+        return std::malloc(size);
+    }
+
+    void deallocate(void* ptr, size_t size) override
+    {
+        outstanding -= size;
+        std::free(ptr);
+    }
+};
+
+// Read back lines of `{:>2}:{:x>N}` written from several threads, and check
+// that none of them were torn apart.
+static bool check_lines(FILE* file, int count)
+{
+    char line[1024];
+    int lines = 0;
+
+    std::rewind(file);
+    while (std::fgets(line, sizeof(line), file)) {
+        const auto length = std::strlen(line);
+        if (length < 5 || line[2] != ':' || line[length - 1] != '\n' || line[length - 2] != '1') {
+            return false;
+        }
+        for (size_t i = 3; i < length - 2; ++i) {
+            if (line[i] != 'x') {
+                return false;
+            }
+        }
+        ++lines;
+    }
+
+    return lines == count;
+}
+
 static bool format_value(sp::IWriter& writer, const sp::StringView& format, const Foo&)
 {
     if (!format.length) {
@@ -69,6 +152,46 @@ static bool format_value(sp::IWriter& writer, const sp::StringView& format, cons
     return true;
 }
 
+struct Point {
+    int x;
+    int y;
+};
+
+static int s_pointParses = 0;
+
+namespace sp {
+
+    // Formats `(x, y)`, or `[x, y]` with a `[` specifier, followed by an
+    // optional `x` to only format `x`.
+    template <>
+    struct Formatter<Point> {
+        struct State {
+            bool square = false;
+            bool onlyX = false;
+        };
+
+        static bool parse(const StringView& spec, State* state)
+        {
+            int32_t pos = 0;
+            ++s_pointParses;
+            state->square = pos < spec.length && spec.ptr[pos] == '[' && ++pos;
+            state->onlyX = pos < spec.length && spec.ptr[pos] == 'x' && ++pos;
+            return pos == spec.length;
+        }
+
+        static bool format(IWriter& writer, const State& state, const Point& value)
+        {
+            if (state.onlyX) {
+                sp::format(writer, state.square ? "[{}]" : "({})", value.x);
+            } else {
+                sp::format(writer, state.square ? "[{}, {}]" : "({}, {})", value.x, value.y);
+            }
+            return true;
+        }
+    };
+
+} // namespace sp
+
 int main()
 {
     TEST_CASE("Output with a string buffer")
@@ -130,6 +253,32 @@ int main()
         TEST_FORMAT("a}b", "a}}b");
     }
 
+    TEST_CASE("Long literals")
+    {
+        // it should find braces anywhere within and across the scanned blocks
+        for (size_t lead = 0; lead < 80; ++lead) {
+            for (size_t trail = 0; trail < 40; trail += 13) {
+                const std::string fmt = std::string(lead, 'a') + "{}{{" + std::string(trail, 'b') + "}}";
+                const std::string expected = std::string(lead, 'a') + "7{" + std::string(trail, 'b') + "}";
+                TEST_FORMAT(expected.c_str(), fmt.c_str(), 7);
+            }
+        }
+
+        // it should treat bytes as such, regardless of sign
+        TEST_FORMAT("\xfb\xfd\x7b\x7c\x7e-1-\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff",
+                    "\xfb\xfd\x7b\x7b\x7c\x7e-{}-\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", 1);
+    }
+
+    TEST_CASE("Unterminated formats")
+    {
+        TEST_FORMAT("a{", "a{");
+        TEST_FORMAT("a{0", "a{0", 1);
+        TEST_FORMAT("a{0:", "a{0:", 1);
+        TEST_FORMAT("{5}}x", "{5}}x", 1);
+        TEST_FORMAT("{0{1}", "{0{1}", 1, 2);
+        TEST_FORMAT("{0!2", "{0!{}", 1, 2);
+    }
+
     TEST_CASE("Custom format")
     {
         TEST_FORMAT("<@:>f0\\", "{:<@:>f0\\}", Foo{});
@@ -137,12 +286,49 @@ int main()
         TEST_FORMAT("<empty>}", "{:}}", Foo{});
     }
 
+    TEST_CASE("Formatter")
+    {
+        TEST_FORMAT("(1, 2)", "{}", Point{ 1, 2 });
+        TEST_FORMAT("[1, 2]|(3)", "{:[}|{:x}", Point{ 1, 2 }, Point{ 3, 4 });
+        TEST_FORMAT("{:y}", "{:y}", Point{ 1, 2 });
+        TEST_FORMAT("[5]", "{0:{1}}", Point{ 5, 6 }, "[x");
+
+        // it should only parse each specifier once per thread
+        {
+            const sp::CompiledFormat<4> fmt("{0:[x}{0:[x}");
+            const auto parses = s_pointParses;
+            char buffer[16];
+
+            for (int i = 0; i < 3; ++i) {
+                REQUIRE(sp::format(buffer, fmt, Point{ i, i }) == 6);
+            }
+            REQUIRE(s_pointParses == parses);
+
+            sp::format(buffer, "{:[}{:}", Point{ 1, 2 }, Point{ 1, 2 });
+            REQUIRE(s_pointParses == parses);
+
+            std::thread([&] { sp::format(buffer, fmt, Point{ 1, 2 }); }).join();
+            REQUIRE(s_pointParses == parses + 1);
+        }
+    }
+
     TEST_CASE("Nested formats")
     {
         TEST_FORMAT("a b ", "{:{}}{:{}}", 'a', 2, 'b', 2);
         TEST_FORMAT("+    52.00", "{:{}}", 52.0f, "=+10.2f");
         TEST_FORMAT("oog", "{1:.{0}}", 3, "ooga");
         TEST_FORMAT("   1.0000", "{:{}.{}f}", 1.0f, 9, 4);
+        TEST_FORMAT("**1|-  3|x   ", "{:*>{}}|{:{}}|{:{}{}}", 1, 3, -3, 4, 'x', '<', 4);
+        TEST_FORMAT("  1", "{:>{}}", 1, -3);
+        TEST_FORMAT("{:{}>{}}", "{:{}>{}}", 1, 256, 3);
+        TEST_FORMAT("0.500", "{:.{}{}}", 0.5, 3, 'f');
+        TEST_FORMAT("00x", "{2:>{0}{1}}", 0, 3, 'x');
+        TEST_FORMAT("  x", "{2:>{0:d}}", 3, 0, 'x');
+
+        // it should support nested specs of any length
+        const std::string spec = "*>" + std::string(80, '0') + "8";
+        TEST_FORMAT("*******5", "{:{}}", 5, spec.c_str());
+        TEST_FORMAT(spec.c_str(), "{0:{1}}", Foo{}, spec.c_str());
 
         // LET'S GO DEEPER
         TEST_FORMAT("Hello", "{0:{0:{1}}}", Foo{}, "Hello");
@@ -182,8 +368,13 @@ int main()
         TEST_FORMAT("{:n}", "{:n}", 1);
         TEST_FORMAT("A", "{:c}", 65);
         TEST_FORMAT("x", "{:#c}", 120);
+#if defined(SP_ENABLE_UTF8)
+        TEST_FORMAT("\xc4\x80", "{:c}", 256);
+        TEST_FORMAT("\xc2\xa0", "{:#c}", 160);
+#else
         TEST_FORMAT("(100)", "{:c}", 256);
         TEST_FORMAT("(0xa0)", "{:#c}", 160);
+#endif
         TEST_FORMAT("(-0x5)", "{:#c}", -5);
         TEST_FORMAT("314159265", "{}", 314159265.0);
     }
@@ -201,9 +392,25 @@ int main()
         TEST_FORMAT("x  ", "{:3}", 'x');
         TEST_FORMAT("  x", "{:>3}", 'x');
         TEST_FORMAT("\x7f", "{:c}", 0x7f);
+#if defined(SP_ENABLE_UTF8)
+        TEST_FORMAT("\xc2\x80", "{:c}", 0x80);
+        TEST_FORMAT("\xdf\xbf", "{:c}", 0x7ff);
+        TEST_FORMAT("\xe0\xa0\x80", "{:c}", 0x800);
+        TEST_FORMAT("\xef\xbf\xbf", "{:c}", 0xffff);
+        TEST_FORMAT("\xf0\x90\x80\x80", "{:c}", 0x10000);
+        TEST_FORMAT("\xf4\x8f\xbf\xbf", "{:c}", 0x10ffff);
+        TEST_FORMAT("(d800)", "{:c}", 0xd800);
+        TEST_FORMAT("(110000)", "{:c}", 0x110000);
+        TEST_FORMAT("  \xe2\x82\xac  ", "{:^5c}", 0x20ac);
+        TEST_FORMAT("\xc3\xa9", "{}", (char16_t)0xe9);
+        TEST_FORMAT("\xe2\x82\xac ", "{:2}", (char32_t)0x20ac);
+        TEST_FORMAT("\xf0\x9f\x98\x80", "{}", (char32_t)0x1f600);
+        TEST_FORMAT(" \xc3\xa9", "{:>2}", (wchar_t)0xe9);
+#else
         TEST_FORMAT("(80)", "{:c}", 0x80);
         TEST_FORMAT("(+80)", "{:+c}", 0x80);
         TEST_FORMAT("  (+80)  ", "{:^+9c}", 0x80);
+#endif
     }
 
     TEST_CASE("Integer formats")
@@ -272,6 +479,11 @@ int main()
         TEST_FORMAT("+  177", "{:=+6o}", INT8_MAX);
         TEST_FORMAT(">> 18446744073709551615", "{:>> 23}", UINT64_MAX);
         TEST_FORMAT("0x7fffffffffffffff", "{:#x}", INT64_MAX);
+        TEST_FORMAT("-9223372036854775808", "{}", INT64_MIN);
+        TEST_FORMAT("9 10 99 100 9999999999 10000000000", "{} {} {} {} {} {}", 9, 10, 99, 100, 9999999999ll, 10000000000ll);
+        TEST_FORMAT("10000000000000000000", "{}", 10000000000000000000ull);
+        TEST_FORMAT("1777777777777777777777", "{:o}", UINT64_MAX);
+        TEST_FORMAT("0 0 0 0", "{} {:x} {:o} {:b}", 0, 0, 0, 0);
     }
 
     TEST_CASE("Float formats")
@@ -285,21 +497,37 @@ int main()
 
         TEST_FORMAT("1", "{}", 1.0);
         TEST_FORMAT("1.5", "{}", 1.5f);
-        TEST_FORMAT("1.79769313486232e+308", "{}", DBL_MAX);
-        TEST_FORMAT("1.17549e-38", "{}", FLT_MIN);
-        TEST_FORMAT("-3.40282e+38", "{}", -FLT_MAX);
+        TEST_FORMAT("1.7976931348623157e+308", "{}", DBL_MAX);
+        TEST_FORMAT("1.1754944e-38", "{}", FLT_MIN);
+        TEST_FORMAT("-3.4028235e+38", "{}", -FLT_MAX);
+        TEST_FORMAT("0.30000000000000004", "{}", 0.1 + 0.2);
+        TEST_FORMAT("0.1", "{}", 0.1f);
+        TEST_FORMAT("5e-324", "{}", 4.9406564584124654e-324);
+        TEST_FORMAT("1e-05", "{}", 0.00001);
+        TEST_FORMAT("1e+15", "{}", 1e15);
+        TEST_FORMAT("1.234567e+06", "{}", 1234567.0f);
+        TEST_FORMAT("1e+01", "{:.0}", 12.5);
 
         TEST_FORMAT(" 1.000000e+00", "{: e}", 1.0f);
         TEST_FORMAT("-1.000000e+00", "{:e}", -1.0f);
         TEST_FORMAT("1.234568E+05", "{:E}", 123456.789);
         TEST_FORMAT("5.12E+02", "{:.2E}", 512.1024);
         TEST_FORMAT("3.251923299534e+01", "{:.12e}", 32.5192329953432345);
+        TEST_FORMAT("2.225073858507201e-308", "{:.15e}", DBL_MIN);
+        TEST_FORMAT("1.797693e+308", "{:e}", DBL_MAX);
+        TEST_FORMAT("1e+23", "{:.0e}", 1e23);
 
         TEST_FORMAT("1.000000", "{:f}", 1.0f);
         TEST_FORMAT("-1.000000", "{:f}", -1.0f);
         TEST_FORMAT("+1.234568", "{:+f}", 1.23456789f);
         TEST_FORMAT("3.1416", "{:.4f}", 3.14159265f);
         TEST_FORMAT("1.57079633", "{:.8f}", 1.5707963267948966192);
+        TEST_FORMAT("0.1000000000000000055511151231", "{:.28f}", 0.1);
+        TEST_FORMAT("2 2 0.1 0.2", "{:.0f} {:.0f} {:.1f} {:.1f}", 1.5, 2.5, 0.125, 0.25);
+        TEST_FORMAT("0.000", "{:.3f}", 1e-300);
+        TEST_FORMAT("99999999999999991611392", "{:.0f}", 1e23);
+        TEST_FORMAT("25.600000%", "{:%}", 0.256);
+        TEST_FORMAT("50.0%", "{:.1%}", 0.5f);
 
         TEST_FORMAT("1", "{:g}", 1.0);
         TEST_FORMAT("-52", "{:g}", -52.0f);
@@ -313,6 +541,48 @@ int main()
         TEST_FORMAT("xxx32.007", "{:x>9.3f}", 32.00723f);
         TEST_FORMAT("__1__", "{:_^5g}", 1.0f);
         TEST_FORMAT("??2???", "{:?^6g}", 2.0f);
+
+        // it should not depend on the locale
+        {
+            static const char* const locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "German" };
+            for (const auto locale : locales) {
+                if (std::setlocale(LC_NUMERIC, locale)) {
+                    TEST_FORMAT("1.5", "{}", 1.5);
+                    TEST_FORMAT("3.142 3.1e+04", "{:.3f} {:.2g}", 3.14159, 31415.9);
+                    std::setlocale(LC_NUMERIC, "C");
+                    break;
+                }
+            }
+        }
+
+        // it should format the same from several threads at once
+        {
+            static const size_t COUNT = 4096;
+            static char expected[COUNT][64];
+            static bool mismatched[4];
+
+            const auto value = [](size_t i) { return double(i * 2654435761u % 1000003) / double(1 + i % 977) * (i % 2 ? 1e-30 : 1e30); };
+            for (size_t i = 0; i < COUNT; ++i) {
+                expected[i][sp::format(expected[i], 63, "{} {:.3e}", value(i), value(i))] = 0;
+            }
+
+            std::thread threads[4];
+            for (size_t t = 0; t < 4; ++t) {
+                threads[t] = std::thread([=]() {
+                    char buffer[64];
+                    for (size_t i = 0; i < COUNT; ++i) {
+                        const auto length = sp::format(buffer, 63, "{} {:.3e}", value(i), value(i));
+                        buffer[length] = 0;
+                        mismatched[t] |= std::strcmp(buffer, expected[i]) != 0;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            REQUIRE(!mismatched[0] && !mismatched[1] && !mismatched[2] && !mismatched[3]);
+        }
     }
 
     TEST_CASE("String formats")
@@ -335,6 +605,65 @@ int main()
         TEST_FORMAT("--ball---", "{:-^9.4s}", "ballet");
         TEST_FORMAT("foo", "{}", sp::StringView("foo"));
 
+        TEST_FORMAT("\"abc\"", "{:j}", "abc");
+        TEST_FORMAT("\"\"", "{:j}", "");
+        TEST_FORMAT("\"a\\\"b\\\\c\\n\\u0001\\u001f\x7f\"", "{:j}", "a\"b\\c\n\x01\x1f\x7f");
+        TEST_FORMAT("\"\\b\\f\\r\\t\xc3\xa9\"", "{:j}", "\b\f\r\t\xc3\xa9");
+        TEST_FORMAT("  \"a\\tb\"", "{:>8j}", "a\tb");
+        TEST_FORMAT("\"a\\n\"***", "{:*<8.2j}", "a\nb");
+        TEST_FORMAT("\"ab\"", "{:2j}", "ab");
+        TEST_FORMAT("true false", "{:j} {:j}", true, false);
+        TEST_FORMAT("\"a,\"\"b\"\"\"", "{:q}", "a,\"b\"");
+        TEST_FORMAT("\"a\\b\nc\"", "{:q}", "a\\b\nc");
+        TEST_FORMAT("1.5 -7 true", "{:j} {:j} {:j}", 1.5, -7, true);
+
+        // it should find characters to escape at any offset of a long string
+        for (size_t i = 0; i < 80; ++i) {
+            static const char specials[] = { '"', '\\', '\n', '\x1f' };
+            static const char* const escapes[] = { "\\\"", "\\\\", "\\n", "\\u001f" };
+
+            for (size_t j = 0; j < 4; ++j) {
+                std::string input(80, 'x');
+                input[i] = specials[j];
+                const auto expected = "\"" + input.substr(0, i) + escapes[j] + input.substr(i + 1) + "\"";
+
+                char buffer[128];
+                const auto length = sp::format(buffer, "{:j}", input.c_str());
+                REQUIRE(std::string(buffer, size_t(length)) == expected);
+            }
+        }
+
+#if defined(SP_ENABLE_UTF8)
+        // width and precision count code points, not bytes
+        TEST_FORMAT("\xc3\xa9t\xc3\xa9  ", "{:5}", "\xc3\xa9t\xc3\xa9");
+        TEST_FORMAT("..\xe2\x82\xac\xf0\x9f\x98\x80", "{:.>4}", "\xe2\x82\xac\xf0\x9f\x98\x80");
+        TEST_FORMAT(" \xc3\xa9 ", "{:^3}", "\xc3\xa9");
+        TEST_FORMAT("\xc3\xa9t", "{:.2}", "\xc3\xa9t\xc3\xa9");
+        TEST_FORMAT("", "{:.0}", "\xc3\xa9");
+        TEST_FORMAT("\xc3\xa9t\xc3\xa9", "{:.9}", "\xc3\xa9t\xc3\xa9");
+        TEST_FORMAT("-\xe2\x82\xac-", "{:-^3.1}", "\xe2\x82\xac\xe2\x82\xac");
+        TEST_FORMAT("\"\xc3\xa9\\n\" ", "{:6j}", "\xc3\xa9\n");
+
+        // it should count code points across whole blocks and the tail
+        for (size_t i = 0; i < 150; ++i) {
+            std::string input;
+            for (size_t j = 0; j < i; ++j) {
+                input += j % 3 ? "x" : "\xc3\xa9";
+            }
+
+            char buffer[512];
+            auto length = sp::format(buffer, "{:>151}", input.c_str());
+            REQUIRE(std::string(buffer, size_t(length)) == std::string(151 - i, ' ') + input);
+
+            length = sp::format(buffer, "{:.{}}", input.c_str(), i / 2);
+            std::string expected;
+            for (size_t j = 0; j < i / 2; ++j) {
+                expected += j % 3 ? "x" : "\xc3\xa9";
+            }
+            REQUIRE(std::string(buffer, size_t(length)) == expected);
+        }
+#endif
+
         std::string str(999, ' ');
         str.push_back('a');
         TEST_FORMAT(str.data(), "{0:>1000}", "a");
@@ -380,6 +709,170 @@ int main()
         }
     }
 
+    TEST_CASE("Compiled formats")
+    {
+        // it should fall back to parsing the format if it has too many segments
+        {
+            const sp::CompiledFormat<2> fmt("{}, {}, {}");
+            REQUIRE(!fmt.compiled());
+            REQUIRE(fmt.end() == fmt.begin());
+
+            char buffer[16];
+            const auto written = sp::format(buffer, fmt, 1, 2, 3);
+            REQUIRE(written == 7);
+            REQUIRE(std::memcmp(buffer, "1, 2, 3", 7) == 0);
+        }
+
+        // it should pre-parse the fields
+        {
+            const sp::CompiledFormat<4> fmt("a{2:>4}b{:x}");
+            REQUIRE(fmt.compiled());
+            REQUIRE(fmt.end() - fmt.begin() == 2);
+
+            const auto& first = fmt.begin()[0];
+            REQUIRE(first.token.literal.length == 1);
+            REQUIRE(first.token.hasField);
+            REQUIRE(first.token.field.index == 2);
+            REQUIRE(first.parsed);
+            REQUIRE(first.flags.align == '>');
+            REQUIRE(first.flags.width == 4);
+
+            const auto& second = fmt.begin()[1];
+            REQUIRE(second.token.field.index == 3);
+            REQUIRE(second.flags.type == 'x');
+
+            char buffer[16];
+            const auto written = sp::format(buffer, fmt, 0, 0, 7, 255);
+            REQUIRE(written == 8);
+            REQUIRE(std::memcmp(buffer, "a   7bff", 8) == 0);
+        }
+
+        // it should only use the length up to the null terminator
+        {
+            char str[16] = "{}";
+            const sp::CompiledFormat<2> fmt(str);
+            REQUIRE(fmt.source().length == 2);
+        }
+
+#if __cplusplus >= 201402L
+        // it should be possible to compile formats at compile time
+        {
+            static constexpr sp::CompiledFormat<4> fmt("{:>{}}|{:.2f}");
+            static_assert(fmt.compiled(), "format not compiled");
+            static_assert(fmt.end() - fmt.begin() == 2, "bad segment count");
+            static_assert(fmt.begin()[1].token.field.index == 2, "bad nested index");
+            static_assert(fmt.begin()[1].flags.precision == 2, "bad precision");
+
+            char buffer[16];
+            const auto written = sp::format(buffer, fmt, 'x', 3, 1.0);
+            REQUIRE(written == 8);
+            REQUIRE(std::memcmp(buffer, "  x|1.00", 8) == 0);
+        }
+#endif
+    }
+
+    TEST_CASE("Format literals")
+    {
+        // it should check formats against the types of their arguments
+        {
+            using Arg = sp::FormatArg;
+            const Arg::Type types[] = { Arg::TYPE_INT, Arg::TYPE_STRING, Arg::TYPE_DOUBLE, Arg::TYPE_CUSTOM };
+
+            REQUIRE(sp::check_format("{:x} {:>4} {:.2f} {:foo}", types, 4) == sp::FORMAT_OK);
+            REQUIRE(sp::check_format("{3} {{ }} {0:{0}} {1} {2}", types, 4) == sp::FORMAT_OK);
+            REQUIRE(sp::check_format("{} {} {}", types, 4) == sp::FORMAT_UNUSED_ARG);
+            REQUIRE(sp::check_format("{} {} {} {} {}", types, 4) == sp::FORMAT_MISSING_ARG);
+            REQUIRE(sp::check_format("{0!s} {} {} {}", types, 4) == sp::FORMAT_INVALID_FIELD);
+            REQUIRE(sp::check_format("{} {} {} {} {", types, 4) == sp::FORMAT_INVALID_FIELD);
+            REQUIRE(sp::check_format("{} {} {:.} {}", types, 4) == sp::FORMAT_INVALID_SPEC);
+            REQUIRE(sp::check_format("{:f} {} {} {}", types, 4) == sp::FORMAT_TYPE_MISMATCH);
+            REQUIRE(sp::check_format("{:.2} {} {} {}", types, 4) == sp::FORMAT_TYPE_MISMATCH);
+            REQUIRE(sp::check_format("{} {:d} {} {}", types, 4) == sp::FORMAT_TYPE_MISMATCH);
+            REQUIRE(sp::check_format("{} {} {:x} {}", types, 4) == sp::FORMAT_TYPE_MISMATCH);
+            REQUIRE(sp::check_format("", types, 0) == sp::FORMAT_OK);
+        }
+
+        // it should format through any output
+        {
+            char buffer[32];
+            auto written = sp::format(buffer, SP_FMT("{:>4}|{:.2f}|{{}}"), 12, 1.5);
+            REQUIRE(written == 12);
+            REQUIRE(std::memcmp(buffer, "  12|1.50|{}", 12) == 0);
+
+            written = sp::format(buffer, 4, SP_FMT("{}-{}"), "ab", 'c');
+            REQUIRE(written == 4);
+            REQUIRE(std::memcmp(buffer, "ab-c", 4) == 0);
+
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            sp::format(writer, SP_FMT("{1}{0:{1}}"), Foo(), 3);
+            REQUIRE(writer.result() == 2);
+            REQUIRE(std::memcmp(buffer, "33", 2) == 0);
+
+            REQUIRE(sp::formatted_size(SP_FMT("{:08}"), 5) == 8);
+            REQUIRE(std::strcmp(sp::format_to_string(SP_FMT("{:#x}"), 255u).c_str(), "0xff") == 0);
+        }
+
+#if __cplusplus >= 201402L
+        // it should check formats at compile time
+        {
+            constexpr sp::FormatArg::Type types[] = { sp::FormatArg::TYPE_UINT };
+            static_assert(sp::check_format(sp::StringView("{:b}", 4), types, 1) == sp::FORMAT_OK, "bad check");
+            static_assert(sp::check_format(sp::StringView("{:s}", 4), types, 1) == sp::FORMAT_TYPE_MISMATCH, "bad check");
+
+            const auto literal = SP_FMT("a{}b{}");
+            using Literal = std::decay<decltype(literal)>::type;
+            static_assert(sp::LiteralFormat<Literal>::get().compiled(), "literal not compiled");
+            static_assert(sp::LiteralFormat<Literal>::get().end() - sp::LiteralFormat<Literal>::get().begin() == 2, "bad segment count");
+        }
+#endif
+    }
+
+    TEST_CASE("Format arguments")
+    {
+        // it should type-erase the arguments
+        {
+            int value = 5;
+            const auto store = sp::make_format_args(true, 'x', -1, 2u, 1.5f, 2.5, "str", &value, Foo{});
+            const sp::FormatArgs args = store;
+
+            REQUIRE(args.size() == 9);
+            REQUIRE(args[0].type == sp::FormatArg::TYPE_BOOL);
+            REQUIRE(args[1].type == sp::FormatArg::TYPE_CHAR);
+            REQUIRE(args[2].type == sp::FormatArg::TYPE_INT);
+            REQUIRE(args[3].type == sp::FormatArg::TYPE_UINT);
+            REQUIRE(args[4].type == sp::FormatArg::TYPE_FLOAT);
+            REQUIRE(args[5].type == sp::FormatArg::TYPE_DOUBLE);
+            REQUIRE(args[6].type == sp::FormatArg::TYPE_STRING);
+            REQUIRE(args[7].type == sp::FormatArg::TYPE_POINTER);
+            REQUIRE(args[8].type == sp::FormatArg::TYPE_CUSTOM);
+            REQUIRE(args[9].type == sp::FormatArg::TYPE_NONE);
+            REQUIRE(args[-1].type == sp::FormatArg::TYPE_NONE);
+        }
+
+        // it should be possible to format stored arguments later
+        {
+            const auto store = sp::make_format_args(42, "foo", Foo{});
+
+            char buffer[32];
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            sp::vformat(writer, "{1:>4}|{0:x}|{0}|{2:bar}|{3}", store);
+            REQUIRE(writer.result() == 18);
+            REQUIRE(std::memcmp(buffer, " foo|2a|42|bar|{3}", 18) == 0);
+        }
+
+        // it should be possible to format stored arguments with compiled formats
+        {
+            const sp::CompiledFormat<4> fmt("{:+}{}");
+            const auto store = sp::make_format_args(7, 8);
+
+            char buffer[32];
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            sp::vformat(writer, fmt, store);
+            REQUIRE(writer.result() == 3);
+            REQUIRE(std::memcmp(buffer, "+78", 3) == 0);
+        }
+    }
+
     TEST_CASE("StringWriter") {
         char buffer[64];
         sp::StringWriter writer(buffer, sizeof(buffer));
@@ -395,6 +888,1068 @@ int main()
         REQUIRE(writer.result() == sizeof(data) * 3);
     }
 
+    TEST_CASE("BufferedWriter")
+    {
+        // it should fill in bulk
+        {
+            char buffer[8] = { 0 };
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(writer.fill(3, 'x') == 3);
+            REQUIRE(writer.fill(6, 'y') == 5);
+            REQUIRE(writer.result() == 9);
+            REQUIRE(std::memcmp(buffer, "xxxyyyyy", 8) == 0);
+        }
+
+        // it should write and fill every length exactly
+        {
+            const char source[] = "0123456789abcdefghij";
+
+            for (size_t length = 0; length < 20; ++length) {
+                char buffer[64];
+                std::memset(buffer, '.', sizeof(buffer));
+                sp::StringWriter writer(buffer, sizeof(buffer));
+                REQUIRE(writer.write(length, source) == length);
+                REQUIRE(writer.fill(length, '*') == length);
+                REQUIRE(writer.result() == int32_t(length * 2));
+                REQUIRE(std::memcmp(buffer, source, length) == 0);
+                REQUIRE(std::count(buffer + length, buffer + length * 2, '*') == std::ptrdiff_t(length));
+                REQUIRE(buffer[length * 2] == '.');
+            }
+        }
+
+        // it should only commit reserved data once committed
+        {
+            char buffer[8] = { 0 };
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            char* reserved = writer.reserve(4);
+            REQUIRE(reserved == buffer);
+            std::memcpy(reserved, "abcd", 4);
+            REQUIRE(writer.result() == 0);
+            writer.commit(2);
+            REQUIRE(writer.result() == 2);
+            REQUIRE(writer.reserve(7) == nullptr);
+            REQUIRE(writer.reserve(6) == buffer + 2);
+        }
+
+        // it should write to other writers in chunks
+        {
+            CountingWriter counter;
+            sp::format(counter, "{:>40}|{:<40}|{:^40}", 1, 2.0, "three");
+            REQUIRE(counter.length == 122);
+            REQUIRE(counter.writes == 1);
+
+            counter = CountingWriter();
+            sp::format(counter, "{:>1000}", 1);
+            REQUIRE(counter.length == 1000);
+            REQUIRE(counter.writes == 4);
+        }
+    }
+
+    TEST_CASE("MemoryWriter")
+    {
+        // it should keep small outputs inline
+        {
+            CountingAllocator allocator;
+            sp::MemoryWriter writer(&allocator);
+            sp::format(writer, "{}-{}", "abc", 123);
+            REQUIRE(writer.result() == 7);
+            REQUIRE(std::strcmp(writer.c_str(), "abc-123") == 0);
+            REQUIRE(allocator.allocations == 0);
+        }
+
+        // it should grow geometrically, and free the memory again
+        {
+            CountingAllocator allocator;
+            {
+                sp::MemoryWriter writer(&allocator);
+                sp::format(writer, "{:x>1000}|{:y<3000}", 1, 2);
+                REQUIRE(writer.result() == 4001);
+                REQUIRE(writer.length() == 4001);
+                REQUIRE(writer.data()[999] == '1');
+                REQUIRE(writer.data()[1000] == '|');
+                REQUIRE(writer.data()[1001] == '2');
+                REQUIRE(writer.data()[4000] == 'y');
+                REQUIRE(allocator.allocations > 0 && allocator.allocations <= 3);
+
+                const auto allocations = allocator.allocations;
+
+                writer.clear();
+                sp::format(writer, "{:z>2000}", 3);
+                REQUIRE(writer.length() == 2000);
+                REQUIRE(allocator.allocations == allocations);
+            }
+            REQUIRE(allocator.outstanding == 0);
+        }
+
+        // it should move without copying heap memory
+        {
+            CountingAllocator allocator;
+            auto first = sp::format_to_string(allocator, "{:>500}", "moved");
+            const char* data = first.data();
+            sp::MemoryWriter second(std::move(first));
+            REQUIRE(second.data() == data);
+            REQUIRE(second.length() == 500);
+            REQUIRE(first.length() == 0);
+            REQUIRE(allocator.allocations == 1);
+
+            auto small = sp::format_to_string("{} {}", 1.5, true);
+            REQUIRE(std::strcmp(small.c_str(), "1.5 true") == 0);
+            second = std::move(small);
+            REQUIRE(std::strcmp(second.c_str(), "1.5 true") == 0);
+            REQUIRE(allocator.outstanding == 0);
+
+            static const sp::CompiledFormat<2> fmt("[{}]");
+            REQUIRE(std::strcmp(sp::format_to_string(fmt, 42).c_str(), "[42]") == 0);
+        }
+    }
+
+    TEST_CASE("Format ranges")
+    {
+        const double values[] = { 1.5, -2.25, 1000 };
+        const int ints[] = { 1, 22, 333 };
+        const Point points[] = { { 1, 2 }, { 3, 4 } };
+        char buffer[64];
+
+        // it should format every value with the same specifier
+        {
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(sp::format_range(writer, ">9.3f", values, values + 3, ","));
+            REQUIRE(writer.result() == 29);
+            REQUIRE(std::memcmp(buffer, "    1.500,   -2.250, 1000.000", 29) == 0);
+        }
+
+        // it should write nothing for an empty range
+        {
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(sp::format_range(writer, "", ints, ints, ","));
+            REQUIRE(writer.result() == 0);
+        }
+
+        // it should stop at values that can't be formatted
+        {
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(!sp::format_range(writer, ".", ints, ints + 3, ","));
+            REQUIRE(writer.result() == 0);
+        }
+
+        // it should pass custom specifiers through
+        {
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(sp::format_range(writer, "[x", points, points + 2, " "));
+            REQUIRE(writer.result() == 7);
+            REQUIRE(std::memcmp(buffer, "[1] [3]", 7) == 0);
+        }
+
+        // it should format rows from columns
+        {
+            const char* names[] = { "a", "bb", "ccc" };
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            sp::format_columns(writer, "{:<3}|{:4}|{:.1f}\n", 3, names, ints, values);
+            REQUIRE(writer.result() == 43);
+            REQUIRE(std::memcmp(buffer, "a  |   1|1.5\nbb |  22|-2.2\nccc| 333|1000.0\n", 43) == 0);
+        }
+
+        // it should fall back to parsing formats that don't compile
+        {
+            const sp::CompiledFormat<1> fmt("{{{}}}");
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            sp::format_columns(writer, fmt, 2, ints);
+            REQUIRE(writer.result() == 7);
+            REQUIRE(std::memcmp(buffer, "{1}{22}", 7) == 0);
+        }
+    }
+
+    TEST_CASE("Time formats")
+    {
+        using Micros = std::chrono::time_point<std::chrono::system_clock, std::chrono::microseconds>;
+        using Seconds = std::chrono::time_point<std::chrono::system_clock, std::chrono::seconds>;
+
+        const Micros time(std::chrono::microseconds(1700000000123456ll));
+
+        TEST_FORMAT("2023-11-14 22:13:20", "{}", time);
+        TEST_FORMAT("2023-11-14 22:13:20.123456", "{:%Y-%m-%d %H:%M:%S.%f}", time);
+        TEST_FORMAT("[2023-11-14T22:13:20] 100%", "[{:%FT%T}] 100%", time);
+        TEST_FORMAT("20 22 123456%", "{:%S} {:%H %f%%}", time, time);
+        TEST_FORMAT("2000-02-29 00:00:00", "{}", Seconds(std::chrono::seconds(951782400)));
+        TEST_FORMAT("1969-12-31 23:59:59.999999", "{:%F %T.%f}", Micros(std::chrono::microseconds(-1)));
+        TEST_FORMAT("9999-12-31 23:59:59", "{}", Seconds(std::chrono::seconds(253402300799ll)));
+        TEST_FORMAT("10000-01-01", "{:%F}", Seconds(std::chrono::seconds(253402300800ll)));
+        TEST_FORMAT("0001-01-01 00:00:00", "{}", Seconds(std::chrono::seconds(-62135596800ll)));
+        TEST_FORMAT("0000-12-31", "{:%F}", Seconds(std::chrono::seconds(-62135596800ll - 86400)));
+        TEST_FORMAT("-1-12-31", "{:%F}", Seconds(std::chrono::seconds(-62135596800ll - 367 * 86400ll)));
+        TEST_FORMAT("1970-01-01 00:00:00.000000", "{:%F %T.%f}", std::chrono::system_clock::time_point());
+
+        // it should output fields with invalid specifiers as-is
+        TEST_FORMAT("{:%Q}", "{:%Q}", time);
+        TEST_FORMAT("{:%}", "{:%}", time);
+
+        // it should only reuse the cached second for the same second
+        for (long long i = 0; i < 2500000; i += 250001) {
+            char buffer[64];
+            const auto length = sp::format(buffer, "{:%H:%M:%S.%f}", Micros(std::chrono::microseconds(1700000000000000ll + i)));
+            char expected[64];
+            std::snprintf(expected, sizeof(expected), "22:13:%02d.%06d", int(20 + i / 1000000), int(i % 1000000));
+            REQUIRE(std::string(buffer, size_t(length)) == expected);
+        }
+
+        // it should format durations with their unit
+        TEST_FORMAT("42ms", "{}", std::chrono::milliseconds(42));
+        TEST_FORMAT("   42us", "{:>5}", std::chrono::microseconds(42));
+        TEST_FORMAT("-7ns 3s 2min 5h 1d", "{} {} {} {} {}", std::chrono::nanoseconds(-7), std::chrono::seconds(3), std::chrono::minutes(2), std::chrono::hours(5), std::chrono::duration<int, std::ratio<86400>>(1));
+        TEST_FORMAT("1.50s", "{:.2f}", std::chrono::duration<double>(1.5));
+        TEST_FORMAT("2[1/3]s 4[2]s", "{} {}", std::chrono::duration<int, std::ratio<1, 3>>(2), std::chrono::duration<int, std::ratio<2>>(4));
+        TEST_FORMAT("{:.}", "{:.}", std::chrono::seconds(1));
+    }
+
+    TEST_CASE("Containers and tuples")
+    {
+        const std::vector<int> ints = { 1, 22, 333 };
+        const std::vector<int> none;
+        const std::map<int, const char*> names = { { 1, "one" }, { 2, "two" } };
+        const std::vector<std::vector<int>> nested = { { 10 }, { 11, 12 } };
+        const std::vector<Point> points = { { 1, 2 }, { 3, 4 } };
+        const std::vector<std::pair<int, bool>> pairs = { { 1, true } };
+
+        TEST_FORMAT("[1, 22, 333]", "{}", ints);
+        TEST_FORMAT("[]", "{}", none);
+        TEST_FORMAT("[  1,  16, 14d]", "{::>3x}", ints);
+        TEST_FORMAT("001, 022, 333", "{:n:03}", ints);
+        TEST_FORMAT("[1, 22, 333]", "{::}", ints);
+        TEST_FORMAT("{1: one, 2: two}", "{}", names);
+        TEST_FORMAT("{    1:   one,     2:   two}", "{::>5}", names);
+        TEST_FORMAT("[[a], [b, c]]", "{:::x}", nested);
+        TEST_FORMAT("[[1, 2], [3, 4]]", "{::[}", points);
+        TEST_FORMAT("[(1, true)]", "{}", pairs);
+        TEST_FORMAT("[1, 2]", "{}", (std::array<int, 2>{ { 1, 2 } }));
+        TEST_FORMAT("(1, 2.5)", "{}", std::make_pair(1, 2.5));
+        TEST_FORMAT("(1, a, true)", "{}", std::make_tuple(1, "a", true));
+        TEST_FORMAT("01, 02", "{:n:02}", std::make_tuple(1, 2u));
+        TEST_FORMAT("()", "{}", std::tuple<>());
+
+        // it should output fields with invalid specifiers as-is
+        TEST_FORMAT("{:x}", "{:x}", ints);
+        TEST_FORMAT("{::.}", "{::.}", std::make_tuple(1));
+        TEST_FORMAT("{:n:y}", "{:n:y}", points);
+
+        // it should format large ranges in a single pass
+        {
+            std::vector<unsigned> values(1000);
+            for (size_t i = 0; i < values.size(); ++i) {
+                values[i] = unsigned(i);
+            }
+
+            const auto size = sp::formatted_size("{::04x}", values);
+            REQUIRE(size == 2 + 1000 * 4 + 999 * 2);
+
+            const auto string = sp::format_to_string("{::04x}", values);
+            REQUIRE(ptrdiff_t(string.length()) == size);
+            REQUIRE(std::memcmp(string.data(), "[0000, 0001, ", 13) == 0);
+            REQUIRE(std::memcmp(string.data() + size - 7, ", 03e7]", 7) == 0);
+        }
+    }
+
+    TEST_CASE("Rendered formats")
+    {
+        const auto text = [](const sp::StringView& str) { return std::string(str.ptr, size_t(str.length)); };
+
+        static const sp::CompiledFormat<8> fmt("cpu {:>3}% mem {:>5.1f}M {} [{}]");
+        sp::RenderedFormat status(fmt);
+
+        REQUIRE(text(status.render(12, 200.5, "ok", 'x')) == "cpu  12% mem 200.5M ok [x]");
+        REQUIRE(status.formatted() == 4);
+
+        // it should only format the fields that may have changed
+        REQUIRE(text(status.render(12, 200.5, "ok", 'x')) == "cpu  12% mem 200.5M ok [x]");
+        REQUIRE(status.formatted() == 1);
+        REQUIRE(text(status.render(13, 200.5, "ok", 'x')) == "cpu  13% mem 200.5M ok [x]");
+        REQUIRE(status.formatted() == 2);
+
+        // it should lay out the output again when a field changes length
+        REQUIRE(text(status.render(1000, 200.5, "failed", 'x')) == "cpu 1000% mem 200.5M failed [x]");
+        REQUIRE(status.formatted() == 2);
+        REQUIRE(text(status.output()) == "cpu 1000% mem 200.5M failed [x]");
+        REQUIRE(text(status.render(5, 1.0, "ok", 'y')) == "cpu   5% mem   1.0M ok [y]");
+        REQUIRE(status.formatted() == 4);
+
+        // it should render the same as formatting in full
+        {
+            static const sp::CompiledFormat<8> row("{}|{:{}}|{:x}|{}");
+            sp::RenderedFormat rendered(row);
+            char name[8] = "abc";
+
+            for (int i = 0; i < 200; ++i) {
+                name[i % 3] = char('a' + i % 26);
+                const auto width = 2 + i / 50;
+                const auto value = i % 7 ? i / 10 : -i * 1000;
+                auto expected = sp::format_to_string(row, value, name, width, unsigned(i / 3), i % 5 == 0);
+                REQUIRE(text(rendered.render(value, name, width, unsigned(i / 3), i % 5 == 0)) == expected.c_str());
+            }
+        }
+
+        // it should render formats exceeding their capacity in full
+        {
+            static const sp::CompiledFormat<1> small("{} {}");
+            sp::RenderedFormat rendered(small);
+            REQUIRE(text(rendered.render(1, 2)) == "1 2");
+            REQUIRE(text(rendered.render(1, 3)) == "1 3");
+        }
+    }
+
+    TEST_CASE("IoVecWriter")
+    {
+        const auto join = [](sp::IoVecWriter& writer) {
+            std::string joined;
+            for (size_t i = 0; i < writer.count(); ++i) {
+                joined.append(static_cast<const char*>(writer.entries()[i].iov_base), writer.entries()[i].iov_len);
+            }
+            return joined;
+        };
+
+        // it should reference long literals and strings, and copy the rest
+        {
+            const char fmt[] = "a literal long enough{:>4}|{}";
+            const std::string str(32, 's');
+            sp::IoVecWriter writer(16);
+            sp::format(writer, fmt, 42, str.c_str());
+
+            REQUIRE(writer.result() == 58);
+            REQUIRE(writer.count() == 3);
+            REQUIRE(writer.entries()[0].iov_base == fmt);
+            REQUIRE(writer.entries()[0].iov_len == 21);
+            REQUIRE(writer.entries()[2].iov_base == str.c_str());
+            REQUIRE(join(writer) == std::string("a literal long enough  42|") + str);
+        }
+
+        // it should merge adjacent copies into one entry
+        {
+            sp::IoVecWriter writer;
+            sp::format(writer, "{}:{:x}:{}", 1, 255, "str");
+            REQUIRE(writer.count() == 1);
+            REQUIRE(join(writer) == "1:ff:str");
+        }
+
+        // it should grow without moving what was written
+        CountingAllocator allocator;
+        {
+            const std::string str(100, 'x');
+            sp::IoVecWriter writer(64, &allocator);
+
+            for (int i = 0; i < 40; ++i) {
+                sp::format(writer, "{:>200}{}", i, str.c_str());
+            }
+            REQUIRE(writer.result() == 40 * 300);
+            REQUIRE(writer.count() >= 80);
+            REQUIRE(allocator.allocations > 0);
+
+            std::string expected;
+            for (int i = 0; i < 40; ++i) {
+                expected += sp::format_to_string("{:>200}", i).c_str() + str;
+            }
+            REQUIRE(join(writer) == expected);
+
+            writer.clear();
+            REQUIRE(writer.count() == 0);
+            REQUIRE(writer.result() == 0);
+            sp::format(writer, "{}", 7);
+            REQUIRE(join(writer) == "7");
+        }
+        REQUIRE(allocator.outstanding == 0);
+
+#if defined(SP_ENABLE_POSIX)
+        // it should be possible to write the entries with writev
+        {
+            const std::string str(80, 'z');
+            sp::IoVecWriter writer;
+            sp::format(writer, "{}={:08.3f}\n", str.c_str(), 3.5);
+
+            FILE* file = std::tmpfile();
+            REQUIRE(file);
+            const auto fd = fileno(file);
+            REQUIRE(writev(fd, writer.entries(), int(writer.count())) == 90);
+
+            char buffer[128];
+            lseek(fd, 0, SEEK_SET);
+            REQUIRE(read(fd, buffer, sizeof(buffer)) == 90);
+            REQUIRE(std::string(buffer, 90) == str + "=0003.500\n");
+            std::fclose(file);
+        }
+#endif
+    }
+
+#if defined(SP_ENABLE_POSIX)
+    TEST_CASE("FdWriter")
+    {
+        FILE* file = std::tmpfile();
+        REQUIRE(file);
+        const auto fd = fileno(file);
+
+        // it should write its buffer whenever it is full, and once destroyed
+        {
+            sp::FdWriter writer(fd, 16);
+            sp::format(writer, "{:>20}|{}", 1, "two");
+            REQUIRE(writer.result() == 24);
+            REQUIRE(lseek(fd, 0, SEEK_CUR) == 16);
+            writer.flush();
+            REQUIRE(lseek(fd, 0, SEEK_CUR) == 24);
+            sp::format(writer, "!");
+        }
+
+        char buffer[32];
+        lseek(fd, 0, SEEK_SET);
+        REQUIRE(read(fd, buffer, sizeof(buffer)) == 25);
+        REQUIRE(std::memcmp(buffer, "                   1|two!", 25) == 0);
+
+        // it should report errors
+        {
+            sp::FdWriter writer(-1);
+            sp::format(writer, "x");
+            writer.flush();
+            REQUIRE(writer.result() == -1);
+        }
+
+        // it should fail rather than retry when the descriptor takes nothing
+        {
+            int fds[2];
+            REQUIRE(pipe(fds) == 0);
+            REQUIRE(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+            char chunk[4096] = {};
+            while (write(fds[1], chunk, sizeof(chunk)) > 0) {
+            }
+
+            sp::FdWriter writer(fds[1], 16);
+            sp::format(writer, "{:>40}", 1);
+            writer.flush();
+            REQUIRE(writer.result() == -1);
+
+            close(fds[0]);
+            close(fds[1]);
+        }
+
+        std::fclose(file);
+    }
+
+    TEST_CASE("MmapWriter")
+    {
+        FILE* file = std::tmpfile();
+        REQUIRE(file);
+        const auto fd = fileno(file);
+
+        // it should grow the file, and truncate it to the output once finished
+        {
+            sp::MmapWriter writer(fd, 1000);
+            for (int i = 0; i < 1000; ++i) {
+                sp::format(writer, "{:>9}\n", i);
+            }
+            REQUIRE(writer.result() == 10000);
+            REQUIRE(writer.finish());
+            REQUIRE(writer.result() == 10000);
+        }
+        REQUIRE(lseek(fd, 0, SEEK_END) == 10000);
+
+        std::string contents(10000, 0);
+        lseek(fd, 0, SEEK_SET);
+        REQUIRE(read(fd, &contents[0], contents.size()) == 10000);
+
+        bool matches = true;
+        for (int i = 0; i < 1000; ++i) {
+            matches = matches && contents.compare(size_t(i) * 10, 10, sp::format_to_string("{:>9}\n", i).c_str()) == 0;
+        }
+        REQUIRE(matches);
+
+        // it should replace the contents of the file
+        {
+            sp::MmapWriter writer(fd);
+            sp::format(writer, "short");
+        }
+        REQUIRE(lseek(fd, 0, SEEK_END) == 5);
+
+        // it should report errors
+        {
+            sp::MmapWriter writer(-1);
+            sp::format(writer, "x");
+            REQUIRE(writer.result() == -1);
+            REQUIRE(!writer.finish());
+        }
+
+        // it should discard anything written once finished
+        {
+            sp::MmapWriter writer(fd);
+            sp::format(writer, "short");
+            REQUIRE(writer.finish());
+            sp::format(writer, "{:>10}", 1);
+            REQUIRE(writer.result() == -1);
+        }
+        REQUIRE(lseek(fd, 0, SEEK_END) == 5);
+
+        // it should keep what was written when the file fails to grow
+        {
+            struct rlimit limit;
+            REQUIRE(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+            const auto prevLimit = limit.rlim_cur;
+            const auto prevHandler = std::signal(SIGXFSZ, SIG_IGN);
+            limit.rlim_cur = 8192;
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+            {
+                sp::MmapWriter writer(fd, 4096);
+                sp::format(writer, "{:>100}", 1);
+                REQUIRE(!writer.reserve(8192));
+                sp::format(writer, "after");
+                REQUIRE(writer.result() == -1);
+                REQUIRE(!writer.finish());
+            }
+
+            limit.rlim_cur = prevLimit;
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+            std::signal(SIGXFSZ, prevHandler);
+        }
+        REQUIRE(lseek(fd, 0, SEEK_END) == 100);
+
+        std::fclose(file);
+    }
+#endif
+
+    TEST_CASE("Formatted size")
+    {
+        // it should count without writing anything
+        {
+            sp::SizeWriter writer;
+            REQUIRE(writer.counting());
+            sp::format(writer, "{:>8}|{:#x}|{}|{:.3f}", "abc", 255, -12345, 2.5);
+            REQUIRE(writer.result() == 26);
+        }
+
+        // it should match the formatted length of a compiled format
+        {
+            static const sp::CompiledFormat<4> fmt("{:+} {:^9} {}");
+            REQUIRE(sp::formatted_size(fmt, 7, 'x', Foo()) == 20);
+        }
+
+        // it should count output that doesn't fit a string writer
+        {
+            REQUIRE(sp::format((char*)nullptr, 0, "{:>100}", 1) == 100);
+        }
+
+        // it should count beyond 32 bits
+        if (sizeof(ptrdiff_t) > 4) {
+            const auto expected = ptrdiff_t(3) * 2000000000 + 1;
+            REQUIRE(sp::formatted_size("{:>2000000000}{:>2000000000}{:2000000000}!", 1, 2.5, "x") == expected);
+
+            char buffer[8];
+            REQUIRE(sp::format(buffer, "{0:*>2000000000}{0:*>2000000000}{0:*>2000000000}!", 1) == expected);
+            REQUIRE(std::memcmp(buffer, "********", 8) == 0);
+        }
+    }
+
+    TEST_CASE("Format stats")
+    {
+        const auto find_stat = [](const sp::FormatStats* stats, size_t count, const char* fmt) {
+            return std::find_if(stats, stats + count, [fmt](const sp::FormatStats& s) {
+                return s.length == ptrdiff_t(std::strlen(fmt)) && std::memcmp(s.format.ptr, fmt, size_t(s.format.length)) == 0;
+            });
+        };
+
+        // it should count the calls and bytes of each format string
+        {
+            sp::reset_format_stats();
+
+            static const char* const fmt = "stats {}";
+            char buffer[32];
+            for (int i = 0; i < 10; ++i) {
+                sp::format(buffer, fmt, i);
+            }
+
+            static const sp::CompiledFormat<4> compiled(fmt);
+            REQUIRE(sp::format(buffer, compiled, 100) == 9);
+
+            sp::FormatStats stats[64];
+            const auto count = sp::format_stats(stats, 64);
+            REQUIRE(count > 0 && count <= 64);
+
+            const auto stat = find_stat(stats, count, fmt);
+            REQUIRE(stat != stats + count);
+            REQUIRE(stat->format.length == 8);
+            REQUIRE(stat->format.ptr != fmt);
+            REQUIRE(stat->calls == 11);
+            REQUIRE(stat->bytes == 10 * 7 + 9);
+            REQUIRE(stat->truncations == 0);
+        }
+
+        // it should count calls whose output was truncated
+        {
+            static const char* const fmt = "truncated {}";
+            char buffer[8];
+            sp::format(buffer, fmt, 1);
+            sp::format(buffer, fmt, 1);
+
+            sp::FormatStats stats[64];
+            const auto count = sp::format_stats(stats, 64);
+            const auto stat = find_stat(stats, count, fmt);
+            REQUIRE(stat != stats + count);
+            REQUIRE(stat->calls == 2);
+            REQUIRE(stat->bytes == 2 * 11);
+            REQUIRE(stat->truncations == 2);
+        }
+
+        // it should count equal format strings together, wherever they are
+        {
+            static const char first[] = "same {}";
+            char second[] = "same {}";
+            char buffer[16];
+            sp::format(buffer, first, 1);
+            sp::format(buffer, second, 2);
+            std::memcpy(second, "else {}", 7);
+            sp::format(buffer, second, 3);
+
+            sp::FormatStats stats[64];
+            const auto count = sp::format_stats(stats, 64);
+            const auto same = find_stat(stats, count, "same {}");
+            REQUIRE(same != stats + count);
+            REQUIRE(same->calls == 2);
+            const auto other = find_stat(stats, count, "else {}");
+            REQUIRE(other != stats + count);
+            REQUIRE(other->calls == 1);
+        }
+
+        // it should keep the counters of formats that no longer exist
+        {
+            auto fmt = new std::string("freed {}");
+            char buffer[16];
+            sp::format(buffer, sp::StringView(fmt->c_str(), ptrdiff_t(fmt->size())), 1);
+            delete fmt;
+
+            sp::MemoryWriter writer;
+            sp::dump_format_stats(writer);
+            const std::string result(writer.data(), writer.length());
+            REQUIRE(result.find("  freed {}\n") != std::string::npos);
+        }
+
+        // it should keep the start of long format strings
+        {
+            const std::string fmt = std::string(200, '-') + "{}";
+            char buffer[8];
+            sp::format(buffer, sp::StringView(fmt.c_str(), ptrdiff_t(fmt.size())), 1);
+
+            sp::FormatStats stats[64];
+            const auto count = sp::format_stats(stats, 64);
+            const auto stat = std::find_if(stats, stats + count, [](const sp::FormatStats& s) { return s.length == 202; });
+            REQUIRE(stat != stats + count);
+            REQUIRE(stat->format.length < stat->length);
+            REQUIRE(std::string(stat->format.ptr, size_t(stat->format.length)) == fmt.substr(0, size_t(stat->format.length)));
+
+            sp::MemoryWriter writer;
+            sp::dump_format_stats(writer);
+            const std::string result(writer.data(), writer.length());
+            REQUIRE(result.find("-...\n") != std::string::npos);
+        }
+
+        // it should publish the text of formats claimed by other threads
+        {
+            static const char* const formats[] = { "a {}", "bb {}", "ccc {}", "dddd {}" };
+            std::thread threads[4];
+            for (int t = 0; t < 4; ++t) {
+                threads[t] = std::thread([t]() {
+                    char buffer[16];
+                    for (int i = 0; i < 100; ++i) {
+                        sp::format(buffer, formats[(t + i) % 4], i);
+                    }
+                });
+            }
+
+            sp::FormatStats stats[64];
+            for (int i = 0; i < 100; ++i) {
+                const auto count = std::min(sp::format_stats(stats, 64), size_t(64));
+                for (size_t j = 0; j < count; ++j) {
+                    REQUIRE(stats[j].format.ptr && stats[j].format.length == std::min(stats[j].length, ptrdiff_t(120)));
+                }
+            }
+
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            const auto count = sp::format_stats(stats, 64);
+            for (auto fmt : formats) {
+                const auto stat = find_stat(stats, count, fmt);
+                REQUIRE(stat != stats + count);
+                REQUIRE(stat->calls == 100);
+            }
+        }
+
+        // it should dump the stats, one format string per line
+        {
+            const auto count = sp::format_stats(nullptr, 0);
+            sp::MemoryWriter writer;
+            sp::dump_format_stats(writer);
+            const std::string result(writer.data(), writer.length());
+            REQUIRE(std::count(result.begin(), result.end(), '\n') == ptrdiff_t(count + 1));
+            REQUIRE(result.find("  truncated {}\n") != std::string::npos);
+        }
+
+        // it should leave its own output out of the stats
+        {
+            sp::reset_format_stats();
+            sp::MemoryWriter writer;
+            sp::dump_format_stats(writer);
+            sp::dump_format_stats(writer);
+            REQUIRE(sp::format_stats(nullptr, 0) == 0);
+        }
+
+        // it should reset the counters
+        {
+            sp::reset_format_stats();
+            REQUIRE(sp::format_stats(nullptr, 0) == 0);
+        }
+    }
+
+    TEST_CASE("Binary logs")
+    {
+        // it should decode to the same text as formatting directly
+        {
+            sp::MemoryWriter encoded;
+            sp::BinaryLogWriter log(encoded);
+            std::string expected;
+
+            for (int i = 0; i < 3; ++i) {
+                sp::format(log, "{} {:>4} {:x} {:.2f}|{}|{}|{}\n", -5 * i, 42u + unsigned(i), 255, 1.5, "str", 'c', i == 1);
+                expected += sp::format_to_string("{} {:>4} {:x} {:.2f}|{}|{}|{}\n", -5 * i, 42u + unsigned(i), 255, 1.5, "str", 'c', i == 1).c_str();
+            }
+            sp::format(log, "{:e} {} {} {}\n", 2.5f, (long long)-9000000000, 18000000000000000000ull, sp::StringView("view", 2));
+            expected += sp::format_to_string("{:e} {} {} {}\n", 2.5f, (long long)-9000000000, 18000000000000000000ull, sp::StringView("view", 2)).c_str();
+            sp::format(log, "no args\n");
+            expected += "no args\n";
+
+            sp::BinaryLogReader reader;
+            sp::MemoryWriter text;
+            REQUIRE(reader.read(text, encoded.data(), encoded.length()) == ptrdiff_t(encoded.length()));
+            REQUIRE(std::string(text.data(), text.length()) == expected);
+
+            // and also when the data arrives a byte at a time
+            sp::BinaryLogReader streamed;
+            sp::MemoryWriter streamedText;
+            std::string pending;
+
+            for (size_t i = 0; i < encoded.length(); ++i) {
+                pending.push_back(encoded.data()[i]);
+                const auto read = streamed.read(streamedText, pending.data(), pending.size());
+                REQUIRE(read >= 0);
+                pending.erase(0, size_t(read));
+            }
+            REQUIRE(pending.empty());
+            REQUIRE(std::string(streamedText.data(), streamedText.length()) == expected);
+        }
+
+        // it should only define each format once, and keep records compact
+        {
+            static const char fmt[] = "{}";
+            sp::MemoryWriter encoded;
+            sp::BinaryLogWriter log(encoded);
+
+            sp::format(log, fmt, 1);
+            const auto first = encoded.length();
+            sp::format(log, fmt, 1);
+            REQUIRE(encoded.length() - first == 4);
+            sp::format(log, fmt, -1000);
+            REQUIRE(encoded.length() - first == 9);
+        }
+
+        // it should tell many formats apart
+        {
+            std::vector<std::string> formats;
+            for (int i = 0; i < 200; ++i) {
+                formats.push_back(std::to_string(i) + ":{}\n");
+            }
+
+            sp::MemoryWriter encoded;
+            sp::BinaryLogWriter log(encoded);
+            std::string expected;
+
+            for (int pass = 0; pass < 2; ++pass) {
+                for (size_t i = 0; i < formats.size(); ++i) {
+                    sp::format(log, formats[i].c_str(), pass);
+                    expected += std::to_string(i) + ":" + std::to_string(pass) + "\n";
+                }
+            }
+
+            sp::BinaryLogReader reader;
+            sp::MemoryWriter text;
+            REQUIRE(reader.read(text, encoded.data(), encoded.length()) == ptrdiff_t(encoded.length()));
+            REQUIRE(std::string(text.data(), text.length()) == expected);
+        }
+
+        // it should define a format anew when its memory is reused
+        {
+            char fmt[32] = "one {}\n";
+            sp::MemoryWriter encoded;
+            sp::BinaryLogWriter log(encoded);
+            sp::format(log, fmt, 1);
+            std::memcpy(fmt, "two", 3);
+            sp::format(log, fmt, 2);
+            sp::format(log, fmt, 3);
+
+            sp::BinaryLogReader reader;
+            sp::MemoryWriter text;
+            REQUIRE(reader.read(text, encoded.data(), encoded.length()) == ptrdiff_t(encoded.length()));
+            REQUIRE(std::string(text.data(), text.length()) == "one 1\ntwo 2\ntwo 3\n");
+        }
+
+        // it should reject records of formats it hasn't seen defined
+        {
+            sp::BinaryLogReader reader;
+            sp::MemoryWriter text;
+            REQUIRE(reader.read(text, "\x02\x00", 2) == -1);
+            REQUIRE(reader.read(text, "\x03\x01{", 3) == -1);
+            REQUIRE(reader.read(text, "", 0) == 0);
+        }
+
+        // it should reject varints longer than 64 bits, rather than wait for more
+        {
+            sp::BinaryLogReader reader;
+            sp::MemoryWriter text;
+            const std::string corrupt(12, '\x80');
+            REQUIRE(reader.read(text, corrupt.data(), corrupt.size()) == -1);
+            REQUIRE(reader.read(text, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x02", 10) == -1);
+            REQUIRE(reader.read(text, corrupt.data(), 9) == 0);
+        }
+    }
+
+    TEST_CASE("Stream messages")
+    {
+        // it should write each message whole
+        {
+            FILE* file = std::tmpfile();
+            REQUIRE(file != nullptr);
+
+            std::thread threads[4];
+            for (int t = 0; t < 4; ++t) {
+                threads[t] = std::thread([file, t]() {
+                    for (int i = 0; i < 250; ++i) {
+                        sp::format(file, "{:>2}:{:x>{}}\n", t, 1, 100 + i * 7 % 300);
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            REQUIRE(check_lines(file, 1000));
+            std::fclose(file);
+        }
+
+        // it should queue whole messages from several threads
+        {
+            FILE* file = std::tmpfile();
+            REQUIRE(file != nullptr);
+
+            {
+                // small enough for some lines to span slots, or not fit at all
+                sp::AsyncStream stream(file, 4);
+
+                std::thread threads[4];
+                for (int t = 0; t < 4; ++t) {
+                    threads[t] = std::thread([&stream, t]() {
+                        for (int i = 0; i < 250; ++i) {
+                            sp::format(stream, "{:>2}:{:x>{}}\n", t, 1, 10 + i * 7 % 600);
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+
+                static const sp::CompiledFormat<4> fmt("{:>2}:{:x>3}\n");
+                REQUIRE(sp::format(stream, fmt, 9, 1) == 7);
+                stream.flush();
+                REQUIRE(!stream.failed());
+            }
+
+            REQUIRE(check_lines(file, 1001));
+            std::fclose(file);
+        }
+    }
+
+    TEST_CASE("Deferred messages")
+    {
+        // it should copy strings and custom types, and reference static strings
+        {
+            sp::DeferredQueue queue(256);
+            char local[] = "local";
+            static char pinned[] = "pinned";
+            REQUIRE(queue.empty());
+            REQUIRE(sp::format(queue, "{} {} {:<4} {:foo} {} {}", local, sp::static_string(pinned), 42, Foo(), 1.5, true));
+            REQUIRE(!queue.empty());
+            local[0] = 'x';
+            pinned[0] = 'x';
+
+            char buffer[64];
+            sp::StringWriter writer(buffer, sizeof(buffer));
+            REQUIRE(queue.pop(writer));
+            REQUIRE(!queue.pop(writer));
+            REQUIRE(queue.empty());
+            REQUIRE(writer.result() == 30);
+            REQUIRE(std::memcmp(buffer, "local xinned 42   foo 1.5 true", 30) == 0);
+        }
+
+        // it should reject messages that don't fit, and wrap around the end
+        {
+            sp::DeferredQueue queue(256);
+            int queued = 0;
+            while (sp::format(queue, "{}:{}", queued, "0123456789")) {
+                ++queued;
+            }
+            REQUIRE(queued > 0);
+            REQUIRE(queued < 10);
+
+            static const sp::CompiledFormat<4> fmt("{}:{}");
+            for (int i = 0; i < 100; ++i) {
+                char buffer[32];
+                sp::StringWriter writer(buffer, sizeof(buffer));
+                REQUIRE(queue.pop(writer));
+
+                char expected[32];
+                const auto length = sp::format(expected, "{}:0123456789", i < queued ? i : i - queued + 100);
+                REQUIRE(writer.result() == length);
+                REQUIRE(std::memcmp(buffer, expected, size_t(length)) == 0);
+                REQUIRE(sp::format(queue, fmt, i + 100, "0123456789"));
+            }
+        }
+
+        // it should format the queues of several threads in the background
+        {
+            FILE* file = std::tmpfile();
+            REQUIRE(file != nullptr);
+
+            {
+                sp::StreamWriter output(file);
+                sp::DeferredWriter deferred(output);
+
+                std::thread threads[4];
+                for (int t = 0; t < 4; ++t) {
+                    threads[t] = std::thread([&deferred, t]() {
+                        sp::DeferredQueue queue(1024);
+                        deferred.attach(queue);
+                        for (int i = 0; i < 250; ++i) {
+                            while (!sp::format(queue, "{:>2}:{:x>{}}\n", t, 1, 10 + i * 7 % 60)) {
+                                std::this_thread::yield();
+                            }
+                        }
+                        deferred.detach(queue);
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+
+                sp::DeferredQueue queue;
+                deferred.attach(queue);
+                REQUIRE(sp::format(queue, "{:>2}:{:x>3}\n", 9, 1));
+                deferred.flush();
+                REQUIRE(queue.empty());
+                deferred.detach(queue);
+            }
+
+            REQUIRE(check_lines(file, 1001));
+            std::fclose(file);
+        }
+    }
+
+    TEST_CASE("Batch formats")
+    {
+        static const sp::CompiledFormat<4> fmt("{}:{:x}\n");
+        const auto record = [](sp::BufferedWriter& writer, size_t index) {
+            sp::format(writer, fmt, index, index * 7);
+        };
+
+        const size_t count = 5000;
+        sp::MemoryWriter expected;
+        for (size_t i = 0; i < count; ++i) {
+            record(expected, i);
+        }
+
+        // it should write all records in order, on any amount of threads
+        for (const unsigned threads : { 1u, 3u, 0u }) {
+            sp::ThreadExecutor executor(threads);
+            std::string buffer(expected.length() + 1, '*');
+
+            REQUIRE(sp::format_batch(&buffer[0], buffer.size(), count, record, &executor) == ptrdiff_t(expected.length()));
+            REQUIRE(buffer.compare(0, expected.length(), expected.data(), expected.length()) == 0);
+            REQUIRE(buffer.back() == '*');
+
+            sp::MemoryWriter written;
+            REQUIRE(sp::format_batch(written, count, record, &executor) == ptrdiff_t(expected.length()));
+            REQUIRE(std::string(written.data(), written.length()) == std::string(expected.data(), expected.length()));
+        }
+
+        // it should stop, and report it, once the writer takes less than given
+        {
+            struct LimitedWriter : sp::IWriter {
+                size_t room = 5000;
+                size_t calls = 0;
+
+                size_t write(size_t length, const void*) override
+                {
+                    const auto written = std::min(length, room);
+                    room -= written;
+                    ++calls;
+                    return written;
+                }
+            } writer;
+
+            REQUIRE(sp::format_batch(writer, count, record) == -1);
+            REQUIRE(writer.room == 0);
+            REQUIRE(writer.calls < (count + 511) / 512);
+        }
+
+        // it should leave out what doesn't fit the buffer
+        {
+            char buffer[3000];
+            REQUIRE(sp::format_batch(buffer, sizeof(buffer), count, record) == ptrdiff_t(expected.length()));
+            REQUIRE(std::memcmp(buffer, expected.data(), sizeof(buffer)) == 0);
+        }
+
+        // it should reuse the same threads for every batch
+        {
+            struct Context {
+                std::mutex mutex;
+                std::vector<std::thread::id> ids;
+            } context;
+
+            sp::ThreadExecutor executor(3);
+            for (int i = 0; i < 50; ++i) {
+                executor.run(64, [](void* data, size_t) {
+                    auto& context = *static_cast<Context*>(data);
+                    std::lock_guard<std::mutex> lock(context.mutex);
+                    if (std::find(context.ids.begin(), context.ids.end(), std::this_thread::get_id()) == context.ids.end()) {
+                        context.ids.push_back(std::this_thread::get_id());
+                    }
+                }, &context);
+            }
+
+            REQUIRE(!context.ids.empty() && context.ids.size() <= 3);
+        }
+
+        // it should run the tasks on the provided executor
+        {
+            struct SerialExecutor : sp::IBatchExecutor {
+                size_t tasks = 0;
+
+                void run(size_t taskCount, TaskFn task, void* context) override
+                {
+                    for (size_t i = 0; i < taskCount; ++i) {
+                        task(context, i);
+                    }
+                    tasks += taskCount;
+                }
+            } executor;
+
+            char buffer[16];
+            REQUIRE(sp::format_batch(buffer, sizeof(buffer), 0, record, &executor) == 0);
+            REQUIRE(sp::format_batch(buffer, sizeof(buffer), count, record, &executor) == ptrdiff_t(expected.length()));
+            REQUIRE(executor.tasks == 2 * ((count + 511) / 512));
+        }
+    }
+
     // This should work on other platforms too, but only linux implements
     // fmemopen, which makes this a lot easier to test. Since we're only
     // really testing our own logic, and not that of the CRT, it should be
@@ -415,6 +1970,32 @@ int main()
         size_t written = writer.write(sizeof(data), data);
         REQUIRE(written == sizeof(data));
     }
+
+    TEST_CASE("Buffered StreamWriter") {
+        char buffer[2048];
+        std::memset(buffer, 0, sizeof(buffer));
+
+        FILE* stream = fmemopen(buffer, sizeof(buffer), "wb");
+        REQUIRE(stream != nullptr);
+        std::setvbuf(stream, nullptr, _IONBF, 0);
+
+        {
+            sp::StreamWriter writer(stream);
+            sp::format(writer, "{:>8}", 1);
+            REQUIRE(writer.result() == 8);
+            REQUIRE(buffer[0] == 0);
+
+            writer.flush();
+            REQUIRE(std::memcmp(buffer, "       1", 8) == 0);
+
+            // data that doesn't fit the buffer should be written in chunks
+            sp::format(writer, "{:>1500}", 2);
+            REQUIRE(writer.result() == 1508);
+        }
+
+        REQUIRE(buffer[1507] == '2');
+        std::fclose(stream);
+    }
 #endif
 
     if (!s_failed) {